@@ -90,6 +90,51 @@ typedef struct
 	 */
 	xarc_time_t mod_time;
 } xarc_item_info;
+/* Struct: xarc_extract_options
+ * Options for <xarc_extract_all>. Always initialize with
+ * <xarc_extract_options_init> before setting any fields, so that fields added
+ * in later versions get sensible defaults.
+ */
+typedef struct
+{
+	/* Variable: flags
+	 * Options controlling the extraction process (see <XARC extraction
+	 * flags>).
+	 */
+	uint8_t flags;
+	/* Variable: callback
+	 * A callback function that is called whenever a file or directory is
+	 * created, or NULL for no callbacks (see <xarc_extract_callback>).
+	 */
+	xarc_extract_callback callback;
+	/* Variable: callback_param
+	 * A parameter that is passed along unchanged to the callback function.
+	 */
+	void* callback_param;
+	/* Variable: threads
+	 * The number of threads to extract with, or 0 (the default) to use one
+	 * thread per processor. Archive types that can't be read from several
+	 * places at once are always extracted on the calling thread.
+	 */
+	uint32_t threads;
+} xarc_extract_options;
+/* Struct: xarc_open_options
+ * Options for <xarc_open_ex>. Always initialize with <xarc_open_options_init>
+ * before setting any fields, so that fields added in later versions get
+ * sensible defaults.
+ */
+typedef struct
+{
+	/* Variable: type
+	 * The type of the archive (see <XARC archive types>), or 0 (the default)
+	 * to autodetect it as <xarc_open> does.
+	 */
+	uint8_t type;
+	/* Variable: flags
+	 * Options controlling how the archive is read (see <XARC open flags>).
+	 */
+	uint8_t flags;
+} xarc_open_options;
 
 
 /* Section: Global Functions */
@@ -101,7 +146,8 @@ typedef struct
  * Parameters:
  *   file - The path to the archive file to open
  *   type - Specify the type of the archive (see <XARC archive types>); use "0"
- *     to autodetect the archive type by the file extension
+ *     to autodetect the archive type from the file's content, or failing
+ *     that, its extension
  *
  * Returns:
  *   A pointer to an <xarc> object that must always be freed with <xarc_close>,
@@ -109,6 +155,44 @@ typedef struct
  *   object to see whether the archive was opened successfully.
  */
 xarc* xarc_open(const xchar* file, uint8_t type);
+/* Function: xarc_open_options_init
+ * Fill out an <xarc_open_options> object with the default options.
+ *
+ * Parameters:
+ *   opts - Pointer to the <xarc_open_options> object to initialize
+ */
+void xarc_open_options_init(xarc_open_options* opts);
+/* Function: xarc_open_ex
+ * Open an archive for reading, with extra options.
+ *
+ * Parameters:
+ *   file - The path to the archive file to open
+ *   opts - The options to open with, or NULL for the defaults, which make this
+ *     the same as <xarc_open> with a type of 0
+ *
+ * Returns:
+ *   A pointer to an <xarc> object, exactly as for <xarc_open>.
+ */
+xarc* xarc_open_ex(const xchar* file, const xarc_open_options* opts);
+/* Function: xarc_open_memory
+ * Open an archive that is already held in memory.
+ *
+ * The archive is read in place, without being copied, so the buffer must stay
+ * valid and unchanged until the <xarc> object is closed.
+ *
+ * Parameters:
+ *   buf - The archive's data
+ *   len - Size of the data in bytes
+ *   type - Specify the type of the archive (see <XARC archive types>); use "0"
+ *     to autodetect the archive type from its content
+ *
+ * Returns:
+ *   A pointer to an <xarc> object that must always be freed with <xarc_close>,
+ *   even if xarc_open_memory was unsuccessful. You should always call
+ *   <xarc_ok> on the object to see whether the archive was opened
+ *   successfully.
+ */
+xarc* xarc_open_memory(const void* buf, size_t len, uint8_t type);
 /* Function: xarc_close
  * Closes and deallocates an <xarc> object received from <xarc_open>.
  *
@@ -230,6 +314,79 @@ xarc_result_t xarc_item_get_info(xarc* x, xarc_item_info* info);
  */
 xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
  xarc_extract_callback callback, void* callback_param);
+/* Function: xarc_item_open_stream
+ * Prepare the current archive entry to be read into memory with
+ * <xarc_item_read>, instead of being extracted to the file system.
+ *
+ * Each entry can be read through once. Some archive types (such as TAR) can
+ * only be read front to back, so an entry's data can't be read again after
+ * it has been read or extracted.
+ *
+ * Parameters:
+ *   x - Pointer to the <xarc> object to read from
+ *
+ * Returns:
+ *   XARC_OK - If the entry is ready to be read
+ *   XARC_ERR_ITEM_IS_DIR - If the current entry is a directory
+ *   <xarc_result_t> - Any other error that may have occurred (see <XARC result
+ *     codes>)
+ */
+xarc_result_t xarc_item_open_stream(xarc* x);
+/* Function: xarc_item_read
+ * Read the next piece of the current entry's data into a buffer.
+ *
+ * The data is decoded straight into the buffer. The buffer is always filled
+ * completely unless the end of the entry is reached, so a read that returns
+ * fewer than "len" bytes is the last one with any data.
+ *
+ * Parameters:
+ *   x - Pointer to the <xarc> object to read from
+ *   buf - The buffer to receive the data
+ *   len - Size of the buffer in bytes
+ *   got - Set to the number of bytes placed in the buffer; 0 once the end of
+ *     the entry has been reached
+ *
+ * Returns:
+ *   XARC_OK - If no errors occurred
+ *   XARC_ERR_NO_STREAM - If <xarc_item_open_stream> wasn't called for the
+ *     current entry
+ *   <xarc_result_t> - Any other error that may have occurred (see <XARC result
+ *     codes>)
+ */
+xarc_result_t xarc_item_read(xarc* x, void* buf, size_t len, size_t* got);
+/* Function: xarc_extract_options_init
+ * Fill out an <xarc_extract_options> object with the default options.
+ *
+ * Parameters:
+ *   opts - Pointer to the <xarc_extract_options> object to initialize
+ */
+void xarc_extract_options_init(xarc_extract_options* opts);
+/* Function: xarc_extract_all
+ * Extract the current archive entry and every entry after it to a base path in
+ * the file system.
+ *
+ * For archive types whose entries can be read independently of each other
+ * (such as ZIP and 7z), the file data is extracted by several worker threads at
+ * once. Directories are still created on the calling thread, and callbacks are
+ * always made on the calling thread in archive order, exactly as a loop of
+ * <xarc_item_extract> and <xarc_next_item> would make them. Because entries
+ * may be extracted out of order, callbacks must not rely on which entry is
+ * "current" in the <xarc> object.
+ *
+ * Parameters:
+ *   x - Pointer to the <xarc> object to extract from
+ *   base_path - The base path in the local file system to extract to
+ *   opts - Options controlling the extraction, or NULL to use the defaults
+ *     (see <xarc_extract_options>)
+ *
+ * Returns:
+ *   XARC_OK - If every entry was extracted; the <xarc> object is then
+ *     positioned past the last entry, as if <xarc_next_item> had returned
+ *     XARC_NO_MORE_ITEMS
+ *   <xarc_result_t> - The first error that occurred (see <XARC result codes>)
+ */
+xarc_result_t xarc_extract_all(xarc* x, const xchar* base_path,
+ const xarc_extract_options* opts);
 
 
 /* Section: Identifiers */
@@ -261,6 +418,9 @@ xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
  * (-8) XARC_ERR_NO_BASE_PATH - Tried to extract an archive entry to a base path
  *   that didn't exist
  * (-9) XARC_ERR_MEMORY - Failed while allocating or freeing memory
+ * (-10) XARC_ERR_ITEM_IS_DIR - Tried to read the data of a directory entry
+ * (-11) XARC_ERR_NO_STREAM - Tried to read an entry's data without opening it
+ *   with <xarc_item_open_stream> first
  */
 #define XARC_OK								0
 #define XARC_NO_MORE_ITEMS					1
@@ -274,6 +434,8 @@ xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
 #define XARC_ERR_DIR_IS_FILE				-7
 #define XARC_ERR_NO_BASE_PATH				-8
 #define XARC_ERR_MEMORY						-9
+#define XARC_ERR_ITEM_IS_DIR				-10
+#define XARC_ERR_NO_STREAM					-11
 
 /* Defines: XARC extraction flags
  * Options governing the extraction process.
@@ -282,8 +444,34 @@ xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
  *   each directory item in an archive entry's relative path is created, in
  *   addition to the file itself. If the directory specified in an entry's
  *   relative path already exists, there will _not_ be a callback.
+ * (0x2) XARC_XFLAG_DIRECT_IO - Write extracted files without going through
+ *   the operating system's page cache (O_DIRECT), so that extracting large
+ *   archives doesn't push everything else out of it. Only has an effect on
+ *   Linux and similar systems, and only for file systems that support it;
+ *   otherwise it is ignored. Mostly useful for large files.
+ * (0x4) XARC_XFLAG_BATCH_IO - Only for <xarc_extract_all>: queue small files
+ *   to be created and written in the background, many per system call
+ *   (io_uring), rather than one at a time. Helps most with archives of many
+ *   small files. Every file has been written by the time <xarc_extract_all>
+ *   returns, but not necessarily by the time its callback is made. Needs
+ *   Linux 5.17 or later; otherwise it is ignored. Files opened with
+ *   XARC_XFLAG_DIRECT_IO aren't batched.
  */
 #define XARC_XFLAG_CALLBACK_DIRS	0x1
+#define XARC_XFLAG_DIRECT_IO		0x2
+#define XARC_XFLAG_BATCH_IO		0x4
+
+/* Defines: XARC open flags
+ *
+ * (0x1) XARC_OFLAG_GZIP_INDEX - For GZIP-compressed archives: keep a
+ *   checkpoint index of the decompressed stream in a file beside the archive
+ *   (the archive's path with ".xarcidx" appended). If a matching index exists,
+ *   skipping over entry data seeks to the nearest checkpoint instead of
+ *   decompressing everything in between; otherwise, or past the end of it,
+ *   checkpoints are recorded while reading and saved when the archive is
+ *   closed. A stream being indexed is decompressed on one thread.
+ */
+#define XARC_OFLAG_GZIP_INDEX	0x1
 
 /* Defines: XARC entry properties
  * Properties of an archive entry.
@@ -297,10 +485,12 @@ xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
 #define XARC_TYPE_BEGIN(id, name) \
  extern const uint8_t name;
 #define XARC_EXTENSION(ext)
+#define XARC_MAGIC(offset, bytes)
 #define XARC_TYPE_END()
 #include <xarc/types.inc>
 #undef XARC_TYPE_BEGIN
 #undef XARC_EXTENSION
+#undef XARC_MAGIC
 #undef XARC_TYPE_END
 
 
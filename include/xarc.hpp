@@ -185,12 +185,31 @@ public:
 	 * Parameters:
 	 *   file - The path to the archive file to open
 	 *   type - Specify the type of the archive (see <XARC archive types>); use
-	 *     "0" to autodetect the archive type by the file extension
+	 *     "0" to autodetect the archive type from the file's content, or
+	 *     failing that, its extension
 	 *
 	 * See also:
 	 *   <xarc_open> (C API)
 	 */
 	ExtractArchive(const xchar* file, uint8_t type = 0);
+	/* Constructor: ExtractArchive
+	 * Open an archive held in memory. The buffer is read in place and must
+	 * stay valid for the lifetime of the object (or until another archive is
+	 * opened).
+	 *
+	 * If the archive cannot be opened, the object will still be constructed
+	 * and can be queried for the nature of the error.
+	 *
+	 * Parameters:
+	 *   buf - The archive's data
+	 *   len - Size of the data in bytes
+	 *   type - Specify the type of the archive (see <XARC archive types>); use
+	 *     "0" to autodetect the archive type from its content
+	 *
+	 * See also:
+	 *   <xarc_open_memory> (C API)
+	 */
+	ExtractArchive(const void* buf, size_t len, uint8_t type);
 	/* Destructor: ~ExtractArchive
 	 * Virtual destructor.
 	 */
@@ -233,7 +252,10 @@ public:
 	 * Parameters:
 	 *   file - The path to the archive file to open
 	 *   type - Specify the type of the archive (see <XARC archive types>); use
-	 *     "0" to autodetect the archive type by the file extension
+	 *     "0" to autodetect the archive type from the file's content, or
+	 *     failing that, its extension
+	 *   flags - Options controlling how the archive is read (see <XARC open
+	 *     flags>)
 	 *
 	 * Returns:
 	 *   XARC_OK - If the archive was succesfully opened and is ready to use
@@ -241,9 +263,32 @@ public:
 	 *     codes>)
 	 *
 	 * See also:
-	 *   <xarc_open> (C API)
+	 *   <xarc_open_ex> (C API)
 	 */
-	xarc_result_t OpenFile(const xchar* file, uint8_t type = 0);
+	xarc_result_t OpenFile(const xchar* file, uint8_t type = 0,
+	 uint8_t flags = 0);
+	/* Method: OpenMemory
+	 * Open an archive held in memory.
+	 *
+	 * If the object already has an archive open, it will be closed before
+	 * attempting to open the new one. The buffer is read in place and must
+	 * stay valid until the archive is closed.
+	 *
+	 * Parameters:
+	 *   buf - The archive's data
+	 *   len - Size of the data in bytes
+	 *   type - Specify the type of the archive (see <XARC archive types>); use
+	 *     "0" to autodetect the archive type from its content
+	 *
+	 * Returns:
+	 *   XARC_OK - If the archive was succesfully opened and is ready to use
+	 *   <xarc_result_t> - Any error that may have occurred (see <XARC result
+	 *     codes>)
+	 *
+	 * See also:
+	 *   <xarc_open_memory> (C API)
+	 */
+	xarc_result_t OpenMemory(const void* buf, size_t len, uint8_t type);
 	/* Method: NextItem
 	 * Iterate to the next entry in the archive.
 	 *
@@ -305,10 +350,69 @@ public:
 	template< class UserCallback >
 	xarc_result_t ExtractItem(const StringType& base_path, uint8_t flags,
 	 UserCallback& callback);
+	/* Method: ExtractAll
+	 * Extract every remaining archive entry, possibly on several threads.
+	 *
+	 * The callback functor has the same signature as for <ExtractItem>.
+	 * Callbacks are always made on the calling thread, in archive order,
+	 * regardless of how many threads are used.
+	 *
+	 * Parameters:
+	 *   base_path - The base path in the local file system to extract to
+	 *   flags - Options controlling the extraction process (see <XARC
+	 *     extraction flags>)
+	 *   callback - Templated callback functor
+	 *   threads - The number of threads to extract with; 0 to use one per
+	 *     processor
+	 *
+	 * Returns:
+	 *   XARC_OK - If all remaining items were successfully extracted
+	 *   <xarc_result_t> - Any error that may have occurred (see <XARC result
+	 *     codes>)
+	 *
+	 * See also:
+	 *   <xarc_extract_all> (C API)
+	 */
+	template< class UserCallback >
+	xarc_result_t ExtractAll(const StringType& base_path, uint8_t flags,
+	 UserCallback& callback, uint32_t threads = 0);
+	/* Method: OpenItemStream
+	 * Prepare the current archive entry to be read into memory with
+	 * <ReadItem>.
+	 *
+	 * Returns:
+	 *   XARC_OK - If the entry is ready to be read
+	 *   <xarc_result_t> - Any error that may have occurred (see <XARC result
+	 *     codes>)
+	 *
+	 * See also:
+	 *   <xarc_item_open_stream> (C API)
+	 */
+	xarc_result_t OpenItemStream();
+	/* Method: ReadItem
+	 * Read the next piece of the current entry's data into a buffer.
+	 *
+	 * Parameters:
+	 *   buf - The buffer to receive the data
+	 *   len - Size of the buffer in bytes
+	 *   got - Set to the number of bytes placed in the buffer; less than len
+	 *     only at the end of the entry
+	 *
+	 * Returns:
+	 *   XARC_OK - If no errors occurred
+	 *   <xarc_result_t> - Any error that may have occurred (see <XARC result
+	 *     codes>)
+	 *
+	 * See also:
+	 *   <xarc_item_read> (C API)
+	 */
+	xarc_result_t ReadItem(void* buf, size_t len, size_t* got);
 
 private:
 	xarc_result_t ExtractItemUserCallback(const StringType& base_path,
 	 uint8_t flags, ExtractCallback* callback);
+	xarc_result_t ExtractAllUserCallback(const StringType& base_path,
+	 uint8_t flags, ExtractCallback* callback, uint32_t threads);
 
 	xarc* m_xarc;
 };
@@ -321,6 +425,14 @@ xarc_result_t ExtractArchive::ExtractItem(const StringType& base_path,
 	return this->ExtractItemUserCallback(base_path, flags, &euc);
 }
 
+template< class UserCallback >
+xarc_result_t ExtractArchive::ExtractAll(const StringType& base_path,
+ uint8_t flags, UserCallback& callback, uint32_t threads)
+{
+	ExtractUserCallback< UserCallback > euc(callback);
+	return this->ExtractAllUserCallback(base_path, flags, &euc, threads);
+}
+
 }
 
 #endif // XARC_HPP_INC
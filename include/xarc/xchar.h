@@ -63,6 +63,7 @@ extern "C" {
 #define xchmod _wchmod
 #define xfopen _wfopen
 #define xopen _wopen
+#define xremove _wremove
 
 typedef wchar_t xchar;
 
@@ -81,6 +82,7 @@ typedef wchar_t xchar;
 #define xchmod chmod
 #define xfopen fopen
 #define xopen open
+#define xremove remove
 
 typedef char xchar;
 
@@ -24,12 +24,236 @@
 
 #include <stdio.h>
 #include <bzlib.h>
+#include <limits.h>
 #include <malloc.h>
 #include <errno.h>
 #include <string.h>
 #include "xarc_decompress.h"
 #include "xarc_impl.h"
 #include "filesys.h"
+#include "threads.h"
+
+
+/* The 48-bit markers that start each compressed block and end each stream.
+ * Neither is byte-aligned past the first block of a stream.
+ */
+#define BLOCK_MAGIC 0x314159265359ULL
+#define END_MAGIC 0x177245385090ULL
+/* An upper bound on the compressed size of one block at the given level
+ * (1-9): each of up to level*100000 symbols takes at most 20 bits, plus
+ * coding tables.
+ */
+#define UNIT_IN_MAX(level) ((size_t)(level) * 250000 + 65536)
+/* The size of the buffer that file input is read into while looking for
+ * blocks; always topped up to hold at least one whole block.
+ */
+#define PEND_SIZE 4194304
+/* The most worker threads to start for one stream */
+#define MAX_WORKERS 16
+
+
+/* Enum: bz_unit_kind
+ * UNIT_BLOCK - One compressed block, to be decoded by a worker
+ * UNIT_END - The end of a BZIP2 stream, carrying the stream's CRC
+ * UNIT_ERROR - The input couldn't be split further; reading it fails
+ */
+enum
+{
+	UNIT_BLOCK = 0,
+	UNIT_END,
+	UNIT_ERROR
+};
+
+/* Enum: bz_unit_state
+ * UNIT_QUEUED - Waiting for a worker
+ * UNIT_RUNNING - A worker is decoding the unit
+ * UNIT_DONE - The unit's output is ready (or it has none)
+ * UNIT_FAILED - The unit didn't decode on its own
+ */
+enum
+{
+	UNIT_QUEUED = 0,
+	UNIT_RUNNING,
+	UNIT_DONE,
+	UNIT_FAILED
+};
+
+
+/* Struct: bz_unit
+ * A piece of the input found between block markers, and the output of
+ * decoding it.
+ */
+typedef struct _bz_unit
+{
+	/* Variable: next
+	 * The following unit, or NULL.
+	 */
+	struct _bz_unit* next;
+	/* Variable: kind
+	 * See <bz_unit_kind>.
+	 */
+	uint8_t kind;
+	/* Variable: state
+	 * See <bz_unit_state>; guarded by <bz_parallel.lock>.
+	 */
+	uint8_t state;
+	/* Variable: level
+	 * The block size level (1-9) of the stream the unit belongs to.
+	 */
+	uint8_t level;
+	/* Variable: ends
+	 * Set if the block is followed by another marker, so <in> was finished
+	 * with an end-of-stream marker; otherwise the input ran out first.
+	 */
+	uint8_t ends;
+	/* Variable: bzerror
+	 * For UNIT_ERROR, or once a worker has given up on the unit, the BZIP2
+	 * error to report.
+	 */
+	int bzerror;
+	/* Variable: crc
+	 * The block's CRC from its header; for UNIT_END, the stream's combined
+	 * CRC.
+	 */
+	uint32_t crc;
+	/* Variable: in
+	 * The block rewritten as a stand-alone, byte-aligned BZIP2 stream: a
+	 * stream header, the block's bits, then (if <ends>) an end-of-stream
+	 * marker.
+	 */
+	uint8_t* in;
+	/* Variable: in_len
+	 * The number of bytes at <in>.
+	 */
+	size_t in_len;
+	/* Variable: bits
+	 * The number of bits of block data in <in>, after the 32-bit stream
+	 * header.
+	 */
+	uint64_t bits;
+	/* Variable: out
+	 * The decoded data, once <state> is UNIT_DONE.
+	 */
+	uint8_t* out;
+	/* Variable: out_len
+	 * The number of bytes at <out>.
+	 */
+	size_t out_len;
+	/* Variable: out_pos
+	 * The number of bytes of <out> already handed to the caller.
+	 */
+	size_t out_pos;
+} bz_unit;
+
+
+/* Struct: bz_worker
+ * A thread decoding units.
+ */
+typedef struct
+{
+	/* Variable: thread
+	 * The running thread.
+	 */
+	threads_thread* thread;
+	/* Variable: par
+	 * The <bz_parallel> state the thread takes units from.
+	 */
+	struct _bz_parallel* par;
+} bz_worker;
+
+
+/* Struct: bz_parallel
+ * State for decoding the blocks of a BZIP2 stream concurrently, in the manner
+ * of lbzip2. The reading thread looks for block markers at every bit offset
+ * of the input, copies each block out as a stream of its own, and queues it
+ * for the workers; their output is then handed out in order. A marker can
+ * turn up by chance inside compressed data, so a unit that doesn't decode on
+ * its own is joined to the one after it and decoded again on the reading
+ * thread.
+ */
+typedef struct _bz_parallel
+{
+	/* Variable: lock
+	 * Guards the unit list and unit states.
+	 */
+	threads_mutex* lock;
+	/* Variable: cond
+	 * Broadcast when a unit is queued or finished, and on shutdown.
+	 */
+	threads_cond* cond;
+	/* Variable: workers
+	 * The running worker threads.
+	 */
+	bz_worker* workers;
+	/* Variable: num_workers
+	 * The number of entries in <workers>.
+	 */
+	uint32_t num_workers;
+	/* Variable: stop
+	 * Set to tell the workers to exit.
+	 */
+	uint8_t stop;
+	/* Variable: head
+	 * The oldest unit not yet fully consumed.
+	 */
+	bz_unit* head;
+	/* Variable: tail
+	 * The newest unit.
+	 */
+	bz_unit* tail;
+	/* Variable: count
+	 * The number of units in the list.
+	 */
+	uint32_t count;
+	/* Variable: pend
+	 * Input not yet cut into units: a buffer filled from the file, or the
+	 * caller's memory.
+	 */
+	const uint8_t* pend;
+	/* Variable: pend_buf
+	 * The allocated buffer behind <pend> when reading from a file.
+	 */
+	uint8_t* pend_buf;
+	/* Variable: pend_len
+	 * The number of bytes at <pend>.
+	 */
+	size_t pend_len;
+	/* Variable: in_eof
+	 * Set once the whole input has been read into <pend>.
+	 */
+	uint8_t in_eof;
+	/* Variable: scan_bit
+	 * The bit offset in <pend> where the next unit starts.
+	 */
+	uint64_t scan_bit;
+	/* Variable: scan_level
+	 * The block size level of the stream being cut into units, or 0 if a
+	 * stream header is expected at <scan_bit>.
+	 */
+	uint8_t scan_level;
+	/* Variable: scan_done
+	 * Set once no more units will be cut.
+	 */
+	uint8_t scan_done;
+	/* Variable: streams
+	 * The number of stream headers seen so far.
+	 */
+	uint32_t streams;
+	/* Variable: scan_crc
+	 * The combined CRC of the block headers cut so far in the current stream.
+	 */
+	uint32_t scan_crc;
+	/* Variable: out_crc
+	 * The combined CRC of the blocks handed out so far in the current stream.
+	 */
+	uint32_t out_crc;
+	/* Variable: marker_shifts
+	 * For each byte value, the bit offsets into the preceding byte at which
+	 * a block marker (low 8 bits) or end marker (high 8 bits) would start for
+	 * that value to be its second byte.
+	 */
+	uint16_t marker_shifts[256];
+} bz_parallel;
 
 
 /* Struct: d_bz2_impl
@@ -48,9 +272,28 @@ typedef struct
 	 */
 	FILE* infile;
 	/* Variable: inbz2
-	 * The BZIP2 decompression object.
+	 * The BZIP2 decompression object, when reading from a file. NULL when
+	 * reading from memory.
 	 */
 	BZFILE* inbz2;
+	/* Variable: strm
+	 * The BZIP2 stream, when reading from memory.
+	 */
+	bz_stream strm;
+	/* Variable: mem_left
+	 * When reading from memory, the amount of input beyond what's been handed
+	 * to <strm> so far (BZIP2's counters are narrower than size_t).
+	 */
+	size_t mem_left;
+	/* Variable: mem_done
+	 * Set once the last BZIP2 stream in memory has been fully decompressed.
+	 */
+	uint8_t mem_done;
+	/* Variable: par
+	 * Concurrent block decoding state, on a machine with more than one
+	 * processor. <inbz2> and <strm> go unused.
+	 */
+	bz_parallel* par;
 #if XARC_NATIVE_WCHAR
 	/* Variable: localized_error
 	 * Holds the localized return value of <d_bz2_error_desc> when the native
@@ -62,12 +305,743 @@ typedef struct
 #define D_BZ2(base) ((d_bz2_impl*)base)
 
 
+/* Section: Static Functions */
+
+
+/* BZIP2 error strings, indexed by the negated error code (as in bzlib's own
+ * BZ2_bzerror, which only works with a BZFILE)
+ */
+static const char* const bz2_error_strings[] = {
+	"OK",
+	"SEQUENCE_ERROR",
+	"PARAM_ERROR",
+	"MEM_ERROR",
+	"DATA_ERROR",
+	"DATA_ERROR_MAGIC",
+	"IO_ERROR",
+	"UNEXPECTED_EOF",
+	"OUTBUFF_FULL",
+	"CONFIG_ERROR"
+};
+
+static const char* bz2_error_string(int bzerror)
+{
+	if (bzerror > 0 || bzerror < -9)
+		return "???";
+	return bz2_error_strings[-bzerror];
+}
+
+/* Set a decompression error carrying a BZIP2 error string */
+static xarc_result_t set_error_bz2(xarc* x, int bzerror, const char* edesc)
+{
+#if XARC_NATIVE_WCHAR
+	/* Localize the BZIP2 error string */
+	size_t lenl = filesys_localize_char(edesc, -1, 0, 0);
+	xchar* edescl = malloc(sizeof(xchar) * lenl);
+	filesys_localize_char(edesc, -1, edescl, lenl);
+	xarc_set_error(x, XARC_DECOMPRESS_ERROR, bzerror, XC("%s"), edescl);
+	free(edescl);
+	return XARC_DECOMPRESS_ERROR;
+#else
+	return xarc_set_error(x, XARC_DECOMPRESS_ERROR, bzerror, XC("%s"), edesc);
+#endif
+}
+
+/* Hand the next stretch of in-memory input to the BZIP2 stream */
+static void feed_memory(d_bz2_impl* i)
+{
+	if (i->strm.avail_in == 0 && i->mem_left > 0)
+	{
+		i->strm.avail_in = (i->mem_left > UINT_MAX) ? UINT_MAX :
+		 (unsigned int)i->mem_left;
+		i->mem_left -= i->strm.avail_in;
+	}
+}
+
+/* The in-memory counterpart of BZ2_bzRead. Concatenated BZIP2 streams (as
+ * written by parallel compressors) are decompressed one after another.
+ */
+static xarc_result_t read_memory(xarc* x, d_bz2_impl* i, void* buf,
+ size_t* read_inout)
+{
+	bz_stream* bs = &i->strm;
+	size_t out_left = *read_inout;
+	bs->next_out = (char*)buf;
+	while (out_left > 0 && !i->mem_done)
+	{
+		feed_memory(i);
+		bs->avail_out = (out_left > UINT_MAX) ? UINT_MAX :
+		 (unsigned int)out_left;
+		unsigned int out_before = bs->avail_out;
+
+		int bzerror = BZ2_bzDecompress(bs);
+		out_left -= out_before - bs->avail_out;
+
+		if (bzerror == BZ_STREAM_END)
+		{
+			BZ2_bzDecompressEnd(bs);
+			feed_memory(i);
+			if (bs->avail_in + i->mem_left >= 3 && bs->next_in[0] == 'B'
+			 && bs->next_in[1] == 'Z' && bs->next_in[2] == 'h')
+			{
+				char* next_in = bs->next_in;
+				unsigned int avail_in = bs->avail_in;
+				memset(bs, 0, sizeof(bz_stream));
+				bs->next_in = next_in;
+				bs->avail_in = avail_in;
+				bzerror = BZ2_bzDecompressInit(bs, 0, 0);
+				if (bzerror != BZ_OK)
+				{
+					i->mem_done = 1;
+					return set_error_bz2(x, bzerror,
+					 bz2_error_string(bzerror));
+				}
+			}
+			else
+				i->mem_done = 1;
+		}
+		else if (bzerror != BZ_OK)
+			return set_error_bz2(x, bzerror, bz2_error_string(bzerror));
+		else if (bs->avail_in == 0 && i->mem_left == 0
+		 && bs->avail_out == out_before)
+		{
+			/* Out of input before the end of the stream */
+			return set_error_bz2(x, BZ_UNEXPECTED_EOF,
+			 bz2_error_string(BZ_UNEXPECTED_EOF));
+		}
+	}
+
+	if (out_left > 0)
+	{
+		*read_inout -= out_left;
+		return xarc_set_error(x, XARC_DECOMPRESS_EOF, 0,
+		 XC("EOF while reading BZIP2 data"));
+	}
+	return XARC_OK;
+}
+
+
+/* Read n bits (up to 57) starting at a bit offset, most significant first */
+static uint64_t peek_bits(const uint8_t* p, uint64_t bit, int n)
+{
+	const uint8_t* b = p + (bit >> 3);
+	int have = -(int)(bit & 7);
+	uint64_t v = 0;
+	while (have < n)
+	{
+		v = (v << 8) | *b++;
+		have += 8;
+	}
+	return (v >> (have - n)) & ((1ULL << n) - 1);
+}
+
+/* Bits being written out most significant first, as BZIP2 stores them */
+typedef struct
+{
+	uint8_t* buf;
+	uint64_t bits;
+} bz_bits;
+
+/* Append the low n bits of v */
+static void put_value(bz_bits* w, uint64_t v, int n)
+{
+	while (n-- > 0)
+	{
+		uint8_t* b = w->buf + (w->bits >> 3);
+		int shift = 7 - (int)(w->bits & 7);
+		if (shift == 7)
+			*b = 0;
+		*b |= (uint8_t)(((v >> n) & 1) << shift);
+		++w->bits;
+	}
+}
+
+/* Append n bits read from src starting at a bit offset */
+static void put_bits(bz_bits* w, const uint8_t* src, uint64_t bit, uint64_t n)
+{
+	const uint8_t* s = src + (bit >> 3);
+	int ss = (int)(bit & 7);
+	int ds = (int)(w->bits & 7);
+	uint8_t* d = w->buf + (w->bits >> 3);
+	for (; n >= 8; n -= 8)
+	{
+		uint8_t byte = ss ? (uint8_t)((s[0] << ss) | (s[1] >> (8 - ss))) : s[0];
+		++s;
+		if (ds)
+		{
+			*d = (uint8_t)((*d & (0xff << (8 - ds))) | (byte >> ds));
+			*++d = (uint8_t)(byte << (8 - ds));
+		}
+		else
+			*d++ = byte;
+		bit += 8;
+		w->bits += 8;
+	}
+	if (n > 0)
+		put_value(w, peek_bits(src, bit, (int)n), (int)n);
+}
+
+/* Fill out a unit's <bz_unit.in> from a block's bits, given in up to two
+ * pieces. Returns 0 if out of memory.
+ */
+static int write_unit(bz_unit* u, const uint8_t* a, uint64_t a_bit,
+ uint64_t a_bits, const uint8_t* b, uint64_t b_bit, uint64_t b_bits)
+{
+	uint8_t* in = (uint8_t*)malloc(4
+	 + (size_t)((a_bits + b_bits + 80 + 7) >> 3));
+	if (!in)
+		return 0;
+	bz_bits w = {in, 0};
+	put_value(&w, 0x425a68, 24); /* "BZh" */
+	put_value(&w, '0' + u->level, 8);
+	put_bits(&w, a, a_bit, a_bits);
+	if (b_bits)
+		put_bits(&w, b, b_bit, b_bits);
+	/* A stream of one block has that block's CRC as its combined CRC */
+	if (u->ends)
+	{
+		put_value(&w, END_MAGIC, 48);
+		put_value(&w, u->crc, 32);
+	}
+	free(u->in);
+	u->in = in;
+	u->in_len = (size_t)((w.bits + 7) >> 3);
+	u->bits = a_bits + b_bits;
+	return 1;
+}
+
+static void free_unit(bz_unit* u)
+{
+	free(u->in);
+	free(u->out);
+	free(u);
+}
+
+/* Decode a unit's stream into <bz_unit.out>. Returns 0, with the reason in
+ * <bz_unit.bzerror>, if it doesn't decode.
+ */
+static int decode_unit(bz_unit* u)
+{
+	bz_stream bs;
+	memset(&bs, 0, sizeof(bz_stream));
+	int bzerror = BZ2_bzDecompressInit(&bs, 0, 0);
+	if (bzerror != BZ_OK)
+	{
+		u->bzerror = bzerror;
+		return 0;
+	}
+	size_t cap = (size_t)u->level * 100000;
+	u->out = (uint8_t*)malloc(cap);
+	u->out_len = 0;
+	bs.next_in = (char*)u->in;
+	bs.avail_in = (unsigned int)u->in_len;
+	while (u->out)
+	{
+		bs.next_out = (char*)u->out + u->out_len;
+		bs.avail_out = (unsigned int)(cap - u->out_len);
+		bzerror = BZ2_bzDecompress(&bs);
+		u->out_len = cap - bs.avail_out;
+		if (bzerror != BZ_OK)
+			break;
+		if (bs.avail_out > 0)
+		{
+			/* Out of input before the end of the block */
+			bzerror = BZ_UNEXPECTED_EOF;
+			break;
+		}
+		/* Runs of repeated bytes can expand a block well past its nominal
+		 * size.
+		 */
+		cap *= 2;
+		uint8_t* out = (uint8_t*)realloc(u->out, cap);
+		if (!out)
+		{
+			free(u->out);
+			u->out = 0;
+		}
+		else
+			u->out = out;
+	}
+	if (!u->out)
+		bzerror = BZ_MEM_ERROR;
+	BZ2_bzDecompressEnd(&bs);
+	if (bzerror == BZ_STREAM_END)
+		return 1;
+	free(u->out);
+	u->out = 0;
+	u->out_len = 0;
+	u->bzerror = bzerror;
+	return 0;
+}
+
+/* Worker thread: decode queued units, oldest first, until told to stop */
+static void worker_main(void* param)
+{
+	bz_worker* w = (bz_worker*)param;
+	bz_parallel* p = w->par;
+	threads_mutex_lock(p->lock);
+	while (!p->stop)
+	{
+		bz_unit* u = p->head;
+		while (u && u->state != UNIT_QUEUED)
+			u = u->next;
+		if (!u)
+		{
+			threads_cond_wait(p->cond, p->lock);
+			continue;
+		}
+		u->state = UNIT_RUNNING;
+		threads_mutex_unlock(p->lock);
+
+		int ok = decode_unit(u);
+
+		threads_mutex_lock(p->lock);
+		u->state = ok ? UNIT_DONE : UNIT_FAILED;
+		threads_cond_broadcast(p->cond);
+	}
+	threads_mutex_unlock(p->lock);
+}
+
+/* Wait until no worker is decoding a unit, and return its final state */
+static uint8_t wait_unit(bz_parallel* p, bz_unit* u)
+{
+	threads_mutex_lock(p->lock);
+	while (u->state == UNIT_QUEUED || u->state == UNIT_RUNNING)
+		threads_cond_wait(p->cond, p->lock);
+	uint8_t state = u->state;
+	threads_mutex_unlock(p->lock);
+	return state;
+}
+
+/* Drop the oldest unit */
+static void pop_unit(bz_parallel* p)
+{
+	bz_unit* u = p->head;
+	threads_mutex_lock(p->lock);
+	p->head = u->next;
+	if (!p->head)
+		p->tail = 0;
+	--p->count;
+	threads_mutex_unlock(p->lock);
+	free_unit(u);
+}
+
+/* Decide whether an end marker found at bit e ends the stream, rather than
+ * turning up by chance inside a block: either the stream CRC after it
+ * matches the block headers seen, or it's followed by the end of the input or
+ * another stream.
+ */
+static int accept_end(bz_parallel* p, uint64_t e)
+{
+	if (e + 80 > ((uint64_t)p->pend_len << 3))
+		return p->in_eof;
+	if ((uint32_t)peek_bits(p->pend, e + 48, 32) == p->scan_crc)
+		return 1;
+	size_t next = (size_t)((e + 80 + 7) >> 3);
+	if (next == p->pend_len)
+		return p->in_eof;
+	if (next + 10 > p->pend_len)
+		return 0;
+	const uint8_t* h = p->pend + next;
+	if (h[0] != 'B' || h[1] != 'Z' || h[2] != 'h' || h[3] < '1' || h[3] > '9')
+		return 0;
+	uint64_t m = peek_bits(h, 32, 48);
+	return m == BLOCK_MAGIC || m == END_MAGIC;
+}
+
+/* Find the first block marker, or end marker accepted by <accept_end>, that
+ * starts at or after from_bit and ends by limit_bit. Returns its bit offset,
+ * or UINT64_MAX if there's none.
+ */
+static uint64_t find_cut(bz_parallel* p, uint64_t from_bit, uint64_t limit_bit)
+{
+	if (limit_bit < from_bit + 48)
+		return UINT64_MAX;
+	/* Markers are looked up by their first whole byte, one past the byte
+	 * they start in.
+	 */
+	size_t q = (size_t)(from_bit >> 3) + 1;
+	size_t q_end = (size_t)((limit_bit - 48) >> 3) + 1;
+	for (; q <= q_end; ++q)
+	{
+		uint16_t shifts = p->marker_shifts[p->pend[q]];
+		if (!shifts)
+			continue;
+		int s;
+		for (s = 0; s < 8; ++s)
+		{
+			if (!(shifts & (0x101 << s)))
+				continue;
+			uint64_t b = ((uint64_t)(q - 1) << 3) + s;
+			if (b < from_bit || b + 48 > limit_bit)
+				continue;
+			uint64_t m = peek_bits(p->pend, b, 48);
+			if (m == BLOCK_MAGIC || (m == END_MAGIC && accept_end(p, b)))
+				return b;
+		}
+	}
+	return UINT64_MAX;
+}
+
+/* Make sure the file buffer holds at least a whole block past <scan_bit>,
+ * unless the file ends first.
+ */
+static xarc_result_t top_up_input(xarc* x, d_bz2_impl* i)
+{
+	bz_parallel* p = i->par;
+	size_t at = (size_t)(p->scan_bit >> 3);
+	if (!p->pend_buf || p->in_eof || p->pend_len - at >= UNIT_IN_MAX(9) + 64)
+		return XARC_OK;
+	memmove(p->pend_buf, p->pend_buf + at, p->pend_len - at);
+	p->pend_len -= at;
+	p->scan_bit -= (uint64_t)at << 3;
+	size_t want = PEND_SIZE - p->pend_len;
+	size_t got = fread(p->pend_buf + p->pend_len, 1, want, i->infile);
+	if (got < want)
+	{
+		if (ferror(i->infile))
+		{
+			return xarc_set_error_filesys(x,
+			 XC("Error while reading BZIP2 data"));
+		}
+		p->in_eof = 1;
+	}
+	p->pend_len += got;
+	return XARC_OK;
+}
+
+/* Cut units from the input until enough are lined up to keep the workers
+ * busy.
+ */
+static xarc_result_t queue_units(xarc* x, d_bz2_impl* i)
+{
+	bz_parallel* p = i->par;
+	while (p->count < p->num_workers + 2 && !p->scan_done)
+	{
+		xarc_result_t ret = top_up_input(x, i);
+		if (ret != XARC_OK)
+			return ret;
+		uint64_t total = (uint64_t)p->pend_len << 3;
+
+		bz_unit* u = (bz_unit*)calloc(1, sizeof(bz_unit));
+		u->state = UNIT_DONE;
+		u->level = p->scan_level;
+		if (!p->scan_level)
+		{
+			/* A stream header. After the first stream, anything else ends
+			 * the input, as when reading from memory.
+			 */
+			const uint8_t* h = p->pend + (p->scan_bit >> 3);
+			size_t avail = p->pend_len - (size_t)(p->scan_bit >> 3);
+			if (avail >= 4 && h[0] == 'B' && h[1] == 'Z' && h[2] == 'h'
+			 && h[3] >= '1' && h[3] <= '9')
+			{
+				p->scan_level = (uint8_t)(h[3] - '0');
+				p->scan_bit += 32;
+				p->scan_crc = 0;
+				++p->streams;
+				free(u);
+				continue;
+			}
+			p->scan_done = 1;
+			if (p->streams > 0)
+			{
+				free(u);
+				break;
+			}
+			u->kind = UNIT_ERROR;
+			u->bzerror = (avail < 4) ? BZ_UNEXPECTED_EOF : BZ_DATA_ERROR_MAGIC;
+		}
+		else if (p->scan_bit + 80 > total)
+		{
+			u->kind = UNIT_ERROR;
+			u->bzerror = BZ_UNEXPECTED_EOF;
+			p->scan_done = 1;
+		}
+		else
+		{
+			uint64_t m = peek_bits(p->pend, p->scan_bit, 48);
+			u->crc = (uint32_t)peek_bits(p->pend, p->scan_bit + 48, 32);
+			if (m == END_MAGIC)
+			{
+				/* The next stream, if any, starts on a byte boundary */
+				u->kind = UNIT_END;
+				p->scan_bit = (p->scan_bit + 80 + 7) & ~(uint64_t)7;
+				p->scan_level = 0;
+			}
+			else if (m == BLOCK_MAGIC)
+			{
+				p->scan_crc = ((p->scan_crc << 1) | (p->scan_crc >> 31))
+				 ^ u->crc;
+				uint64_t limit = p->scan_bit
+				 + ((uint64_t)UNIT_IN_MAX(p->scan_level) << 3);
+				if (limit > total)
+					limit = total;
+				uint64_t cut = find_cut(p, p->scan_bit + 80, limit);
+				u->kind = UNIT_BLOCK;
+				u->ends = 1;
+				if (cut == UINT64_MAX && limit < total)
+				{
+					/* No block is that long */
+					u->kind = UNIT_ERROR;
+					u->bzerror = BZ_DATA_ERROR;
+					p->scan_done = 1;
+				}
+				else if (cut == UINT64_MAX)
+				{
+					/* The input ends partway through the block */
+					cut = total;
+					u->ends = 0;
+					p->scan_done = 1;
+				}
+				if (u->kind == UNIT_BLOCK)
+				{
+					if (write_unit(u, p->pend, p->scan_bit, cut - p->scan_bit,
+					 0, 0, 0))
+						u->state = UNIT_QUEUED;
+					else
+					{
+						u->kind = UNIT_ERROR;
+						u->bzerror = BZ_MEM_ERROR;
+						p->scan_done = 1;
+					}
+					p->scan_bit = cut;
+				}
+			}
+			else
+			{
+				u->kind = UNIT_ERROR;
+				u->bzerror = BZ_DATA_ERROR;
+				p->scan_done = 1;
+			}
+		}
+
+		threads_mutex_lock(p->lock);
+		if (p->tail)
+			p->tail->next = u;
+		else
+			p->head = u;
+		p->tail = u;
+		++p->count;
+		if (u->state == UNIT_QUEUED)
+			threads_cond_broadcast(p->cond);
+		threads_mutex_unlock(p->lock);
+	}
+	return XARC_OK;
+}
+
+/* The unit at the head of the list didn't decode; most likely a block marker
+ * turned up by chance inside it. Join it to the following unit and decode the
+ * two as one block on this thread, until that works or no block could be that
+ * long.
+ */
+static xarc_result_t retry_head(xarc* x, d_bz2_impl* i)
+{
+	bz_parallel* p = i->par;
+	bz_unit* u = p->head;
+	for (;;)
+	{
+		xarc_result_t ret = queue_units(x, i);
+		if (ret != XARC_OK)
+			return ret;
+		bz_unit* n = u->next;
+		if (!n || n->kind != UNIT_BLOCK
+		 || ((u->bits + n->bits) >> 3) > UNIT_IN_MAX(u->level))
+			return set_error_bz2(x, u->bzerror, bz2_error_string(u->bzerror));
+
+		/* Take the following unit out of the list once no worker is using
+		 * it.
+		 */
+		threads_mutex_lock(p->lock);
+		while (n->state == UNIT_RUNNING)
+			threads_cond_wait(p->cond, p->lock);
+		u->next = n->next;
+		if (p->tail == n)
+			p->tail = u;
+		--p->count;
+		threads_mutex_unlock(p->lock);
+
+		uint8_t* u_in = u->in;
+		u->in = 0;
+		u->ends = n->ends;
+		int ok = write_unit(u, u_in, 32, u->bits, n->in, 32, n->bits);
+		free(u_in);
+		free_unit(n);
+		if (!ok)
+		{
+			return set_error_bz2(x, BZ_MEM_ERROR,
+			 bz2_error_string(BZ_MEM_ERROR));
+		}
+		if (decode_unit(u))
+		{
+			threads_mutex_lock(p->lock);
+			u->state = UNIT_DONE;
+			threads_mutex_unlock(p->lock);
+			return XARC_OK;
+		}
+	}
+}
+
+/* Stop the workers and free all concurrent decoding state */
+static void stop_parallel(bz_parallel* p)
+{
+	threads_mutex_lock(p->lock);
+	p->stop = 1;
+	threads_cond_broadcast(p->cond);
+	threads_mutex_unlock(p->lock);
+	uint32_t w;
+	for (w = 0; w < p->num_workers; ++w)
+		threads_join(p->workers[w].thread);
+	while (p->head)
+	{
+		bz_unit* u = p->head;
+		p->head = u->next;
+		free_unit(u);
+	}
+	threads_cond_free(p->cond);
+	threads_mutex_free(p->lock);
+	free(p->workers);
+	free(p->pend_buf);
+	free(p);
+}
+
+/* Set up concurrent decoding of the input: the given memory, or <infile> if
+ * mem is NULL. Returns 0, leaving everything as it was, if there's only one
+ * processor or the workers can't be started.
+ */
+static int start_parallel(d_bz2_impl* i, const uint8_t* mem, size_t mem_len)
+{
+	uint32_t num_workers = threads_cpu_count();
+	if (num_workers < 2)
+		return 0;
+	if (num_workers > MAX_WORKERS)
+		num_workers = MAX_WORKERS;
+
+	bz_parallel* p = (bz_parallel*)calloc(1, sizeof(bz_parallel));
+	p->lock = threads_mutex_create();
+	p->cond = threads_cond_create();
+	p->workers = (bz_worker*)calloc(num_workers, sizeof(bz_worker));
+	if (!mem)
+		p->pend_buf = (uint8_t*)malloc(PEND_SIZE);
+	if (!p->lock || !p->cond || !p->workers || (!mem && !p->pend_buf))
+	{
+		if (p->cond)
+			threads_cond_free(p->cond);
+		if (p->lock)
+			threads_mutex_free(p->lock);
+		free(p->workers);
+		free(p->pend_buf);
+		free(p);
+		return 0;
+	}
+	while (p->num_workers < num_workers)
+	{
+		bz_worker* w = &p->workers[p->num_workers];
+		w->par = p;
+		w->thread = threads_start(worker_main, w);
+		if (!w->thread)
+			break;
+		++p->num_workers;
+	}
+	if (p->num_workers == 0)
+	{
+		stop_parallel(p);
+		return 0;
+	}
+
+	int s;
+	for (s = 0; s < 8; ++s)
+	{
+		p->marker_shifts[(BLOCK_MAGIC >> (32 + s)) & 0xff] |= 1 << s;
+		p->marker_shifts[(END_MAGIC >> (32 + s)) & 0xff] |= 0x100 << s;
+	}
+	if (mem)
+	{
+		p->pend = mem;
+		p->pend_len = mem_len;
+		p->in_eof = 1;
+	}
+	else
+		p->pend = p->pend_buf;
+	i->par = p;
+	return 1;
+}
+
+/* The concurrent counterpart of <d_bz2_read>. Output is taken from the units
+ * in order, checking each stream's combined CRC at its end.
+ */
+static xarc_result_t read_parallel(xarc* x, d_bz2_impl* i, uint8_t* buf,
+ size_t* read_inout)
+{
+	bz_parallel* p = i->par;
+	size_t out_left = *read_inout;
+	while (out_left > 0)
+	{
+		xarc_result_t ret = queue_units(x, i);
+		if (ret != XARC_OK)
+			return ret;
+		bz_unit* u = p->head;
+		if (!u)
+			break;
+
+		if (u->kind == UNIT_ERROR)
+		{
+			if (u->bzerror == BZ_DATA_ERROR_MAGIC)
+			{
+				return xarc_set_error(x, XARC_DECOMPRESS_ERROR, u->bzerror,
+				 XC("Invalid BZIP2 stream"));
+			}
+			return set_error_bz2(x, u->bzerror, bz2_error_string(u->bzerror));
+		}
+		if (u->kind == UNIT_END)
+		{
+			if (u->crc != p->out_crc)
+			{
+				return set_error_bz2(x, BZ_DATA_ERROR,
+				 bz2_error_string(BZ_DATA_ERROR));
+			}
+			p->out_crc = 0;
+			pop_unit(p);
+			continue;
+		}
+		if (wait_unit(p, u) == UNIT_FAILED)
+		{
+			ret = retry_head(x, i);
+			if (ret != XARC_OK)
+				return ret;
+		}
+
+		/* Hand over the unit's output */
+		size_t n = u->out_len - u->out_pos;
+		if (n > out_left)
+			n = out_left;
+		memcpy(buf, u->out + u->out_pos, n);
+		buf += n;
+		out_left -= n;
+		u->out_pos += n;
+		if (u->out_pos == u->out_len)
+		{
+			p->out_crc = ((p->out_crc << 1) | (p->out_crc >> 31)) ^ u->crc;
+			pop_unit(p);
+		}
+	}
+
+	if (out_left > 0)
+	{
+		*read_inout -= out_left;
+		return xarc_set_error(x, XARC_DECOMPRESS_EOF, 0,
+		 XC("EOF while reading BZIP2 data"));
+	}
+	return XARC_OK;
+}
+
+
 /* Section: BZIP2 decompression wrappers
  * See also: <decomp_open_func>, <xarc_decompress_impl>
  */
 
 
-xarc_result_t d_bz2_open(xarc* x, const xchar* path,
+xarc_result_t d_bz2_open(xarc* x, const xarc_source* src,
  xarc_decompress_impl** impl);
 void d_bz2_close(xarc_decompress_impl* impl);
 xarc_result_t d_bz2_read(xarc* x, xarc_decompress_impl* impl, void* buf,
@@ -81,45 +1055,97 @@ XARC_DEFINE_DECOMPRESSOR(decomp_bz2, d_bz2_open)
 
 /* Function: d_bz2_open
  *
- * Open a file for BZIP2 decompression.
+ * Open a file or memory buffer for BZIP2 decompression.
  *
  * See also: <decomp_open_func>
  */
-xarc_result_t d_bz2_open(xarc* x, const xchar* path, xarc_decompress_impl** impl)
+xarc_result_t d_bz2_open(xarc* x, const xarc_source* src,
+ xarc_decompress_impl** impl)
 {
-	/* Open the file for reading */
-	FILE* infile = xfopen(path, XC("rb"));
-	if (!infile)
-	{
-		return xarc_set_error_filesys(x, XC("Failed to open '%s' for reading"),
-		 path);
-	}
-
 	/* Allocate and fill out a d_bz2_impl object */
 	d_bz2_impl* i = (d_bz2_impl*)malloc(sizeof(d_bz2_impl));
 	i->base.close = d_bz2_close;
 	i->base.read = d_bz2_read;
 	i->base.error_desc = d_bz2_error_desc;
+	i->base.skip = 0;
+	i->base.copy = 0;
 	i->infile = 0;
 	i->inbz2 = 0;
+	i->mem_left = 0;
+	/* No memory stream to clean up unless one is started below */
+	i->mem_done = 1;
+	i->par = 0;
 #if XARC_NATIVE_WCHAR
 	i->localized_error = 0;
 #endif
+
+	if (!src->path)
+	{
+		/* Decompress straight from the caller's buffer, concurrently if
+		 * there's more than one processor.
+		 */
+		if (start_parallel(i, (const uint8_t*)src->buf, src->len))
+		{
+			*impl = (xarc_decompress_impl*)i;
+			return XARC_OK;
+		}
+		memset(&i->strm, 0, sizeof(bz_stream));
+		i->strm.next_in = (char*)src->buf;
+		i->mem_left = src->len;
+		feed_memory(i);
+		int bzerror = BZ2_bzDecompressInit(&i->strm, 0, 0);
+		if (bzerror != BZ_OK)
+		{
+			free(i);
+			return set_error_bz2(x, bzerror, bz2_error_string(bzerror));
+		}
+		i->mem_done = 0;
+		*impl = (xarc_decompress_impl*)i;
+		return XARC_OK;
+	}
+
+	/* Open the file for reading */
+	FILE* infile = xfopen(src->path, XC("rb"));
+	if (!infile)
+	{
+		free(i);
+		return xarc_set_error_filesys(x, XC("Failed to open '%s' for reading"),
+		 src->path);
+	}
 	*impl = (xarc_decompress_impl*)i;
+	i->infile = infile;
+
+	/* With more than one processor, blocks are found and decoded
+	 * concurrently, reading the file from the start.
+	 */
+	if (start_parallel(i, 0, 0))
+		return XARC_OK;
+
+	/* If the start of the file was already read while detecting the archive
+	 * type, BZIP2 can take it as its first input and carry on from there.
+	 */
+	void* unused = 0;
+	int nunused = 0;
+	if (src->probe && src->probe_len <= BZ_MAX_UNUSED
+	 && fseek(infile, (long)src->probe_len, SEEK_SET) == 0)
+	{
+		unused = (void*)src->probe;
+		nunused = (int)src->probe_len;
+	}
 
 	/* Open a BZIP2 decompression stream on the input file */
 	int32_t bzerror;
-	BZFILE* inbz2 = BZ2_bzReadOpen(&bzerror, infile, 0, 0, 0, 0);
+	BZFILE* inbz2 = BZ2_bzReadOpen(&bzerror, infile, 0, 0, unused, nunused);
 	if (bzerror != BZ_OK)
 	{
 		xarc_set_error(x, XARC_DECOMPRESS_ERROR, bzerror,
-		 XC("Failed to start BZIP2 stream on open file '%s'"), path);
+		 XC("Failed to start BZIP2 stream on open file '%s'"), src->path);
 		BZ2_bzReadClose(&bzerror, inbz2);
 		fclose(infile);
+		i->infile = 0;
 		return XARC_DECOMPRESS_ERROR;
 	}
 
-	i->infile = infile;
 	i->inbz2 = inbz2;
 
 	return XARC_OK;
@@ -134,11 +1160,20 @@ xarc_result_t d_bz2_open(xarc* x, const xchar* path, xarc_decompress_impl** impl
  */
 void d_bz2_close(xarc_decompress_impl* impl)
 {
-	/* Close the BZIP2 stream */
-	int bzerror;
-	BZ2_bzReadClose(&bzerror, D_BZ2(impl)->inbz2);
-	/* Close the input file */
-	fclose(D_BZ2(impl)->infile);
+	/* Stop any workers */
+	if (D_BZ2(impl)->par)
+		stop_parallel(D_BZ2(impl)->par);
+	if (D_BZ2(impl)->infile)
+	{
+		/* Close the BZIP2 stream */
+		int bzerror;
+		if (D_BZ2(impl)->inbz2)
+			BZ2_bzReadClose(&bzerror, D_BZ2(impl)->inbz2);
+		/* Close the input file */
+		fclose(D_BZ2(impl)->infile);
+	}
+	else if (!D_BZ2(impl)->mem_done)
+		BZ2_bzDecompressEnd(&D_BZ2(impl)->strm);
 	/* Free heap memory */
 #if XARC_NATIVE_WCHAR
 	if (D_BZ2(impl)->localized_error)
@@ -157,6 +1192,11 @@ void d_bz2_close(xarc_decompress_impl* impl)
 xarc_result_t d_bz2_read(xarc* x, xarc_decompress_impl* impl, void* buf,
  size_t* read_inout)
 {
+	if (D_BZ2(impl)->par)
+		return read_parallel(x, D_BZ2(impl), (uint8_t*)buf, read_inout);
+	if (!D_BZ2(impl)->infile)
+		return read_memory(x, D_BZ2(impl), buf, read_inout);
+
 	int bzerror;
 	int read = BZ2_bzRead(&bzerror, D_BZ2(impl)->inbz2, buf, *read_inout);
 
@@ -177,19 +1217,7 @@ xarc_result_t d_bz2_read(xarc* x, xarc_decompress_impl* impl, void* buf,
 			 XC("Invalid BZIP2 stream"));
 		}
 		else
-		{
-#if XARC_NATIVE_WCHAR
-			/* Localize the BZIP2 error string */
-			size_t lenl = filesys_localize_char(edesc, -1, 0, 0);
-			xchar* edescl = malloc(sizeof(xchar) * lenl);
-			filesys_localize_char(edesc, -1, edescl, lenl);
-			xarc_set_error(x, XARC_DECOMPRESS_ERROR, bzerror, edescl);
-			free(edescl);
-			return XARC_DECOMPRESS_ERROR;
-#else
-			return xarc_set_error(x, XARC_DECOMPRESS_ERROR, bzerror, edesc);
-#endif
-		}
+			return set_error_bz2(x, bzerror, edesc);
 	}
 
 	/* Otherwise, if we read less than the amount requested, return
@@ -215,11 +1243,11 @@ xarc_result_t d_bz2_read(xarc* x, xarc_decompress_impl* impl, void* buf,
  *
  * See also: <xarc_decompress_impl>
  */
-const xchar* d_bz2_error_desc(xarc_decompress_impl* impl,
- int32_t error_id __attribute__((unused)))
+const xchar* d_bz2_error_desc(xarc_decompress_impl* impl, int32_t error_id)
 {
-	int errnum;
-	const char* edesc = BZ2_bzerror(D_BZ2(impl)->inbz2, &errnum);
+	int errnum = error_id;
+	const char* edesc = D_BZ2(impl)->inbz2 ?
+	 BZ2_bzerror(D_BZ2(impl)->inbz2, &errnum) : bz2_error_string(error_id);
 	/* BZ_IO_ERROR in errnum indicates an error in the standard I/O library; 
 	 * anything else indicates a BZIP2-specific error.
 	 */
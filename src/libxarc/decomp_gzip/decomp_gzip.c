@@ -23,18 +23,281 @@
 #include "build.h"
 
 #include <zlib.h>
+#include <stdio.h>
+#include <limits.h>
 #include <malloc.h>
 #include <string.h>
-#include <errno.h>
-#include <fcntl.h>
 #include "xarc_decompress.h"
 #include "xarc_impl.h"
 #include "filesys.h"
+#include "threads.h"
+#include "inflate_whole.h"
 
 
-#if defined(_WIN32) || defined(_WIN64)
-#define gzclose gzclose_r
-#endif
+#define INBUFSIZE 65536 /* The number of bytes to read in at a time */
+
+/* Multi-member input is cut into segments of roughly SEGMENT_TARGET bytes,
+ * each ending where a member starts; if no member start turns up by
+ * SEGMENT_MAX, the segment is cut there anyway and the members running
+ * through it get inflated in order on the reading thread.
+ */
+#define SEGMENT_TARGET 1048576
+#define SEGMENT_MAX 4194304
+/* The most a worker will inflate from one segment before giving it up to the
+ * reading thread.
+ */
+#define SEGMENT_OUT_MAX 16777216
+/* How far the member header checks look past the end of a segment */
+#define HEADER_LOOKAHEAD 18
+/* The most worker threads to start for one stream */
+#define MAX_WORKERS 16
+
+/* The amount of decompressed data between index checkpoints */
+#define INDEX_SPAN 4194304
+/* Skipping only jumps to a checkpoint if that saves at least this much
+ * inflating.
+ */
+#define INDEX_MIN_JUMP 1048576
+/* The size of the DEFLATE window saved with each checkpoint */
+#define WINDOW_SIZE 32768
+/* The size of a checkpoint's fixed fields in an index file */
+#define INDEX_POINT_SIZE 25
+/* Identifies an index file, and its version */
+static const uint8_t index_magic[8] = {'X', 'A', 'R', 'C', 'G', 'Z', 'I', 1};
+
+
+/* Enum: gz_segment_state
+ * SEGMENT_IDLE - No worker will touch the segment
+ * SEGMENT_QUEUED - Waiting for a worker
+ * SEGMENT_RUNNING - A worker is inflating the segment
+ * SEGMENT_DONE - Every member in the segment was inflated into <out>
+ * SEGMENT_FAILED - The segment has to be inflated on the reading thread
+ */
+enum
+{
+	SEGMENT_IDLE = 0,
+	SEGMENT_QUEUED,
+	SEGMENT_RUNNING,
+	SEGMENT_DONE,
+	SEGMENT_FAILED
+};
+
+
+/* Struct: gz_checkpoint
+ * A place in a GZIP stream where inflating can start again, as in zlib's
+ * "zran" example.
+ */
+typedef struct
+{
+	/* Variable: out
+	 * The checkpoint's offset in the decompressed data.
+	 */
+	uint64_t out;
+	/* Variable: in
+	 * The offset in the file of the first compressed byte after the
+	 * checkpoint.
+	 */
+	uint64_t in;
+	/* Variable: bits
+	 * If non-zero, the checkpoint falls this many bits before <in>, partway
+	 * through the previous byte.
+	 */
+	uint8_t bits;
+	/* Variable: window_len
+	 * The size of the inflate window at the checkpoint.
+	 */
+	uint32_t window_len;
+	/* Variable: window
+	 * The window, compressed with ZLIB.
+	 */
+	uint8_t* window;
+	/* Variable: window_zlen
+	 * The number of bytes at <window>.
+	 */
+	uint32_t window_zlen;
+} gz_checkpoint;
+
+
+/* Struct: gz_index
+ * Checkpoints for a GZIP archive, kept in a file beside it (see
+ * XARC_OFLAG_GZIP_INDEX).
+ */
+typedef struct
+{
+	/* Variable: path
+	 * The index file's path.
+	 */
+	xchar* path;
+	/* Variable: archive_size
+	 * The size of the archive the index belongs to.
+	 */
+	uint64_t archive_size;
+	/* Variable: archive_time
+	 * The modification time of the archive the index belongs to.
+	 */
+	int64_t archive_time;
+	/* Variable: points
+	 * The checkpoints, in order.
+	 */
+	gz_checkpoint* points;
+	/* Variable: count
+	 * The number of entries in <points>.
+	 */
+	uint32_t count;
+	/* Variable: dirty
+	 * Set when checkpoints were added since the index file was read.
+	 */
+	uint8_t dirty;
+} gz_index;
+
+
+/* Struct: gz_segment
+ * A stretch of compressed input, and the output of inflating it.
+ */
+typedef struct _gz_segment
+{
+	/* Variable: next
+	 * The following segment of input, or NULL.
+	 */
+	struct _gz_segment* next;
+	/* Variable: in
+	 * The compressed input.
+	 */
+	const uint8_t* in;
+	/* Variable: in_len
+	 * The number of bytes at <in>.
+	 */
+	size_t in_len;
+	/* Variable: in_owned
+	 * <in> when it's a copy of file data, to be freed with the segment.
+	 */
+	uint8_t* in_owned;
+	/* Variable: at_member
+	 * Set if the segment starts with what looks like a GZIP member header.
+	 */
+	uint8_t at_member;
+	/* Variable: state
+	 * See <gz_segment_state>; guarded by <gz_parallel.lock>.
+	 */
+	uint8_t state;
+	/* Variable: ends_stream
+	 * Set if something other than a GZIP member follows the last member in
+	 * the segment, ending the stream.
+	 */
+	uint8_t ends_stream;
+	/* Variable: out
+	 * The inflated data, once <state> is SEGMENT_DONE.
+	 */
+	uint8_t* out;
+	/* Variable: out_len
+	 * The number of bytes at <out>.
+	 */
+	size_t out_len;
+	/* Variable: out_pos
+	 * The number of bytes of <out> already handed to the caller.
+	 */
+	size_t out_pos;
+} gz_segment;
+
+
+/* Struct: gz_worker
+ * A thread inflating segments.
+ */
+typedef struct
+{
+	/* Variable: thread
+	 * The running thread.
+	 */
+	threads_thread* thread;
+	/* Variable: strm
+	 * The thread's own inflate stream.
+	 */
+	z_stream strm;
+	/* Variable: whole
+	 * The thread's decompressor for BGZF blocks, or NULL.
+	 */
+	inflate_whole* whole;
+	/* Variable: par
+	 * The <gz_parallel> state the thread takes segments from.
+	 */
+	struct _gz_parallel* par;
+} gz_worker;
+
+
+/* Struct: gz_parallel
+ * State for inflating the members of a multi-member stream concurrently.
+ * Segments are cut from the input on the reading thread and queued for the
+ * workers; the reading thread then hands out their output in order. Member
+ * starts are found by looking for GZIP headers, or from the block sizes
+ * stored in BGZF headers, so a segment may start in the middle of a member;
+ * a segment that doesn't inflate cleanly on its own is inflated on the
+ * reading thread instead, carrying on through following segments until a
+ * member ends exactly where one starts.
+ */
+typedef struct _gz_parallel
+{
+	/* Variable: lock
+	 * Guards the segment list and segment states.
+	 */
+	threads_mutex* lock;
+	/* Variable: cond
+	 * Broadcast when a segment is queued or finished, and on shutdown.
+	 */
+	threads_cond* cond;
+	/* Variable: workers
+	 * The running worker threads.
+	 */
+	gz_worker* workers;
+	/* Variable: num_workers
+	 * The number of entries in <workers>.
+	 */
+	uint32_t num_workers;
+	/* Variable: stop
+	 * Set to tell the workers to exit.
+	 */
+	uint8_t stop;
+	/* Variable: head
+	 * The oldest segment not yet fully consumed.
+	 */
+	gz_segment* head;
+	/* Variable: tail
+	 * The newest segment.
+	 */
+	gz_segment* tail;
+	/* Variable: count
+	 * The number of segments in the list.
+	 */
+	uint32_t count;
+	/* Variable: pend
+	 * Input not yet cut into segments: a buffer filled from the file, or the
+	 * rest of the caller's memory.
+	 */
+	const uint8_t* pend;
+	/* Variable: pend_buf
+	 * The allocated buffer behind <pend> when reading from a file.
+	 */
+	uint8_t* pend_buf;
+	/* Variable: pend_len
+	 * The number of bytes at <pend>.
+	 */
+	size_t pend_len;
+	/* Variable: in_eof
+	 * Set once the whole input has been read into <pend>.
+	 */
+	uint8_t in_eof;
+	/* Variable: next_at_member
+	 * Whether the next segment cut from <pend> starts at a member header.
+	 */
+	uint8_t next_at_member;
+	/* Variable: inline_mode
+	 * Set while the reading thread is inflating segments itself.
+	 */
+	uint8_t inline_mode;
+	/* Variable: head_fed
+	 * Set once <head> has been handed to the reading thread's inflate stream.
+	 */
+	uint8_t head_fed;
+} gz_parallel;
 
 
 /* Struct: d_gzip_impl
@@ -49,31 +312,964 @@ typedef struct
 	 */
 	xarc_decompress_impl base;
 	/* Variable: infile
-	 * The ZLIB decompression object.
+	 * The input file, or NULL when inflating from the caller's buffer.
+	 */
+	filesys_reader* infile;
+	/* Variable: inbuf
+	 * Input buffer for <infile>; NULL when inflating straight from memory:
+	 * the caller's buffer, or <infile> mapped into memory.
+	 */
+	Bytef* inbuf;
+	/* Variable: mem
+	 * The start of the input, when inflating straight from memory.
+	 */
+	const uint8_t* mem;
+	/* Variable: mem_len
+	 * The size of <mem>.
+	 */
+	size_t mem_len;
+	/* Variable: strm
+	 * The ZLIB inflate stream.
+	 */
+	z_stream strm;
+	/* Variable: mem_left
+	 * When reading from memory, the amount of input beyond what's been handed
+	 * to <strm> so far (ZLIB's counters are narrower than size_t).
+	 */
+	size_t mem_left;
+	/* Variable: in_pos
+	 * The input offset just past the data handed to <strm>.
+	 */
+	uint64_t in_pos;
+	/* Variable: out_pos
+	 * The amount of data decompressed so far.
+	 */
+	uint64_t out_pos;
+	/* Variable: index
+	 * Checkpoints to seek to when skipping, and to add to while reading; NULL
+	 * unless opened with XARC_OFLAG_GZIP_INDEX.
 	 */
-	gzFile infile;
+	gz_index* index;
+	/* Variable: raw_member
+	 * Set after resuming at a checkpoint, where <strm> inflates without the
+	 * GZIP wrapper: the current member's trailer must be passed over by hand.
+	 */
+	uint8_t raw_member;
+	/* Variable: par
+	 * Concurrent inflate state, once a second member has turned up on a
+	 * machine with more than one processor.
+	 */
+	gz_parallel* par;
+	/* Variable: done
+	 * Set once the last GZIP member has been fully inflated.
+	 */
+	uint8_t done;
+	/* Variable: error
+	 * The most recent ZLIB error message.
+	 */
+	const char* error;
 #if XARC_NATIVE_WCHAR
 	/* Variable: localized_error
 	 * Holds the localized return value of <d_gzip_error_desc> when the native
-	 * character size is wider than a char.
+	 * char type is wchar_t.
 	 */
-	xchar* localized_error;
+	wchar_t* localized_error;
 #endif
 } d_gzip_impl;
 #define D_GZIP(base) ((d_gzip_impl*)base)
 
 
+/* Section: Static Functions */
+
+
+/* Set a decompression error carrying a ZLIB error string */
+static xarc_result_t set_error_zlib(xarc* x, int errnum, const char* edesc)
+{
+#if XARC_NATIVE_WCHAR
+	/* Localize the ZLIB error string */
+	size_t lenl = filesys_localize_char(edesc, -1, 0, 0);
+	xchar* edescl = malloc(sizeof(xchar) * lenl);
+	filesys_localize_char(edesc, -1, edescl, lenl);
+	xarc_set_error(x, XARC_DECOMPRESS_ERROR, errnum, XC("%s"), edescl);
+	free(edescl);
+	return XARC_DECOMPRESS_ERROR;
+#else
+	return xarc_set_error(x, XARC_DECOMPRESS_ERROR, errnum, XC("%s"), edesc);
+#endif
+}
+
+/* Make sure <strm> has input, if there is any left: the next stretch of
+ * memory, or the next read from the file.
+ */
+static xarc_result_t fill_input(xarc* x, d_gzip_impl* i)
+{
+	z_stream* zs = &i->strm;
+	if (zs->avail_in > 0)
+		return XARC_OK;
+	if (!i->inbuf)
+	{
+		zs->avail_in = (i->mem_left > UINT_MAX) ? UINT_MAX : (uInt)i->mem_left;
+		i->mem_left -= zs->avail_in;
+		i->in_pos += zs->avail_in;
+		return XARC_OK;
+	}
+	size_t got;
+	zs->next_in = i->inbuf;
+	zs->avail_in = 0;
+	if (filesys_reader_read(i->infile, i->inbuf, INBUFSIZE, &got) != 0)
+	{
+		return xarc_set_error_filesys(x,
+		 XC("Error while reading from file for GZIP decompression"));
+	}
+	zs->avail_in = (uInt)got;
+	i->in_pos += got;
+	return XARC_OK;
+}
+
+
+/* Store and fetch little-endian numbers (GZIP trailers, index files) */
+static void put_le(uint8_t* p, uint64_t v, int n)
+{
+	int b;
+	for (b = 0; b < n; ++b)
+		p[b] = (uint8_t)(v >> (8 * b));
+}
+
+static uint64_t get_le(const uint8_t* p, int n)
+{
+	uint64_t v = 0;
+	int b;
+	for (b = n - 1; b >= 0; --b)
+		v = (v << 8) | p[b];
+	return v;
+}
+
+/* Whether "p" looks like the start of a GZIP member: the magic bytes, the
+ * deflate method and no reserved flags.
+ */
+static int member_header(const uint8_t* p, size_t avail)
+{
+	return avail >= 10 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8
+	 && (p[3] & 0xe0) == 0;
+}
+
+/* The length of the member at "p" if it's a BGZF block, whose header records
+ * it in a "BC" extra subfield; 0 otherwise.
+ */
+static size_t bgzf_block_size(const uint8_t* p, size_t avail)
+{
+	if (avail < HEADER_LOOKAHEAD || !member_header(p, avail) || !(p[3] & 4))
+		return 0;
+	if (p[10] < 6 || p[12] != 'B' || p[13] != 'C' || p[14] != 2 || p[15] != 0)
+		return 0;
+	return (size_t)(p[16] | (p[17] << 8)) + 1;
+}
+
+/* Choose where to end a segment taken from the "len" bytes at "p". Sets
+ * "*at_member" if the segment ends where a member header starts.
+ */
+static size_t find_cut(const uint8_t* p, size_t len, uint8_t* at_member)
+{
+	*at_member = 0;
+	if (len <= SEGMENT_TARGET)
+		return len;
+
+	/* Walk BGZF blocks by their recorded sizes */
+	size_t pos = 0;
+	size_t block;
+	while (pos < SEGMENT_TARGET
+	 && (block = bgzf_block_size(p + pos, len - pos)) > 0)
+		pos += block;
+	if (pos >= len)
+		return len;
+	if (pos >= SEGMENT_TARGET && member_header(p + pos, len - pos))
+	{
+		*at_member = 1;
+		return pos;
+	}
+
+	/* Otherwise look for the next member header */
+	size_t limit = (len < SEGMENT_MAX) ? len : SEGMENT_MAX;
+	if (pos < SEGMENT_TARGET)
+		pos = SEGMENT_TARGET;
+	while (pos < limit)
+	{
+		const uint8_t* q = memchr(p + pos, 0x1f, limit - pos);
+		if (!q)
+			break;
+		pos = q - p;
+		if (member_header(q, len - pos))
+		{
+			*at_member = 1;
+			return pos;
+		}
+		++pos;
+	}
+	return limit;
+}
+
+/* Make room for at least "need" more bytes of output in a segment, up to
+ * SEGMENT_OUT_MAX in all. Returns 0 if there can't be.
+ */
+static int grow_output(gz_segment* seg, size_t* cap, size_t need)
+{
+	if (*cap - seg->out_len >= need)
+		return 1;
+	if (SEGMENT_OUT_MAX - seg->out_len < need)
+		return 0;
+	size_t grown_cap = *cap;
+	while (grown_cap - seg->out_len < need)
+		grown_cap = (grown_cap * 2 > SEGMENT_OUT_MAX) ? SEGMENT_OUT_MAX
+		 : grown_cap * 2;
+	uint8_t* grown = realloc(seg->out, grown_cap);
+	if (!grown)
+		return 0;
+	seg->out = grown;
+	*cap = grown_cap;
+	return 1;
+}
+
+/* Decode a complete BGZF block of "len" bytes at "p" into a segment's output
+ * in one call; its trailer gives the decompressed size and CRC.
+ */
+static int inflate_bgzf_block(inflate_whole* whole, gz_segment* seg,
+ size_t* cap, const uint8_t* p, size_t len)
+{
+	size_t header_len = 12 + (p[10] | (p[11] << 8));
+	if (len < header_len + 8)
+		return 0;
+	uLong crc = (uLong)get_le(p + len - 8, 4);
+	size_t size = (size_t)get_le(p + len - 4, 4);
+	if (!grow_output(seg, cap, size))
+		return 0;
+	uint8_t* out = seg->out + seg->out_len;
+	if (inflate_whole_run(whole, p + header_len, len - header_len - 8, out,
+	 size, 0) != 0 || crc32(0, out, (uInt)size) != crc)
+		return 0;
+	seg->out_len += size;
+	return 1;
+}
+
+/* Inflate every member in a segment into its output buffer. Returns 0 if the
+ * segment ran out of input partway through a member, didn't start with one,
+ * or inflated to more than SEGMENT_OUT_MAX bytes.
+ */
+static int inflate_segment(gz_worker* w, gz_segment* seg)
+{
+	size_t cap = (seg->in_len < 16384) ? 65536 : seg->in_len * 4;
+	if (cap > SEGMENT_OUT_MAX)
+		cap = SEGMENT_OUT_MAX;
+	seg->out = malloc(cap);
+	seg->out_len = 0;
+	if (!seg->out)
+		return 0;
+
+	/* BGZF blocks record both their sizes, so they can be decoded whole */
+	size_t pos = 0;
+	size_t block;
+	while (w->whole && pos < seg->in_len
+	 && (block = bgzf_block_size(seg->in + pos, seg->in_len - pos)) > 0
+	 && block <= seg->in_len - pos)
+	{
+		if (!inflate_bgzf_block(w->whole, seg, &cap, seg->in + pos, block))
+			return 0;
+		pos += block;
+	}
+	if (pos == seg->in_len)
+		return 1;
+
+	/* Anything else is inflated as a stream */
+	z_stream* zs = &w->strm;
+	inflateReset(zs);
+	zs->next_in = (Bytef*)seg->in + pos;
+	zs->avail_in = (uInt)(seg->in_len - pos);
+	while (1)
+	{
+		if (seg->out_len == cap && !grow_output(seg, &cap, 1))
+			return 0;
+		zs->next_out = seg->out + seg->out_len;
+		zs->avail_out = (uInt)(cap - seg->out_len);
+		int zret = inflate(zs, Z_NO_FLUSH);
+		seg->out_len = cap - zs->avail_out;
+
+		if (zret == Z_STREAM_END)
+		{
+			if (zs->avail_in == 0)
+				return 1;
+			if (zs->next_in[0] != 0x1f
+			 || (zs->avail_in >= 2 && zs->next_in[1] != 0x8b))
+			{
+				seg->ends_stream = 1;
+				return 1;
+			}
+			inflateReset(zs);
+		}
+		else if (zret == Z_BUF_ERROR && zs->avail_in == 0)
+			return 0;
+		else if (zret != Z_OK && zret != Z_BUF_ERROR)
+			return 0;
+	}
+}
+
+/* Worker thread: inflate queued segments, oldest first, until told to stop */
+static void worker_main(void* param)
+{
+	gz_worker* w = (gz_worker*)param;
+	gz_parallel* p = w->par;
+	threads_mutex_lock(p->lock);
+	while (!p->stop)
+	{
+		gz_segment* seg = p->head;
+		while (seg && seg->state != SEGMENT_QUEUED)
+			seg = seg->next;
+		if (!seg)
+		{
+			threads_cond_wait(p->cond, p->lock);
+			continue;
+		}
+		seg->state = SEGMENT_RUNNING;
+		threads_mutex_unlock(p->lock);
+
+		int ok = inflate_segment(w, seg);
+
+		threads_mutex_lock(p->lock);
+		seg->state = ok ? SEGMENT_DONE : SEGMENT_FAILED;
+		if (!ok)
+		{
+			free(seg->out);
+			seg->out = 0;
+		}
+		threads_cond_broadcast(p->cond);
+	}
+	threads_mutex_unlock(p->lock);
+}
+
+/* Wait until no worker is inflating a segment, and return its final state */
+static uint8_t wait_segment(gz_parallel* p, gz_segment* seg)
+{
+	threads_mutex_lock(p->lock);
+	while (seg->state == SEGMENT_QUEUED || seg->state == SEGMENT_RUNNING)
+		threads_cond_wait(p->cond, p->lock);
+	uint8_t state = seg->state;
+	threads_mutex_unlock(p->lock);
+	return state;
+}
+
+/* Drop the oldest segment, once no worker is using it */
+static void pop_segment(gz_parallel* p)
+{
+	gz_segment* seg = p->head;
+	threads_mutex_lock(p->lock);
+	while (seg->state == SEGMENT_RUNNING)
+		threads_cond_wait(p->cond, p->lock);
+	p->head = seg->next;
+	if (!p->head)
+		p->tail = 0;
+	--p->count;
+	threads_mutex_unlock(p->lock);
+
+	free(seg->in_owned);
+	free(seg->out);
+	free(seg);
+	p->head_fed = 0;
+}
+
+/* Cut segments from the input until enough are lined up to keep the workers
+ * busy.
+ */
+static xarc_result_t queue_segments(xarc* x, d_gzip_impl* i)
+{
+	gz_parallel* p = i->par;
+	while (p->count < p->num_workers + 2)
+	{
+		/* Top up the file buffer */
+		if (i->inbuf && !p->in_eof
+		 && p->pend_len < SEGMENT_MAX + HEADER_LOOKAHEAD)
+		{
+			memmove(p->pend_buf, p->pend, p->pend_len);
+			p->pend = p->pend_buf;
+			size_t want = SEGMENT_MAX + HEADER_LOOKAHEAD - p->pend_len;
+			size_t got;
+			if (filesys_reader_read(i->infile, p->pend_buf + p->pend_len, want,
+			 &got) != 0)
+			{
+				return xarc_set_error_filesys(x,
+				 XC("Error while reading from file for GZIP decompression"));
+			}
+			p->pend_len += got;
+			if (got < want)
+				p->in_eof = 1;
+		}
+		if (p->pend_len == 0)
+			break;
+
+		gz_segment* seg = (gz_segment*)malloc(sizeof(gz_segment));
+		uint8_t next_at_member;
+		seg->next = 0;
+		seg->in_len = find_cut(p->pend, p->pend_len, &next_at_member);
+		if (i->inbuf)
+		{
+			seg->in_owned = malloc(seg->in_len);
+			memcpy(seg->in_owned, p->pend, seg->in_len);
+			seg->in = seg->in_owned;
+		}
+		else
+		{
+			seg->in_owned = 0;
+			seg->in = p->pend;
+		}
+		p->pend += seg->in_len;
+		p->pend_len -= seg->in_len;
+		seg->at_member = p->next_at_member;
+		p->next_at_member = next_at_member;
+		seg->state = seg->at_member ? SEGMENT_QUEUED : SEGMENT_IDLE;
+		seg->ends_stream = 0;
+		seg->out = 0;
+		seg->out_len = 0;
+		seg->out_pos = 0;
+
+		threads_mutex_lock(p->lock);
+		if (p->tail)
+			p->tail->next = seg;
+		else
+			p->head = seg;
+		p->tail = seg;
+		++p->count;
+		if (seg->state == SEGMENT_QUEUED)
+			threads_cond_broadcast(p->cond);
+		threads_mutex_unlock(p->lock);
+	}
+	return XARC_OK;
+}
+
+/* Stop the workers and free all concurrent inflate state */
+static void stop_parallel(gz_parallel* p)
+{
+	threads_mutex_lock(p->lock);
+	p->stop = 1;
+	threads_cond_broadcast(p->cond);
+	threads_mutex_unlock(p->lock);
+	uint32_t w;
+	for (w = 0; w < p->num_workers; ++w)
+	{
+		threads_join(p->workers[w].thread);
+		inflateEnd(&p->workers[w].strm);
+		if (p->workers[w].whole)
+			inflate_whole_free(p->workers[w].whole);
+	}
+	while (p->head)
+	{
+		gz_segment* seg = p->head;
+		p->head = seg->next;
+		free(seg->in_owned);
+		free(seg->out);
+		free(seg);
+	}
+	threads_cond_free(p->cond);
+	threads_mutex_free(p->lock);
+	free(p->workers);
+	free(p->pend_buf);
+	free(p);
+}
+
+/* Switch to inflating the rest of the input concurrently, starting at the
+ * member header waiting in <strm>. Returns 0, leaving everything as it was,
+ * if there's only one processor or the workers can't be started.
+ */
+static int start_parallel(d_gzip_impl* i)
+{
+	z_stream* zs = &i->strm;
+	uint32_t num_workers = threads_cpu_count();
+	if (num_workers < 2)
+		return 0;
+	if (num_workers > MAX_WORKERS)
+		num_workers = MAX_WORKERS;
+
+	gz_parallel* p = (gz_parallel*)calloc(1, sizeof(gz_parallel));
+	p->lock = threads_mutex_create();
+	p->cond = threads_cond_create();
+	p->workers = (gz_worker*)calloc(num_workers, sizeof(gz_worker));
+	if (i->inbuf)
+		p->pend_buf = malloc(SEGMENT_MAX + HEADER_LOOKAHEAD);
+	if (!p->lock || !p->cond || !p->workers || (i->inbuf && !p->pend_buf))
+	{
+		if (p->cond)
+			threads_cond_free(p->cond);
+		if (p->lock)
+			threads_mutex_free(p->lock);
+		free(p->workers);
+		free(p->pend_buf);
+		free(p);
+		return 0;
+	}
+	while (p->num_workers < num_workers)
+	{
+		gz_worker* w = &p->workers[p->num_workers];
+		w->par = p;
+		if (inflateInit2(&w->strm, 16 + MAX_WBITS) != Z_OK)
+			break;
+		w->whole = inflate_whole_create();
+		w->thread = threads_start(worker_main, w);
+		if (!w->thread)
+		{
+			inflateEnd(&w->strm);
+			if (w->whole)
+				inflate_whole_free(w->whole);
+			break;
+		}
+		++p->num_workers;
+	}
+	if (p->num_workers == 0)
+	{
+		stop_parallel(p);
+		return 0;
+	}
+
+	/* Whatever <strm> hasn't consumed yet is where the segments start */
+	if (i->inbuf)
+	{
+		memcpy(p->pend_buf, zs->next_in, zs->avail_in);
+		p->pend = p->pend_buf;
+		p->pend_len = zs->avail_in;
+	}
+	else
+	{
+		p->pend = zs->next_in;
+		p->pend_len = zs->avail_in + i->mem_left;
+		i->mem_left = 0;
+	}
+	zs->avail_in = 0;
+	p->next_at_member = 1;
+	i->par = p;
+	return 1;
+}
+
+/* Like <fill_input>, but taking input from the segment list: once <strm> has
+ * used up the oldest segment, the next one is handed over.
+ */
+static xarc_result_t fill_input_inline(xarc* x, d_gzip_impl* i)
+{
+	gz_parallel* p = i->par;
+	z_stream* zs = &i->strm;
+	if (zs->avail_in > 0)
+		return XARC_OK;
+	if (p->head_fed)
+		pop_segment(p);
+	xarc_result_t ret = queue_segments(x, i);
+	if (ret != XARC_OK)
+		return ret;
+	if (p->head)
+	{
+		zs->next_in = (Bytef*)p->head->in;
+		zs->avail_in = (uInt)p->head->in_len;
+		p->head_fed = 1;
+	}
+	return XARC_OK;
+}
+
+/* Start inflating on the reading thread at the oldest segment */
+static void begin_inline(d_gzip_impl* i)
+{
+	gz_parallel* p = i->par;
+	inflateReset(&i->strm);
+	i->strm.next_in = (Bytef*)p->head->in;
+	i->strm.avail_in = (uInt)p->head->in_len;
+	p->head_fed = 1;
+	p->inline_mode = 1;
+}
+
+/* The concurrent counterpart of <d_gzip_read>. Output is taken from the
+ * workers' segments in order; anything they couldn't inflate is inflated here
+ * with <strm>, as on the single-stream path.
+ */
+static xarc_result_t read_parallel(xarc* x, d_gzip_impl* i, uint8_t* buf,
+ size_t* read_inout)
+{
+	gz_parallel* p = i->par;
+	z_stream* zs = &i->strm;
+	size_t out_left = *read_inout;
+	xarc_result_t ret;
+	while (out_left > 0 && !i->done)
+	{
+		if (!p->inline_mode)
+		{
+			ret = queue_segments(x, i);
+			if (ret != XARC_OK)
+				return ret;
+			gz_segment* seg = p->head;
+			if (!seg)
+			{
+				i->done = 1;
+				break;
+			}
+			if (!seg->at_member)
+			{
+				/* The last member ended where a segment was cut for length;
+				 * carry on into whatever follows, as below.
+				 */
+				if (seg->in_len > 0 && seg->in[0] == 0x1f
+				 && (seg->in_len < 2 || seg->in[1] == 0x8b))
+					begin_inline(i);
+				else
+					i->done = 1;
+				continue;
+			}
+			if (wait_segment(p, seg) == SEGMENT_FAILED)
+			{
+				begin_inline(i);
+				continue;
+			}
+
+			/* Hand over the segment's output */
+			size_t n = seg->out_len - seg->out_pos;
+			if (n > out_left)
+				n = out_left;
+			memcpy(buf, seg->out + seg->out_pos, n);
+			buf += n;
+			out_left -= n;
+			i->out_pos += n;
+			seg->out_pos += n;
+			if (seg->out_pos == seg->out_len)
+			{
+				if (seg->ends_stream)
+					i->done = 1;
+				pop_segment(p);
+			}
+			continue;
+		}
+
+		ret = fill_input_inline(x, i);
+		if (ret != XARC_OK)
+			return ret;
+		zs->next_out = buf;
+		zs->avail_out = (out_left > UINT_MAX) ? UINT_MAX : (uInt)out_left;
+		uInt out_before = zs->avail_out;
+		uInt in_before = zs->avail_in;
+
+		int zret = inflate(zs, Z_NO_FLUSH);
+		buf += out_before - zs->avail_out;
+		out_left -= out_before - zs->avail_out;
+		i->out_pos += out_before - zs->avail_out;
+
+		if (zret == Z_STREAM_END)
+		{
+			ret = fill_input_inline(x, i);
+			if (ret != XARC_OK)
+				return ret;
+			if (zs->avail_in > 0 && zs->next_in[0] == 0x1f
+			 && (zs->avail_in < 2 || zs->next_in[1] == 0x8b))
+			{
+				/* If the member ended right where a segment starts, that
+				 * segment's output can be used as it is.
+				 */
+				if (zs->next_in == p->head->in && p->head->at_member)
+				{
+					zs->avail_in = 0;
+					p->head_fed = 0;
+					p->inline_mode = 0;
+				}
+				else
+					inflateReset(zs);
+			}
+			else
+				i->done = 1;
+		}
+		else if (zret == Z_BUF_ERROR && in_before == 0)
+		{
+			i->error = "unexpected end of file";
+			return set_error_zlib(x, zret, i->error);
+		}
+		else if (zret != Z_OK && zret != Z_BUF_ERROR)
+		{
+			i->error = zs->msg ? zs->msg : zError(zret);
+			return set_error_zlib(x, zret, i->error);
+		}
+	}
+
+	if (out_left > 0)
+	{
+		*read_inout -= out_left;
+		return xarc_set_error(x, XARC_DECOMPRESS_EOF, 0,
+		 XC("EOF while reading GZIP data"));
+	}
+	return XARC_OK;
+}
+
+
+static void free_index(gz_index* idx)
+{
+	uint32_t n;
+	for (n = 0; n < idx->count; ++n)
+		free(idx->points[n].window);
+	free(idx->points);
+	free(idx->path);
+	free(idx);
+}
+
+/* Read the checkpoints from an index file, if it's intact and was made for
+ * this version of the archive; otherwise just forget the ones read so far.
+ */
+static void load_index(gz_index* idx)
+{
+	FILE* f = xfopen(idx->path, XC("rb"));
+	if (!f)
+		return;
+
+	uint8_t head[32];
+	if (fread(head, 1, sizeof(head), f) != sizeof(head)
+	 || memcmp(head, index_magic, sizeof(index_magic)) != 0
+	 || get_le(head + 8, 8) != idx->archive_size
+	 || (int64_t)get_le(head + 16, 8) != idx->archive_time
+	 || get_le(head + 24, 4) != INDEX_SPAN)
+	{
+		fclose(f);
+		return;
+	}
+	uint32_t count = (uint32_t)get_le(head + 28, 4);
+	idx->points = (gz_checkpoint*)calloc(count ? count : 1,
+	 sizeof(gz_checkpoint));
+	uint64_t last_out = 0;
+	while (idx->points && idx->count < count)
+	{
+		uint8_t rec[INDEX_POINT_SIZE];
+		if (fread(rec, 1, sizeof(rec), f) != sizeof(rec))
+			break;
+		gz_checkpoint* cp = &idx->points[idx->count];
+		cp->out = get_le(rec, 8);
+		cp->in = get_le(rec + 8, 8);
+		cp->bits = rec[16];
+		cp->window_len = (uint32_t)get_le(rec + 17, 4);
+		cp->window_zlen = (uint32_t)get_le(rec + 21, 4);
+		if (cp->out <= last_out || cp->in > idx->archive_size || cp->bits > 7
+		 || cp->window_len > WINDOW_SIZE
+		 || cp->window_zlen > compressBound(WINDOW_SIZE))
+			break;
+		cp->window = malloc(cp->window_zlen ? cp->window_zlen : 1);
+		if (!cp->window || fread(cp->window, 1, cp->window_zlen, f)
+		 != cp->window_zlen)
+		{
+			free(cp->window);
+			break;
+		}
+		last_out = cp->out;
+		++idx->count;
+	}
+	fclose(f);
+
+	if (idx->count < count)
+	{
+		while (idx->count > 0)
+			free(idx->points[--idx->count].window);
+		free(idx->points);
+		idx->points = 0;
+	}
+}
+
+/* Write the index file; it's only an aid, so failure is silently ignored */
+static void save_index(gz_index* idx)
+{
+	FILE* f = xfopen(idx->path, XC("wb"));
+	if (!f)
+		return;
+	uint8_t head[32];
+	memcpy(head, index_magic, sizeof(index_magic));
+	put_le(head + 8, idx->archive_size, 8);
+	put_le(head + 16, (uint64_t)idx->archive_time, 8);
+	put_le(head + 24, INDEX_SPAN, 4);
+	put_le(head + 28, idx->count, 4);
+	int ok = (fwrite(head, 1, sizeof(head), f) == sizeof(head));
+	uint32_t n;
+	for (n = 0; ok && n < idx->count; ++n)
+	{
+		gz_checkpoint* cp = &idx->points[n];
+		uint8_t rec[INDEX_POINT_SIZE];
+		put_le(rec, cp->out, 8);
+		put_le(rec + 8, cp->in, 8);
+		rec[16] = cp->bits;
+		put_le(rec + 17, cp->window_len, 4);
+		put_le(rec + 21, cp->window_zlen, 4);
+		ok = (fwrite(rec, 1, sizeof(rec), f) == sizeof(rec)
+		 && fwrite(cp->window, 1, cp->window_zlen, f) == cp->window_zlen);
+	}
+	if (fclose(f) != 0 || !ok)
+		xremove(idx->path);
+}
+
+/* Set up the index for an archive file, reading any existing index file.
+ * Returns NULL if the archive isn't a regular file.
+ */
+static gz_index* open_index(filesys_reader* infile, const xchar* path)
+{
+	uint64_t size;
+	int64_t mod_time;
+	if (filesys_reader_stamp(infile, &size, &mod_time) != 0)
+		return 0;
+	gz_index* idx = (gz_index*)calloc(1, sizeof(gz_index));
+	size_t len = xstrlen(path);
+	static const xchar ext[] = XC(".xarcidx");
+	idx->path = malloc(sizeof(xchar) * len + sizeof(ext));
+	memcpy(idx->path, path, sizeof(xchar) * len);
+	memcpy(idx->path + len, ext, sizeof(ext));
+	idx->archive_size = size;
+	idx->archive_time = mod_time;
+	load_index(idx);
+	return idx;
+}
+
+/* Add a checkpoint if <strm> has just finished a DEFLATE block (other than
+ * the last in a member) and the last checkpoint is far enough behind.
+ */
+static void maybe_add_checkpoint(d_gzip_impl* i)
+{
+	gz_index* idx = i->index;
+	z_stream* zs = &i->strm;
+	uint64_t last = idx->count ? idx->points[idx->count - 1].out : 0;
+	if (!(zs->data_type & 128) || (zs->data_type & 64)
+	 || i->out_pos < last + INDEX_SPAN)
+		return;
+
+	uint8_t window[WINDOW_SIZE];
+	uInt window_len = WINDOW_SIZE;
+	if (inflateGetDictionary(zs, window, &window_len) != Z_OK)
+		return;
+	uLongf zlen = compressBound(window_len);
+	uint8_t* z = malloc(zlen);
+	if (!z || compress2(z, &zlen, window, window_len, Z_BEST_SPEED) != Z_OK)
+	{
+		free(z);
+		return;
+	}
+	if ((idx->count & 63) == 0)
+	{
+		gz_checkpoint* grown = realloc(idx->points,
+		 sizeof(gz_checkpoint) * (idx->count + 64));
+		if (!grown)
+		{
+			free(z);
+			return;
+		}
+		idx->points = grown;
+	}
+	gz_checkpoint* cp = &idx->points[idx->count++];
+	cp->out = i->out_pos;
+	cp->in = i->in_pos - zs->avail_in;
+	cp->bits = zs->data_type & 7;
+	cp->window_len = window_len;
+	cp->window = z;
+	cp->window_zlen = (uint32_t)zlen;
+	idx->dirty = 1;
+}
+
+/* Find the last checkpoint at or before a decompressed offset */
+static const gz_checkpoint* find_checkpoint(const gz_index* idx, uint64_t out)
+{
+	uint32_t lo = 0;
+	uint32_t hi = idx->count;
+	while (lo < hi)
+	{
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (idx->points[mid].out <= out)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? &idx->points[lo - 1] : 0;
+}
+
+/* Start inflating again at a checkpoint. Returns XARC_OK without moving if
+ * the checkpoint's window doesn't decompress.
+ */
+static xarc_result_t resume_at_checkpoint(xarc* x, d_gzip_impl* i,
+ const gz_checkpoint* cp)
+{
+	z_stream* zs = &i->strm;
+	uint8_t window[WINDOW_SIZE];
+	uLongf window_len = WINDOW_SIZE;
+	if (cp->window_len > 0 && (uncompress(window, &window_len, cp->window,
+	 cp->window_zlen) != Z_OK || window_len != cp->window_len))
+		return XARC_OK;
+
+	if (i->par)
+	{
+		stop_parallel(i->par);
+		i->par = 0;
+	}
+	uint64_t at = cp->in - (cp->bits ? 1 : 0);
+	if (!i->inbuf)
+	{
+		zs->next_in = (Bytef*)i->mem + at;
+		i->mem_left = i->mem_len - (size_t)at;
+	}
+	else if (filesys_reader_seek(i->infile, at) != 0)
+	{
+		return xarc_set_error_filesys(x,
+		 XC("Error while seeking in file for GZIP decompression"));
+	}
+	i->in_pos = at;
+	zs->avail_in = 0;
+	inflateReset2(zs, -MAX_WBITS);
+	if (cp->bits)
+	{
+		xarc_result_t ret = fill_input(x, i);
+		if (ret != XARC_OK)
+			return ret;
+		if (zs->avail_in == 0)
+		{
+			i->error = "unexpected end of file";
+			return set_error_zlib(x, Z_BUF_ERROR, i->error);
+		}
+		inflatePrime(zs, cp->bits, zs->next_in[0] >> (8 - cp->bits));
+		++zs->next_in;
+		--zs->avail_in;
+	}
+	if (cp->window_len > 0)
+		inflateSetDictionary(zs, window, (uInt)window_len);
+	i->raw_member = 1;
+	i->out_pos = cp->out;
+	i->done = 0;
+	return XARC_OK;
+}
+
+/* After resuming at a checkpoint, pass over the trailer of the member the
+ * checkpoint was in, and expect GZIP headers again.
+ */
+static xarc_result_t end_raw_member(xarc* x, d_gzip_impl* i)
+{
+	z_stream* zs = &i->strm;
+	uInt left = 8;
+	while (left > 0)
+	{
+		xarc_result_t ret = fill_input(x, i);
+		if (ret != XARC_OK)
+			return ret;
+		if (zs->avail_in == 0)
+		{
+			i->error = "unexpected end of file";
+			return set_error_zlib(x, Z_BUF_ERROR, i->error);
+		}
+		uInt n = (zs->avail_in < left) ? zs->avail_in : left;
+		zs->next_in += n;
+		zs->avail_in -= n;
+		left -= n;
+	}
+	i->raw_member = 0;
+	inflateReset2(zs, 16 + MAX_WBITS);
+	return XARC_OK;
+}
+
 /* Section: GZIP decompression wrappers
  * See also: <decomp_open_func>, <xarc_decompress_impl>
  */
 
 
-xarc_result_t d_gzip_open(xarc* x, const xchar* path,
+xarc_result_t d_gzip_open(xarc* x, const xarc_source* src,
  xarc_decompress_impl** impl);
 void d_gzip_close(xarc_decompress_impl* impl);
 xarc_result_t d_gzip_read(xarc* x, xarc_decompress_impl* impl, void* buf,
  size_t* read_inout);
 const xchar* d_gzip_error_desc(xarc_decompress_impl* impl, int32_t error_id);
+xarc_result_t d_gzip_skip(xarc* x, xarc_decompress_impl* impl,
+ uint64_t* skip_inout);
 
 
 /* Link d_gzip_open as the opener function for the decomp_gzip module. */
@@ -82,27 +1278,23 @@ XARC_DEFINE_DECOMPRESSOR(decomp_gzip, d_gzip_open)
 
 /* Function: d_gzip_open
  *
- * Open a file for GZIP decompression.
+ * Open a file or memory buffer for GZIP decompression.
  *
  * See also: <decomp_open_func>
  */
-xarc_result_t d_gzip_open(xarc* x, const xchar* path,
+xarc_result_t d_gzip_open(xarc* x, const xarc_source* src,
  xarc_decompress_impl** impl)
 {
 	/* Open the file for reading */
-	int fd = filesys_read_open(path);
-	if (fd == -1)
-	{
-		return xarc_set_error_filesys(x, XC("Failed to open '%s' for reading"),
-		 path);
-	}
-
-	/* Open a gzip input stream on the file */
-	gzFile infile = gzdopen(fd, "rb");
-	if (!infile)
+	filesys_reader* infile = 0;
+	if (src->path)
 	{
-		return xarc_set_error(x, XARC_ERR_UNRECOGNIZED_COMPRESSION, 0,
-		 XC("Failed to open gzip input stream on '%s'"), path);
+		infile = filesys_reader_open(src->path);
+		if (!infile)
+		{
+			return xarc_set_error_filesys(x,
+			 XC("Failed to open '%s' for reading"), src->path);
+		}
 	}
 
 	/* Allocate and fill out a d_gzip_impl object */
@@ -110,12 +1302,74 @@ xarc_result_t d_gzip_open(xarc* x, const xchar* path,
 	i->base.close = d_gzip_close;
 	i->base.read = d_gzip_read;
 	i->base.error_desc = d_gzip_error_desc;
+	i->base.skip = 0;
+	i->base.copy = 0;
 	i->infile = infile;
+	i->inbuf = 0;
+	i->mem = (const uint8_t*)src->buf;
+	i->mem_len = src->len;
+	memset(&i->strm, 0, sizeof(z_stream));
+	i->mem_left = 0;
+	i->in_pos = 0;
+	i->out_pos = 0;
+	i->index = 0;
+	i->raw_member = 0;
+	i->par = 0;
+	i->done = 0;
+	i->error = 0;
 #if XARC_NATIVE_WCHAR
 	i->localized_error = 0;
 #endif
-	*impl = (xarc_decompress_impl*)i;
 
+	/* Inflate straight from the file's pages if it can be mapped */
+	if (infile)
+		i->mem = (const uint8_t*)filesys_reader_map(infile, &i->mem_len);
+
+	if (infile && !i->mem)
+	{
+		i->inbuf = malloc(INBUFSIZE);
+		i->strm.next_in = i->inbuf;
+		/* Start with whatever was already read while detecting the archive
+		 * type.
+		 */
+		uint64_t skipped;
+		if (src->probe && src->probe_len <= INBUFSIZE
+		 && filesys_reader_skip(infile, src->probe_len, &skipped) == 0
+		 && skipped == src->probe_len)
+		{
+			memcpy(i->inbuf, src->probe, src->probe_len);
+			i->strm.avail_in = (uInt)src->probe_len;
+			i->in_pos = src->probe_len;
+		}
+	}
+	else
+	{
+		/* Inflate straight from memory */
+		i->strm.next_in = (Bytef*)i->mem;
+		i->mem_left = i->mem_len;
+	}
+	if (infile && (src->flags & XARC_OFLAG_GZIP_INDEX))
+	{
+		i->index = open_index(infile, src->path);
+		if (i->index)
+			i->base.skip = d_gzip_skip;
+	}
+
+	/* 16 + MAX_WBITS: expect a GZIP header and trailer */
+	int zret = inflateInit2(&i->strm, 16 + MAX_WBITS);
+	if (zret != Z_OK)
+	{
+		set_error_zlib(x, zret, i->strm.msg ? i->strm.msg : zError(zret));
+		if (infile)
+			filesys_reader_close(infile);
+		if (i->index)
+			free_index(i->index);
+		free(i->inbuf);
+		free(i);
+		return XARC_DECOMPRESS_ERROR;
+	}
+
+	*impl = (xarc_decompress_impl*)i;
 	return XARC_OK;
 }
 
@@ -128,9 +1382,21 @@ xarc_result_t d_gzip_open(xarc* x, const xchar* path,
  */
 void d_gzip_close(xarc_decompress_impl* impl)
 {
-	/* Close the GZIP file */
-	gzclose(D_GZIP(impl)->infile);
+	/* Stop any workers, then close the inflate stream and the input file */
+	if (D_GZIP(impl)->par)
+		stop_parallel(D_GZIP(impl)->par);
+	/* Save any new checkpoints */
+	if (D_GZIP(impl)->index)
+	{
+		if (D_GZIP(impl)->index->dirty)
+			save_index(D_GZIP(impl)->index);
+		free_index(D_GZIP(impl)->index);
+	}
+	inflateEnd(&D_GZIP(impl)->strm);
+	if (D_GZIP(impl)->infile)
+		filesys_reader_close(D_GZIP(impl)->infile);
 	/* Free heap memory */
+	free(D_GZIP(impl)->inbuf);
 #if XARC_NATIVE_WCHAR
 	if (D_GZIP(impl)->localized_error)
 		free(D_GZIP(impl)->localized_error);
@@ -148,48 +1414,131 @@ void d_gzip_close(xarc_decompress_impl* impl)
 xarc_result_t d_gzip_read(xarc* x, xarc_decompress_impl* impl, void* buf,
  size_t* read_inout)
 {
-	int read = gzread(D_GZIP(impl)->infile, buf, (unsigned)(*read_inout));
-
-	/* For any result less than 0, return due to an unrecoverable decompression
-	 * error.
-	 */
-	if (read < 0)
+	d_gzip_impl* i = D_GZIP(impl);
+	if (i->par)
+		return read_parallel(x, i, (uint8_t*)buf, read_inout);
+	z_stream* zs = &i->strm;
+	size_t out_left = *read_inout;
+	zs->next_out = (Bytef*)buf;
+	while (out_left > 0 && !i->done)
 	{
-		int errnum;
-		const char* edesc = gzerror(D_GZIP(impl)->infile, &errnum);
-		if (errnum == Z_ERRNO)
+		/* Hand over the next stretch of input and output */
+		xarc_result_t ret = fill_input(x, i);
+		if (ret != XARC_OK)
+			return ret;
+		zs->avail_out = (out_left > UINT_MAX) ? UINT_MAX : (uInt)out_left;
+		uInt out_before = zs->avail_out;
+		uInt in_before = zs->avail_in;
+
+		/* When indexing, stop at each block boundary for a possible
+		 * checkpoint.
+		 */
+		int zret = inflate(zs, i->index ? Z_BLOCK : Z_NO_FLUSH);
+		out_left -= out_before - zs->avail_out;
+		i->out_pos += out_before - zs->avail_out;
+		if (zret == Z_OK && i->index)
+			maybe_add_checkpoint(i);
+
+		if (zret == Z_STREAM_END)
 		{
-			return xarc_set_error_filesys(x,
-			 XC("Error while reading GZIP data"));
+			if (i->raw_member)
+			{
+				ret = end_raw_member(x, i);
+				if (ret != XARC_OK)
+					return ret;
+			}
+
+			/* Like gzread, carry on into a following GZIP member, if there is
+			 * one; anything else after the end is ignored.
+			 */
+			ret = fill_input(x, i);
+			if (ret != XARC_OK)
+				return ret;
+			if (zs->avail_in > 0 && zs->next_in[0] == 0x1f
+			 && (zs->avail_in < 2 || zs->next_in[1] == 0x8b))
+			{
+				/* With more than one member, the rest can be inflated
+				 * concurrently, unless it's being indexed.
+				 */
+				if (!i->index && start_parallel(i))
+				{
+					size_t got = *read_inout - out_left;
+					size_t rest = out_left;
+					ret = read_parallel(x, i, (uint8_t*)buf + got, &rest);
+					*read_inout = got + rest;
+					return ret;
+				}
+				inflateReset(zs);
+			}
+			else
+				i->done = 1;
 		}
-		else
+		else if (zret == Z_BUF_ERROR && in_before == 0)
 		{
-#if XARC_NATIVE_WCHAR
-			/* Localize the ZLIB error string */
-			size_t lenl = filesys_localize_char(edesc, -1, 0, 0);
-			xchar* edescl = malloc(sizeof(xchar) * lenl);
-			filesys_localize_char(edesc, -1, edescl, lenl);
-			xarc_set_error(x, XARC_DECOMPRESS_ERROR, errnum, edescl);
-			free(edescl);
-			return XARC_DECOMPRESS_ERROR;
-#else
-			return xarc_set_error(x, XARC_DECOMPRESS_ERROR, errnum, edesc);
-#endif
+			/* There was no input left to give ZLIB */
+			i->error = "unexpected end of file";
+			return set_error_zlib(x, zret, i->error);
+		}
+		else if (zret != Z_OK && zret != Z_BUF_ERROR)
+		{
+			i->error = zs->msg ? zs->msg : zError(zret);
+			return set_error_zlib(x, zret, i->error);
 		}
 	}
 
-	/* Otherwise, if we read less than the amount requested, return
-	 * XARC_DECOMPRESS_EOF.
+	/* If we read less than the amount requested, return XARC_DECOMPRESS_EOF.
 	 */
-	if ((size_t)read < *read_inout)
+	if (out_left > 0)
 	{
-		*read_inout = read;
+		*read_inout -= out_left;
 		return xarc_set_error(x, XARC_DECOMPRESS_EOF, 0,
 		 XC("EOF while reading GZIP data"));
 	}
 
 	/* If we got here, everything is fine. */
-	*read_inout = (size_t)read;
+	return XARC_OK;
+}
+
+
+/* Function: d_gzip_skip
+ *
+ * Skip decompressed data, first jumping to the last checkpoint in the index
+ * before the destination, if that saves enough inflating.
+ *
+ * See also: <xarc_decompress_impl>
+ */
+xarc_result_t d_gzip_skip(xarc* x, xarc_decompress_impl* impl,
+ uint64_t* skip_inout)
+{
+	d_gzip_impl* i = D_GZIP(impl);
+	uint64_t start = i->out_pos;
+	uint64_t target = start + *skip_inout;
+	xarc_result_t ret;
+
+	const gz_checkpoint* cp = find_checkpoint(i->index, target);
+	if (cp && !i->done && cp->out >= start + INDEX_MIN_JUMP)
+	{
+		ret = resume_at_checkpoint(x, i, cp);
+		if (ret != XARC_OK)
+		{
+			*skip_inout = 0;
+			return ret;
+		}
+	}
+
+	/* Inflate the rest of the way */
+	uint8_t scratch[65536];
+	while (i->out_pos < target)
+	{
+		size_t got = (target - i->out_pos > sizeof(scratch)) ? sizeof(scratch)
+		 : (size_t)(target - i->out_pos);
+		ret = d_gzip_read(x, impl, scratch, &got);
+		if (ret != XARC_OK)
+		{
+			*skip_inout = i->out_pos - start;
+			return ret;
+		}
+	}
 	return XARC_OK;
 }
 
@@ -204,13 +1553,7 @@ xarc_result_t d_gzip_read(xarc* x, xarc_decompress_impl* impl, void* buf,
 const xchar* d_gzip_error_desc(xarc_decompress_impl* impl,
  int32_t error_id __attribute__((unused)))
 {
-	int errnum;
-	const char* edesc = gzerror(D_GZIP(impl)->infile, &errnum);
-	/* Z_ERRNO in errnum indicates an error in the standard I/O library; 
-	 * anything else indicates a ZLIB-specific error.
-	 */
-	if (errnum == Z_ERRNO)
-		edesc = strerror(errno);
+	const char* edesc = D_GZIP(impl)->error ? D_GZIP(impl)->error : "";
 
 #if XARC_NATIVE_WCHAR
 	/* Localize error string */
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <malloc.h>
+#include <string.h>
 #include <LzmaDec.h>
 #include <7zAlloc.h>
 #include "xarc_impl.h"
@@ -43,7 +44,8 @@ typedef struct
 	 */
 	xarc_decompress_impl base;
 	/* Variable: infile
-	 * The stdio stream for reading the archive file.
+	 * The stdio stream for reading the archive file. NULL when reading from
+	 * memory.
 	 */
 	FILE* infile;
 	/* Variable: lzdecomp
@@ -51,17 +53,22 @@ typedef struct
 	 */
 	CLzmaDec lzdecomp;
 	/* Variable: inbuf
-	 * The buffer holding input data.
+	 * The buffer holding input data read from the file.
 	 */
 	Byte inbuf[INBUFSIZE];
+	/* Variable: in
+	 * The input data being decompressed: either <inbuf>, or the caller's
+	 * buffer when reading from memory.
+	 */
+	const Byte* in;
 	/* Variable: inbuf_at
-	 * The index in inbuf up to which the decompressor has already consumed.
+	 * The index in <in> up to which the decompressor has already consumed.
 	 */
-	uint16_t inbuf_at;
+	size_t inbuf_at;
 	/* Variable: inbuf_filled
-	 * The index in inbuf up to which input data is available.
+	 * The index in <in> up to which input data is available.
 	 */
-	uint16_t inbuf_filled;
+	size_t inbuf_filled;
 } d_lzma_impl;
 #define D_LZMA(base) ((d_lzma_impl*)base)
 
@@ -72,7 +79,7 @@ typedef struct
  */
 
 
-xarc_result_t d_lzma_open(xarc* x, const xchar* path,
+xarc_result_t d_lzma_open(xarc* x, const xarc_source* src,
  xarc_decompress_impl** impl);
 void d_lzma_close(xarc_decompress_impl* impl);
 xarc_result_t d_lzma_read(xarc* x, xarc_decompress_impl* impl, void* buf,
@@ -110,19 +117,23 @@ const xchar* lzma_error_strings[] = {
 
 /* Function: d_lzma_open
  *
- * Open a file for LZMA decompression.
+ * Open a file or memory buffer for LZMA decompression.
  *
  * See also: <decomp_open_func>
  */
-xarc_result_t d_lzma_open(xarc* x, const xchar* path,
+xarc_result_t d_lzma_open(xarc* x, const xarc_source* src,
  xarc_decompress_impl** impl)
 {
 	/* Open the file for reading */
-	FILE* infile = xfopen(path, XC("rb"));
-	if (!infile)
+	FILE* infile = 0;
+	if (src->path)
 	{
-		return xarc_set_error_filesys(x, XC("Failed to open '%s' for reading"),
-		 path);
+		infile = xfopen(src->path, XC("rb"));
+		if (!infile)
+		{
+			return xarc_set_error_filesys(x,
+			 XC("Failed to open '%s' for reading"), src->path);
+		}
 	}
 
 	/* Allocate and fill out a d_lzma_impl object */
@@ -130,19 +141,54 @@ xarc_result_t d_lzma_open(xarc* x, const xchar* path,
 	i->base.close = d_lzma_close;
 	i->base.read = d_lzma_read;
 	i->base.error_desc = d_lzma_error_desc;
+	i->base.skip = 0;
+	i->base.copy = 0;
 	i->infile = 0;
+	LzmaDec_Construct(&i->lzdecomp);
+	i->in = i->inbuf;
 	i->inbuf_at = 0;
 	i->inbuf_filled = 0;
 	*impl = (xarc_decompress_impl*)i;
 
 	/* Read the LZMA header -- stream properties plus 8 bytes uncompressed size
 	 */
-	uint8_t lzheader[LZMA_PROPS_SIZE + 8];
-	if (fread(lzheader, 1, LZMA_PROPS_SIZE + 8, infile) != LZMA_PROPS_SIZE + 8)
+	const uint8_t* lzheader;
+	if (infile)
+	{
+		/* Start with whatever was already read while detecting the archive
+		 * type, and read the rest of the header if that wasn't enough.
+		 */
+		lzheader = i->inbuf;
+		if (src->probe && src->probe_len <= INBUFSIZE
+		 && fseek(infile, (long)src->probe_len, SEEK_SET) == 0)
+		{
+			memcpy(i->inbuf, src->probe, src->probe_len);
+			i->inbuf_filled = src->probe_len;
+		}
+		if (i->inbuf_filled < LZMA_PROPS_SIZE + 8)
+		{
+			i->inbuf_filled += fread(i->inbuf + i->inbuf_filled, 1,
+			 LZMA_PROPS_SIZE + 8 - i->inbuf_filled, infile);
+		}
+		if (i->inbuf_filled < LZMA_PROPS_SIZE + 8)
+		{
+			fclose(infile);
+			return xarc_set_error(x, XARC_DECOMPRESS_ERROR, SZ_ERROR_UNSUPPORTED,
+			 XC("EOF reading LZMA stream properties from '%s'"), src->name);
+		}
+		i->inbuf_at = LZMA_PROPS_SIZE + 8;
+	}
+	else
 	{
-		fclose(infile);
-		return xarc_set_error(x, XARC_DECOMPRESS_ERROR, SZ_ERROR_UNSUPPORTED,
-		 XC("EOF reading LZMA stream properties from '%s'"), path);
+		if (src->len < LZMA_PROPS_SIZE + 8)
+		{
+			return xarc_set_error(x, XARC_DECOMPRESS_ERROR, SZ_ERROR_UNSUPPORTED,
+			 XC("EOF reading LZMA stream properties from '%s'"), src->name);
+		}
+		/* Decompress the rest straight from the caller's buffer */
+		lzheader = (const uint8_t*)src->buf;
+		i->in = lzheader + LZMA_PROPS_SIZE + 8;
+		i->inbuf_filled = src->len - (LZMA_PROPS_SIZE + 8);
 	}
 
 	/* Open a LZMA decompression stream */
@@ -151,9 +197,10 @@ xarc_result_t d_lzma_open(xarc* x, const xchar* path,
 	SRes ret = LzmaDec_Allocate(&lzdecomp, lzheader, LZMA_PROPS_SIZE, &g_Alloc);
 	if (ret != SZ_OK)
 	{
-		fclose(infile);
+		if (infile)
+			fclose(infile);
 		return xarc_set_error(x, XARC_DECOMPRESS_ERROR, ret,
-		 XC("Error initializing LZMA decompressor for '%s'"), path);
+		 XC("Error initializing LZMA decompressor for '%s'"), src->name);
 	}
 	LzmaDec_Init(&lzdecomp);
 
@@ -175,7 +222,8 @@ void d_lzma_close(xarc_decompress_impl* impl)
 	/* Close the LZMA decompressor */
 	LzmaDec_Free(&D_LZMA(impl)->lzdecomp, &g_Alloc);
 	/* Close the input file */
-	fclose(D_LZMA(impl)->infile);
+	if (D_LZMA(impl)->infile)
+		fclose(D_LZMA(impl)->infile);
 	/* Free heap memory */
 	free(impl);
 }
@@ -206,9 +254,10 @@ xarc_result_t d_lzma_read(xarc* x, xarc_decompress_impl* impl, void* buf,
 		{
 			/* If we've previously reached input EOF, no more data is available.
 			 * Since the decompressor has already consumed the entire buffer, we
-			 * are done and we return EOF.
+			 * are done and we return EOF. (In memory, all the input was
+			 * available from the start.)
 			 */
-			if (feof(D_LZMA(impl)->infile))
+			if (!D_LZMA(impl)->infile || feof(D_LZMA(impl)->infile))
 			{
 				return xarc_set_error(x, XARC_DECOMPRESS_EOF, 0,
 				 XC("EOF while reading LZMA data"));
@@ -248,7 +297,7 @@ xarc_result_t d_lzma_read(xarc* x, xarc_decompress_impl* impl, void* buf,
 		 */
 		SRes ret = LzmaDec_DecodeToBuf(&D_LZMA(impl)->lzdecomp,
 		 buf + *read_inout, &outbuffered,
-		 D_LZMA(impl)->inbuf + D_LZMA(impl)->inbuf_at, &inbuffered,
+		 D_LZMA(impl)->in + D_LZMA(impl)->inbuf_at, &inbuffered,
 		 LZMA_FINISH_ANY, &status);
 		*read_inout += outbuffered;
 		D_LZMA(impl)->inbuf_at += inbuffered;
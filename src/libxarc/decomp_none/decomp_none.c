@@ -0,0 +1,245 @@
+/* File: libxarc/decomp_none/decomp_none.c
+ * Pass-through "decompression" for archives stored without compression.
+ */
+
+/* Copyright 2013 John Eubank.
+
+   This file is part of XARC.
+
+   XARC is free software: you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   XARC is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with XARC.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "build.h"
+
+#include <malloc.h>
+#include <string.h>
+#include "xarc_decompress.h"
+#include "xarc_impl.h"
+#include "filesys.h"
+
+
+/* Struct: d_none_impl
+ * Extends: <xarc_decompress_impl>
+ *
+ * Data specific to the pass-through impl.
+ */
+typedef struct
+{
+	/* Variable: base
+	 * The base <xarc_decompress_impl> object.
+	 */
+	xarc_decompress_impl base;
+	/* Variable: infile
+	 * The input file, or NULL when reading from memory.
+	 */
+	filesys_reader* infile;
+	/* Variable: mem
+	 * The caller's buffer, when reading from memory.
+	 */
+	const uint8_t* mem;
+	/* Variable: mem_left
+	 * The amount of <mem> not yet read.
+	 */
+	size_t mem_left;
+} d_none_impl;
+#define D_NONE(base) ((d_none_impl*)base)
+
+
+/* Section: Pass-through wrappers
+ * See also: <decomp_open_func>, <xarc_decompress_impl>
+ */
+
+
+xarc_result_t d_none_open(xarc* x, const xarc_source* src,
+ xarc_decompress_impl** impl);
+void d_none_close(xarc_decompress_impl* impl);
+xarc_result_t d_none_read(xarc* x, xarc_decompress_impl* impl, void* buf,
+ size_t* read_inout);
+const xchar* d_none_error_desc(xarc_decompress_impl* impl, int32_t error_id);
+xarc_result_t d_none_skip(xarc* x, xarc_decompress_impl* impl,
+ uint64_t* skip_inout);
+xarc_result_t d_none_copy(xarc* x, xarc_decompress_impl* impl,
+ filesys_writer* to, uint64_t* copy_inout);
+
+
+/* Link d_none_open as the opener function for the decomp_none module. */
+XARC_DEFINE_DECOMPRESSOR(decomp_none, d_none_open)
+
+
+/* Function: d_none_open
+ *
+ * Open a file or memory buffer for reading as-is.
+ *
+ * See also: <decomp_open_func>
+ */
+xarc_result_t d_none_open(xarc* x, const xarc_source* src,
+ xarc_decompress_impl** impl)
+{
+	/* Open the file for reading. Anything read while detecting the archive
+	 * type is simply read again; there's no decoder state to prime.
+	 */
+	filesys_reader* infile = 0;
+	if (src->path)
+	{
+		infile = filesys_reader_open(src->path);
+		if (!infile)
+		{
+			return xarc_set_error_filesys(x,
+			 XC("Failed to open '%s' for reading"), src->path);
+		}
+	}
+
+	/* Allocate and fill out a d_none_impl object */
+	d_none_impl* i = (d_none_impl*)malloc(sizeof(d_none_impl));
+	i->base.close = d_none_close;
+	i->base.read = d_none_read;
+	i->base.error_desc = d_none_error_desc;
+	i->base.skip = d_none_skip;
+	/* Data in memory is copied into the writer's buffer like anything else */
+	i->base.copy = infile ? d_none_copy : 0;
+	i->infile = infile;
+	i->mem = (const uint8_t*)src->buf;
+	i->mem_left = infile ? 0 : src->len;
+
+	*impl = (xarc_decompress_impl*)i;
+	return XARC_OK;
+}
+
+
+/* Function: d_none_close
+ *
+ * Close a previously opened file.
+ *
+ * See also: <xarc_decompress_impl>
+ */
+void d_none_close(xarc_decompress_impl* impl)
+{
+	if (D_NONE(impl)->infile)
+		filesys_reader_close(D_NONE(impl)->infile);
+	free(impl);
+}
+
+
+/* Function: d_none_read
+ *
+ * Read data from the file or buffer as-is.
+ *
+ * See also: <xarc_decompress_impl>
+ */
+xarc_result_t d_none_read(xarc* x, xarc_decompress_impl* impl, void* buf,
+ size_t* read_inout)
+{
+	d_none_impl* i = D_NONE(impl);
+	size_t want = *read_inout;
+	if (i->infile)
+	{
+		if (filesys_reader_read(i->infile, buf, want, read_inout) != 0)
+		{
+			*read_inout = 0;
+			return xarc_set_error_filesys(x,
+			 XC("Error while reading from archive file"));
+		}
+	}
+	else
+	{
+		if (*read_inout > i->mem_left)
+			*read_inout = i->mem_left;
+		memcpy(buf, i->mem, *read_inout);
+		i->mem += *read_inout;
+		i->mem_left -= *read_inout;
+	}
+
+	/* If we read less than the amount requested, return XARC_DECOMPRESS_EOF.
+	 */
+	if (*read_inout < want)
+	{
+		return xarc_set_error(x, XARC_DECOMPRESS_EOF, 0,
+		 XC("EOF while reading archive data"));
+	}
+	return XARC_OK;
+}
+
+
+/* Function: d_none_error_desc
+ *
+ * Errors here all come from the file system, which describes them itself.
+ *
+ * See also: <xarc_decompress_impl>
+ */
+const xchar* d_none_error_desc(
+ xarc_decompress_impl* impl __attribute__((unused)),
+ int32_t error_id __attribute__((unused)))
+{
+	return XC("");
+}
+
+
+/* Function: d_none_skip
+ *
+ * Move forward without reading: a seek in the file, or just a pointer
+ * increment in memory.
+ *
+ * See also: <xarc_decompress_impl>
+ */
+xarc_result_t d_none_skip(xarc* x, xarc_decompress_impl* impl,
+ uint64_t* skip_inout)
+{
+	d_none_impl* i = D_NONE(impl);
+	uint64_t want = *skip_inout;
+	if (i->infile)
+	{
+		if (filesys_reader_skip(i->infile, want, skip_inout) != 0)
+		{
+			*skip_inout = 0;
+			return xarc_set_error_filesys(x,
+			 XC("Error while seeking in archive file"));
+		}
+	}
+	else
+	{
+		if (*skip_inout > i->mem_left)
+			*skip_inout = i->mem_left;
+		i->mem += *skip_inout;
+		i->mem_left -= (size_t)*skip_inout;
+	}
+
+	if (*skip_inout < want)
+	{
+		return xarc_set_error(x, XARC_DECOMPRESS_EOF, 0,
+		 XC("EOF while reading archive data"));
+	}
+	return XARC_OK;
+}
+
+
+/* Function: d_none_copy
+ *
+ * Copy data from the archive file to an output file without reading it in,
+ * where the platform allows.
+ *
+ * See also: <xarc_decompress_impl>
+ */
+xarc_result_t d_none_copy(xarc* x, xarc_decompress_impl* impl,
+ filesys_writer* to, uint64_t* copy_inout)
+{
+	uint64_t want = *copy_inout;
+	if (filesys_writer_copy(to, D_NONE(impl)->infile, want, copy_inout) != 0)
+		return xarc_set_error_filesys(x, 0);
+	if (*copy_inout < want)
+	{
+		return xarc_set_error(x, XARC_DECOMPRESS_EOF, 0,
+		 XC("EOF while reading archive data"));
+	}
+	return XARC_OK;
+}
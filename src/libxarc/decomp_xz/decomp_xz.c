@@ -22,6 +22,7 @@
 
 #include <inttypes.h>
 #include <malloc.h>
+#include <string.h>
 #include <7zAlloc.h>
 #include <7zCrc.h>
 #include <Xz.h>
@@ -45,7 +46,8 @@ typedef struct
 	 */
 	xarc_decompress_impl base;
 	/* Variable: infile
-	 * The stdio stream for reading the archive file.
+	 * The stdio stream for reading the archive file. NULL when reading from
+	 * memory.
 	 */
 	FILE* infile;
 	/* Variable: xzunpack
@@ -53,17 +55,22 @@ typedef struct
 	 */
 	CXzUnpacker xzunpack;
 	/* Variable: inbuf
-	 * The buffer holding input data.
+	 * The buffer holding input data read from the file.
 	 */
 	Byte inbuf[INBUFSIZE];
+	/* Variable: in
+	 * The input data being decompressed: either <inbuf>, or the caller's
+	 * buffer when reading from memory.
+	 */
+	const Byte* in;
 	/* Variable: inbuf_at
-	 * The index in inbuf up to which the decompressor has already consumed.
+	 * The index in <in> up to which the decompressor has already consumed.
 	 */
-	uint16_t inbuf_at;
+	size_t inbuf_at;
 	/* Variable: inbuf_filled
-	 * The index in inbuf up to which input data is available.
+	 * The index in <in> up to which input data is available.
 	 */
-	uint16_t inbuf_filled;
+	size_t inbuf_filled;
 } d_xz_impl;
 #define D_XZ(base) ((d_xz_impl*)base)
 
@@ -80,7 +87,7 @@ static ISzAlloc g_Alloc = { SzAlloc, SzFree };
  */
 
 
-xarc_result_t d_xz_open(xarc* x, const xchar* path,
+xarc_result_t d_xz_open(xarc* x, const xarc_source* src,
  xarc_decompress_impl** impl);
 void d_xz_close(xarc_decompress_impl* impl);
 xarc_result_t d_xz_read(xarc* x, xarc_decompress_impl* impl, void* buf,
@@ -94,9 +101,9 @@ XARC_DEFINE_DECOMPRESSOR(decomp_xz, d_xz_open)
 
 /* Function: d_xz_open
  *
- * Open a file for XZ decompression.
+ * Open a file or memory buffer for XZ decompression.
  */
-xarc_result_t d_xz_open(xarc* x, const xchar* path,
+xarc_result_t d_xz_open(xarc* x, const xarc_source* src,
  xarc_decompress_impl** impl)
 {
 	/* Initialize 7-zip's CRC tables */
@@ -104,11 +111,15 @@ xarc_result_t d_xz_open(xarc* x, const xchar* path,
 	Crc64GenerateTable();
 
 	/* Open the file for reading */
-	FILE* infile = xfopen(path, XC("rb"));
-	if (!infile)
+	FILE* infile = 0;
+	if (src->path)
 	{
-		return xarc_set_error_filesys(x, XC("Failed to open '%s' for reading"),
-		 path);
+		infile = xfopen(src->path, XC("rb"));
+		if (!infile)
+		{
+			return xarc_set_error_filesys(x,
+			 XC("Failed to open '%s' for reading"), src->path);
+		}
 	}
 
 	/* Open a decompression stream */
@@ -123,10 +134,26 @@ xarc_result_t d_xz_open(xarc* x, const xchar* path,
 	i->base.close = d_xz_close;
 	i->base.read = d_xz_read;
 	i->base.error_desc = d_xz_error_desc;
+	i->base.skip = 0;
+	i->base.copy = 0;
 	i->infile = infile;
 	i->xzunpack = xzunpack;
+	i->in = i->inbuf;
 	i->inbuf_at = 0;
 	i->inbuf_filled = 0;
+	if (!infile)
+	{
+		/* Decompress straight from the caller's buffer */
+		i->in = (const Byte*)src->buf;
+		i->inbuf_filled = src->len;
+	}
+	else if (src->probe && src->probe_len <= INBUFSIZE
+	 && fseek(infile, (long)src->probe_len, SEEK_SET) == 0)
+	{
+		/* Start with what was already read while detecting the archive type */
+		memcpy(i->inbuf, src->probe, src->probe_len);
+		i->inbuf_filled = src->probe_len;
+	}
 	*impl = (xarc_decompress_impl*)i;
 
 	return XARC_OK;
@@ -144,7 +171,8 @@ void d_xz_close(xarc_decompress_impl* impl)
 	/* Close the XZ decompressor */
 	XzUnpacker_Free(&(D_XZ(impl))->xzunpack);
 	/* Close the input file */
-	fclose(D_XZ(impl)->infile);
+	if (D_XZ(impl)->infile)
+		fclose(D_XZ(impl)->infile);
 	/* Free heap memory */
 	free(impl);
 }
@@ -160,7 +188,8 @@ xarc_result_t d_xz_read(xarc* x, xarc_decompress_impl* impl, void* buf,
 {
 	size_t to_get = *read_inout;
 	*read_inout = 0;
-	int srcFinished = 0;
+	/* In memory, all the input is available from the start */
+	int srcFinished = (D_XZ(impl)->infile == 0);
 	/* The LZMA decompressor requires us to manage the input buffer ourselves in
 	 * addition to the output buffer. Since the decompressor may not be able to
 	 * produce all the output we need in one pass at the input buffer, we need
@@ -207,7 +236,7 @@ xarc_result_t d_xz_read(xarc* x, xarc_decompress_impl* impl, void* buf,
 		 * contain the number of bytes consumed from the input buffer.
 		 */
 		SRes ret = XzUnpacker_Code(&D_XZ(impl)->xzunpack, buf + *read_inout, &outbuffered,
-    		D_XZ(impl)->inbuf + D_XZ(impl)->inbuf_at, &inbuffered, srcFinished,
+    		D_XZ(impl)->in + D_XZ(impl)->inbuf_at, &inbuffered, srcFinished,
     		CODER_FINISH_ANY, &status);
 		*read_inout += outbuffered;
 		D_XZ(impl)->inbuf_at += inbuffered;
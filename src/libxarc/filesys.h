@@ -29,6 +29,7 @@ extern "C" {
 
 
 #include <stdint.h>
+#include <stdio.h>
 #include <xarc.h>
 
 
@@ -42,6 +43,38 @@ typedef struct
 	uint32_t hi;
 } win_filetime;
 
+/* Struct: filesys_dir_cache
+ * Opaque record of directories already known to exist, so that extracting
+ * many entries into the same tree doesn't check and re-check every path
+ * component. Kept per <xarc> object (see <_xarc.dir_cache>) and not shared
+ * between threads.
+ *
+ * Entries are never removed: directories deleted by someone else while
+ * extracting are not noticed.
+ */
+typedef struct _filesys_dir_cache filesys_dir_cache;
+
+/* Struct: filesys_writer
+ * Opaque output file for an entry being extracted. Data is gathered in a
+ * large aligned buffer and written out with as few system calls as possible.
+ */
+typedef struct _filesys_writer filesys_writer;
+
+/* Struct: filesys_batch
+ * Opaque queue of output files being created, written and closed in the
+ * background (on Linux, through io_uring), so that many small files cost few
+ * system calls. Only available where the platform supports it; see
+ * <filesys_batch_create>.
+ */
+typedef struct _filesys_batch filesys_batch;
+
+/* Struct: filesys_reader
+ * Opaque input file read front to back, for archives that are stored
+ * uncompressed. Can hand its data straight to a <filesys_writer> (see
+ * <filesys_writer_copy>).
+ */
+typedef struct _filesys_reader filesys_reader;
+
 
 /* Section: Functions */
 
@@ -72,18 +105,24 @@ int8_t filesys_is_dir_sep(xchar ch);
  * Set attributes as specified by the WinAPI on a file.
  *
  * Parameters:
+ *   batch - The <xarc> object's <filesys_batch>, if any; if the file is
+ *     still queued there, this is applied once it has been written
  *   path - Set attributes on this file
  *   attr - Set these WinAPI attributes on the file
  */
-void filesys_set_attributes_win(const xchar* path, uint32_t attr);
+void filesys_set_attributes_win(filesys_batch* batch, const xchar* path,
+ uint32_t attr);
 /* Function: filesys_set_attributes_unix
  * Set permissions as specified by the Unix filesystem on a file.
  *
  * Parameters:
+ *   batch - The <xarc> object's <filesys_batch>, if any; if the file is
+ *     still queued there, this is applied once it has been written
  *   path - Set permissions on this file
  *   mode - Set these Unix permissions on the file
  */
-void filesys_set_attributes_unix(const xchar* path, int32_t mode);
+void filesys_set_attributes_unix(filesys_batch* batch, const xchar* path,
+ int32_t mode);
 /* Function: filesys_time_dos
  * Convert an MS-DOS format date & time to an <xarc_time_t>.
  *
@@ -114,30 +153,37 @@ void filesys_time_unix(uintmax_t utime, xarc_time_t* xtime);
  * Set the modification timestamp on a file from an MS-DOS format date & time.
  *
  * Parameters:
+ *   batch - The <xarc> object's <filesys_batch>, if any; if the file is
+ *     still queued there, this is applied once it has been written
  *   path - The file to set the modification timestamp on
  *   dosdate - DOS-format packed date
  *   dostime - DOS-format packed time
  */
-void filesys_set_modtime_dos(const xchar* path, uint16_t dosdate,
- uint16_t dostime);
+void filesys_set_modtime_dos(filesys_batch* batch, const xchar* path,
+ uint16_t dosdate, uint16_t dostime);
 /* Function: filesys_set_modtime_winft
  * Set the modification timestamp on a file from a WinAPI FILETIME.
  *
  * Parameters:
+ *   batch - The <xarc> object's <filesys_batch>, if any; if the file is
+ *     still queued there, this is applied once it has been written
  *   path - The file to set the modification timestamp on
  *   wintime - The WinAPI FILETIME to use
  */
-void filesys_set_modtime_winft(const xchar* path,
+void filesys_set_modtime_winft(filesys_batch* batch, const xchar* path,
  const win_filetime* wintime);
 /* Function: filesys_set_modtime_unix
  * Set the modification timestamp on a file from a Unix timestamp (the number of
  * seconds since the start of 1970).
  *
  * Parameters:
+ *   batch - The <xarc> object's <filesys_batch>, if any; if the file is
+ *     still queued there, this is applied once it has been written
  *   path - The file to set the modification timestamp on
  *   utime - Unix timestamp (the number of seconds since the start of 1970)
  */
-void filesys_set_modtime_unix(const xchar* path, uintmax_t utime);
+void filesys_set_modtime_unix(filesys_batch* batch, const xchar* path,
+ uintmax_t utime);
 #if XARC_NATIVE_WCHAR
 /* Function: filesys_localize_char
  * Convert a string in the local 8-bit character format (on Windows, whatever
@@ -270,6 +316,267 @@ void filesys_ensure_writable(const xchar* path);
  *   0 if successful; -1 (and sets errno) otherwise.
  */
 int filesys_mkdir(const xchar* path);
+/* Function: filesys_dir_cache_create
+ * Create an empty <filesys_dir_cache>.
+ *
+ * Returns:
+ *   The new cache; free it with <filesys_dir_cache_free>.
+ */
+filesys_dir_cache* filesys_dir_cache_create(void);
+/* Function: filesys_dir_cache_free
+ * Free a <filesys_dir_cache> and anything it holds open.
+ *
+ * Parameters:
+ *   dc - The cache to free
+ */
+void filesys_dir_cache_free(filesys_dir_cache* dc);
+/* Function: filesys_dir_cache_exists
+ * Like <filesys_dir_exists>, but answered from the cache where possible;
+ * directories found to exist are added to it.
+ *
+ * Parameters:
+ *   dc - The cache to consult
+ *   dir_path - Check whether this path exists and is a directory.
+ *
+ * Returns:
+ *   0 if the path does not exist or refers to a file rather than a directory;
+ *   nonzero if the path exists and refers to a directory
+ */
+int8_t filesys_dir_cache_exists(filesys_dir_cache* dc, const xchar* dir_path);
+/* Function: filesys_dir_cache_mkdir
+ * Like <filesys_mkdir>, creating the directory relative to its parent if the
+ * parent is cached, and adding the new directory to the cache.
+ *
+ * Parameters:
+ *   dc - The cache to use
+ *   path - Path of the directory to create
+ *
+ * Returns:
+ *   0 if successful; -1 (and sets errno) otherwise.
+ */
+int filesys_dir_cache_mkdir(filesys_dir_cache* dc, const xchar* path);
+/* Function: filesys_writer_open
+ * Open (creating or truncating) a file for an entry being extracted,
+ * relative to its directory if that is cached. If the file exists and isn't
+ * writable, it is made writable (see <filesys_ensure_writable>).
+ *
+ * Parameters:
+ *   dc - The directory cache to use
+ *   batch - If not NULL, the file is only created once the data is known,
+ *     and handed to this <filesys_batch> to be written in the background
+ *     where possible.
+ *   path - Path of the file to open
+ *   flags - <XARC extraction flags>; XARC_XFLAG_DIRECT_IO is honored where
+ *     the platform and file system support it, and ignored otherwise.
+ *
+ * Returns:
+ *   The new writer, or NULL (and sets errno) on failure.
+ */
+filesys_writer* filesys_writer_open(filesys_dir_cache* dc,
+ filesys_batch* batch, const xchar* path, uint8_t flags);
+/* Function: filesys_writer_reserve
+ * Tell the writer how large the file is going to be, if known, before
+ * writing anything. Lets it size its buffer to the file and preallocate
+ * space for large files. Purely advisory; it's fine to write a different
+ * amount.
+ *
+ * Parameters:
+ *   w - The writer
+ *   size - The expected size of the file in bytes
+ */
+void filesys_writer_reserve(filesys_writer* w, uint64_t size);
+/* Function: filesys_writer_space
+ * Get the free part of the writer's buffer, so that data can be decoded
+ * straight into it instead of being copied in with <filesys_writer_write>.
+ * Once filled, hand it back with <filesys_writer_commit>.
+ *
+ * Parameters:
+ *   w - The writer
+ *   space - Set to the start of the free space
+ *   avail - Set to the number of bytes free (always at least one)
+ *
+ * Returns:
+ *   0 if successful; -1 (and sets errno) if the buffer had to be written out
+ *   to make room, and that failed.
+ */
+int filesys_writer_space(filesys_writer* w, void** space, size_t* avail);
+/* Function: filesys_writer_commit
+ * Add data placed in the space returned by <filesys_writer_space> to the
+ * file.
+ *
+ * Parameters:
+ *   w - The writer
+ *   len - The number of bytes placed in the space; no more than was
+ *     available
+ */
+void filesys_writer_commit(filesys_writer* w, size_t len);
+/* Function: filesys_writer_write
+ * Write data to the file.
+ *
+ * Parameters:
+ *   w - The writer
+ *   buf - The data to write
+ *   len - The number of bytes to write
+ *
+ * Returns:
+ *   0 if successful; -1 (and sets errno) otherwise.
+ */
+int filesys_writer_write(filesys_writer* w, const void* buf, size_t len);
+/* Function: filesys_writer_copy
+ * Write data from an input file to the file, taking it from the reader's
+ * current position. Where the platform can (Linux copy_file_range, or
+ * sendfile), the data goes from file to file inside the kernel without
+ * being read into memory; otherwise it passes through the writer's buffer.
+ *
+ * Parameters:
+ *   w - The writer
+ *   r - The reader to take the data from
+ *   len - The number of bytes to copy
+ *   copied - Set to the number of bytes copied, which is less than len only
+ *     if the input ended first or something failed
+ *
+ * Returns:
+ *   0 if successful (including when the input ended first); -1 (and sets
+ *   errno) otherwise.
+ */
+int filesys_writer_copy(filesys_writer* w, filesys_reader* r, uint64_t len,
+ uint64_t* copied);
+/* Function: filesys_writer_close
+ * Write out anything still buffered, close the file and free the writer.
+ *
+ * Parameters:
+ *   w - The writer
+ *
+ * Returns:
+ *   0 if successful; -1 (and sets errno) if anything couldn't be written.
+ */
+int filesys_writer_close(filesys_writer* w);
+/* Function: filesys_reader_open
+ * Open a file for reading with a <filesys_reader>.
+ *
+ * Parameters:
+ *   path - Path of the file to open
+ *
+ * Returns:
+ *   The new reader, or NULL (and sets errno) on failure.
+ */
+filesys_reader* filesys_reader_open(const xchar* path);
+/* Function: filesys_reader_read
+ * Read from the current position, stopping short only at the end of the
+ * file.
+ *
+ * Parameters:
+ *   r - The reader
+ *   buf - Buffer for the data
+ *   len - The number of bytes to read
+ *   got - Set to the number of bytes read
+ *
+ * Returns:
+ *   0 if successful (including at the end of the file); -1 (and sets errno)
+ *   otherwise.
+ */
+int filesys_reader_read(filesys_reader* r, void* buf, size_t len,
+ size_t* got);
+/* Function: filesys_reader_skip
+ * Move the current position forward without reading anything.
+ *
+ * Parameters:
+ *   r - The reader
+ *   len - The number of bytes to skip
+ *   skipped - Set to the number of bytes skipped, which is less than len only
+ *     if the end of the file came first
+ *
+ * Returns:
+ *   0 if successful; -1 (and sets errno) otherwise.
+ */
+int filesys_reader_skip(filesys_reader* r, uint64_t len, uint64_t* skipped);
+/* Function: filesys_reader_seek
+ * Move the current position to an absolute offset.
+ *
+ * Parameters:
+ *   r - The reader
+ *   offset - The new position, from the start of the file
+ *
+ * Returns:
+ *   0 if successful; -1 (and sets errno) otherwise, including when the file
+ *   isn't a regular file.
+ */
+int filesys_reader_seek(filesys_reader* r, uint64_t offset);
+/* Function: filesys_reader_stamp
+ * Get the size and modification time of the file, so that data derived from
+ * it can be checked for staleness later.
+ *
+ * Parameters:
+ *   r - The reader
+ *   size - Set to the size of the file in bytes
+ *   mod_time - Set to the file's modification time, in seconds since the Unix
+ *     epoch
+ *
+ * Returns:
+ *   0 if successful; -1 otherwise, including when the file isn't a regular
+ *   file.
+ */
+int filesys_reader_stamp(filesys_reader* r, uint64_t* size, int64_t* mod_time);
+/* Function: filesys_reader_map
+ * Map the whole file into memory for reading. The mapping stays valid until
+ * the reader is closed; the reader's own position is unaffected. The file
+ * mustn't be truncated while it's mapped.
+ *
+ * Parameters:
+ *   r - The reader
+ *   size - Set to the number of bytes mapped
+ *
+ * Returns:
+ *   The file's contents, or NULL if the file can't be mapped (it's empty,
+ *   isn't a regular file, or doesn't fit in the address space).
+ */
+const void* filesys_reader_map(filesys_reader* r, size_t* size);
+/* Function: filesys_reader_close
+ * Close the file and free the reader.
+ *
+ * Parameters:
+ *   r - The reader
+ */
+void filesys_reader_close(filesys_reader* r);
+/* Function: filesys_batch_create
+ * Set up a <filesys_batch>.
+ *
+ * Returns:
+ *   The new batch, or NULL if the platform can't do batched output (no
+ *   io_uring, or a kernel older than 5.17); extraction then just goes ahead
+ *   with regular system calls.
+ */
+filesys_batch* filesys_batch_create(void);
+/* Function: filesys_batch_finish
+ * Wait until every queued file has been written, closed and had its
+ * properties set. Files that fail in the background are retried with
+ * regular system calls before giving up.
+ *
+ * Parameters:
+ *   b - The batch
+ *
+ * Returns:
+ *   0 if successful; -1 (and sets errno) if any file couldn't be written.
+ *   The first such file is named by <filesys_batch_error_path>.
+ */
+int filesys_batch_finish(filesys_batch* b);
+/* Function: filesys_batch_error_path
+ * Get the path of the first file the batch failed to write.
+ *
+ * Parameters:
+ *   b - The batch
+ *
+ * Returns:
+ *   The path, or NULL if nothing has failed. Valid until the batch is freed.
+ */
+const xchar* filesys_batch_error_path(filesys_batch* b);
+/* Function: filesys_batch_free
+ * Finish (see <filesys_batch_finish>) and free a batch.
+ *
+ * Parameters:
+ *   b - The batch
+ */
+void filesys_batch_free(filesys_batch* b);
 
 
 #ifdef __cplusplus
@@ -4,15 +4,52 @@
  */
 
 
+/* For O_DIRECT, fallocate and copy_file_range */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+/* Archives can be bigger than 2 GiB on 32-bit systems too */
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #include "filesys.h"
 
+/* Batched output goes through io_uring where the headers for it exist */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define FILESYS_IO_URING 1
+#endif
+#endif
+
 #include <wchar.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <utime.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include "xchar.h"
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#if FILESYS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+/* Headers older than Linux 5.17 lack what the batch relies on */
+#ifndef IORING_FEAT_CQE_SKIP
+#undef FILESYS_IO_URING
+#endif
+#endif
+
+
+static int8_t batch_defer_mode(filesys_batch* b, const xchar* path,
+ int32_t mode);
+static int8_t batch_defer_time(filesys_batch* b, const xchar* path, time_t t);
 
 
 static const uintmax_t SECONDS_1601_1970 = (((uintmax_t)369U * 365U) + 89U)
@@ -46,14 +83,27 @@ int8_t filesys_is_dir_sep(xchar ch)
 	return (ch == XC('/'));
 }
 
-void filesys_set_attributes_win(const xchar* path __attribute__((unused)), uint32_t attr __attribute__((unused)))
+void filesys_set_attributes_win(filesys_batch* batch, const xchar* path, uint32_t attr __attribute__((unused)))
 {
-	chmod(path, 0774);
+	if (!batch_defer_mode(batch, path, 0774))
+		chmod(path, 0774);
 }
 
-void filesys_set_attributes_unix(const xchar* path, int32_t mode)
+void filesys_set_attributes_unix(filesys_batch* batch, const xchar* path,
+ int32_t mode)
 {
-	chmod(path, mode);
+	if (!batch_defer_mode(batch, path, mode))
+		chmod(path, mode);
+}
+
+static void set_modtime(filesys_batch* batch, const xchar* path, time_t t)
+{
+	if (batch_defer_time(batch, path, t))
+		return;
+	struct utimbuf utb;
+	utb.actime = t;
+	utb.modtime = t;
+	utime(path, &utb);
 }
 
 void filesys_time_dos(uint16_t dosdate, uint16_t dostime, xarc_time_t* xtime)
@@ -89,8 +139,8 @@ void filesys_time_unix(uintmax_t utime, xarc_time_t* xtime)
 	xtime->nano = 0;
 }
 
-void filesys_set_modtime_dos(const xchar* path, uint16_t dosdate,
- uint16_t dostime)
+void filesys_set_modtime_dos(filesys_batch* batch, const xchar* path,
+ uint16_t dosdate, uint16_t dostime)
 {
 	struct tm local;
 	local.tm_year = (uintmax_t)(dosdate >> 9) + 80;
@@ -100,34 +150,27 @@ void filesys_set_modtime_dos(const xchar* path, uint16_t dosdate,
 	local.tm_min = (uintmax_t)(dostime >> 5) & 0x3fU;
 	local.tm_sec = (uintmax_t)(dostime & 0x1fU) * 2;
 	local.tm_isdst = -1;
-	time_t t = mktime(&local);
-	struct utimbuf utb;
-	utb.actime = t;
-	utb.modtime = t;
-	utime(path, &utb);
+	set_modtime(batch, path, mktime(&local));
 }
 
-void filesys_set_modtime_winft(const xchar* path, const win_filetime* wintime)
+void filesys_set_modtime_winft(filesys_batch* batch, const xchar* path,
+ const win_filetime* wintime)
 {
 #ifdef UINT64_MAX
 	time_t sec = (((uint64_t)wintime->hi << 32) + (uint64_t)wintime->lo)
 	 / __UINT64_C(10000000) - SECONDS_1601_1970;
-	struct utimbuf utb;
-	utb.actime = sec;
-	utb.modtime = sec;
-	utime(path, &utb);
+	set_modtime(batch, path, sec);
 #else
+	batch = batch;
 	path = path;
 	wintime = wintime;
 #endif
 }
 
-void filesys_set_modtime_unix(const xchar* path, uintmax_t unix_time)
+void filesys_set_modtime_unix(filesys_batch* batch, const xchar* path,
+ uintmax_t unix_time)
 {
-	struct utimbuf utb;
-	utb.actime = unix_time;
-	utb.modtime = unix_time;
-	utime(path, &utb);
+	set_modtime(batch, path, unix_time);
 }
 
 intmax_t filesys_localize_cp437(const char* char_str, intmax_t char_len,
@@ -170,6 +213,1154 @@ void filesys_ensure_writable(const xchar* path)
 
 int filesys_mkdir(const xchar* path)
 {
-	return mkdir(path, 0664);
+	return mkdir(path, 0777);
+}
+
+
+/* Directories stay open so that entries can be created relative to them;
+ * past this many, the least recently opened one is closed again.
+ */
+#define DIR_CACHE_MAX_FDS 64
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+typedef struct
+{
+	/* NUL-terminated, without trailing separators */
+	xchar* path;
+	size_t len;
+	uint32_t hash;
+	/* Open directory descriptor, or -1 */
+	int fd;
+} dir_entry;
+
+struct _filesys_dir_cache
+{
+	dir_entry* entries;
+	size_t num_entries;
+	size_t max_entries;
+	/* Open-addressed hash table of (index in entries + 1); 0 is empty */
+	size_t* table;
+	size_t table_size;
+	/* Entries currently holding a descriptor, oldest first from fd_next */
+	size_t fd_ring[DIR_CACHE_MAX_FDS];
+	size_t num_fds;
+	size_t fd_next;
+};
+
+/* Length of a directory path not counting trailing separators */
+static size_t dir_key_len(const xchar* path, size_t len)
+{
+	while (len > 1 && filesys_is_dir_sep(path[len - 1]))
+		--len;
+	return len;
+}
+
+static uint32_t dir_key_hash(const xchar* path, size_t len)
+{
+	/* FNV-1a */
+	uint32_t h = 2166136261U;
+	size_t i;
+	for (i = 0; i < len; ++i)
+	{
+		h ^= (uint32_t)path[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static dir_entry* dir_find(filesys_dir_cache* dc, const xchar* path,
+ size_t len, uint32_t hash)
+{
+	if (dc->table_size == 0)
+		return 0;
+	size_t slot = hash & (dc->table_size - 1);
+	while (dc->table[slot])
+	{
+		dir_entry* e = &dc->entries[dc->table[slot] - 1];
+		if (e->hash == hash && e->len == len
+		 && memcmp(e->path, path, sizeof(xchar) * len) == 0)
+			return e;
+		slot = (slot + 1) & (dc->table_size - 1);
+	}
+	return 0;
+}
+
+static void dir_table_insert(filesys_dir_cache* dc, size_t index)
+{
+	size_t slot = dc->entries[index].hash & (dc->table_size - 1);
+	while (dc->table[slot])
+		slot = (slot + 1) & (dc->table_size - 1);
+	dc->table[slot] = index + 1;
+}
+
+static dir_entry* dir_add(filesys_dir_cache* dc, const xchar* path,
+ size_t len, uint32_t hash)
+{
+	/* Keep the table at most half full */
+	if ((dc->num_entries + 1) * 2 > dc->table_size)
+	{
+		free(dc->table);
+		dc->table_size = dc->table_size ? dc->table_size * 2 : 256;
+		dc->table = calloc(dc->table_size, sizeof(size_t));
+		size_t i;
+		for (i = 0; i < dc->num_entries; ++i)
+			dir_table_insert(dc, i);
+	}
+	if (dc->num_entries == dc->max_entries)
+	{
+		dc->max_entries = dc->max_entries ? dc->max_entries * 2 : 128;
+		dc->entries = realloc(dc->entries,
+		 sizeof(dir_entry) * dc->max_entries);
+	}
+
+	dir_entry* e = &dc->entries[dc->num_entries];
+	e->path = malloc(sizeof(xchar) * (len + 1));
+	memcpy(e->path, path, sizeof(xchar) * len);
+	e->path[len] = XC('\0');
+	e->len = len;
+	e->hash = hash;
+	e->fd = -1;
+	dir_table_insert(dc, dc->num_entries++);
+	return e;
+}
+
+/* Hand a descriptor to an entry, closing the oldest one if too many are
+ * open
+ */
+static void dir_keep_fd(filesys_dir_cache* dc, dir_entry* e, int fd)
+{
+	if (dc->num_fds == DIR_CACHE_MAX_FDS)
+	{
+		dir_entry* old = &dc->entries[dc->fd_ring[dc->fd_next]];
+		close(old->fd);
+		old->fd = -1;
+	}
+	else
+		++dc->num_fds;
+	dc->fd_ring[dc->fd_next] = e - dc->entries;
+	dc->fd_next = (dc->fd_next + 1) % DIR_CACHE_MAX_FDS;
+	e->fd = fd;
+}
+
+static int dir_open(const xchar* path)
+{
+	return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* Find the directory holding path[0..len) and return a descriptor for it,
+ * pointing *leaf at the last component. If the directory can't be opened,
+ * returns AT_FDCWD with *leaf pointing at the whole path.
+ */
+static int dir_parent_fd(filesys_dir_cache* dc, const xchar* path,
+ size_t len, const xchar** leaf)
+{
+	*leaf = path;
+	size_t sep = len;
+	while (sep > 0 && !filesys_is_dir_sep(path[sep - 1]))
+		--sep;
+	/* No directory part, or the last component isn't NUL-terminated */
+	if (sep == 0 || sep == len || path[len] != XC('\0'))
+		return AT_FDCWD;
+
+	size_t plen = dir_key_len(path, sep);
+	uint32_t hash = dir_key_hash(path, plen);
+	dir_entry* e = dir_find(dc, path, plen, hash);
+	if (!e || e->fd < 0)
+	{
+		/* Opening it also proves it exists, so it can be cached */
+		xchar* ppath = malloc(sizeof(xchar) * (plen + 1));
+		memcpy(ppath, path, sizeof(xchar) * plen);
+		ppath[plen] = XC('\0');
+		int fd = dir_open(ppath);
+		free(ppath);
+		if (fd < 0)
+			return AT_FDCWD;
+		if (!e)
+			e = dir_add(dc, path, plen, hash);
+		dir_keep_fd(dc, e, fd);
+	}
+	*leaf = path + sep;
+	return e->fd;
+}
+
+filesys_dir_cache* filesys_dir_cache_create(void)
+{
+	filesys_dir_cache* dc = malloc(sizeof(filesys_dir_cache));
+	memset(dc, 0, sizeof(filesys_dir_cache));
+	return dc;
+}
+
+void filesys_dir_cache_free(filesys_dir_cache* dc)
+{
+	size_t i;
+	for (i = 0; i < dc->num_entries; ++i)
+	{
+		if (dc->entries[i].fd >= 0)
+			close(dc->entries[i].fd);
+		free(dc->entries[i].path);
+	}
+	free(dc->entries);
+	free(dc->table);
+	free(dc);
+}
+
+int8_t filesys_dir_cache_exists(filesys_dir_cache* dc, const xchar* dir_path)
+{
+	size_t len = dir_key_len(dir_path, xstrlen(dir_path));
+	uint32_t hash = dir_key_hash(dir_path, len);
+	if (dir_find(dc, dir_path, len, hash))
+		return 1;
+
+	const xchar* leaf;
+	int pfd = dir_parent_fd(dc, dir_path, len, &leaf);
+	struct stat st;
+	if (fstatat(pfd, leaf, &st, 0) != 0 || !S_ISDIR(st.st_mode))
+		return 0;
+	dir_add(dc, dir_path, len, hash);
+	return 1;
+}
+
+int filesys_dir_cache_mkdir(filesys_dir_cache* dc, const xchar* path)
+{
+	size_t len = dir_key_len(path, xstrlen(path));
+	const xchar* leaf;
+	int pfd = dir_parent_fd(dc, path, len, &leaf);
+	if (mkdirat(pfd, leaf, 0777) != 0)
+		return -1;
+	dir_add(dc, path, len, dir_key_hash(path, len));
+	return 0;
+}
+
+/* Writers buffer up to this much before writing it out */
+#define WRITER_BUFSIZE (1024 * 1024)
+/* Buffer alignment and size granularity; enough for O_DIRECT on any common
+ * file system
+ */
+#define WRITER_ALIGN 4096
+/* The most handed to copy_file_range/sendfile at once */
+#define COPY_CHUNK (1024 * 1024 * 1024)
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+struct _filesys_writer
+{
+	/* -1 until the file is actually opened; see <path> */
+	int fd;
+	/* With a batch, the file isn't created until the data has either
+	 * outgrown the buffer (then it's opened here after all) or been handed
+	 * to the batch on close. Until then, path holds its name.
+	 */
+	filesys_batch* batch;
+	xchar* path;
+	/* Set while the file is open with O_DIRECT; every write must then be a
+	 * multiple of WRITER_ALIGN from an aligned buffer
+	 */
+	uint8_t direct;
+	/* Allocated on first use, once <filesys_writer_reserve> had its chance
+	 * to say how much is needed
+	 */
+	uint8_t* buf;
+	size_t buf_size;
+	size_t buf_used;
+};
+
+struct _filesys_reader
+{
+	int fd;
+	/* Set for regular files, which can be skipped through with lseek */
+	uint8_t seekable;
+	/* The size of a regular file, so that skipping past the end is noticed */
+	uint64_t size;
+	/* The modification time when the file was opened */
+	int64_t mod_time;
+	/* The file's contents, once <filesys_reader_map> has been called */
+	void* map;
+};
+
+/* Write all of buf to the file, retrying short writes */
+static int writer_write_out(filesys_writer* w, const uint8_t* buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t wr = write(w->fd, buf, len);
+		if (wr < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += wr;
+		len -= wr;
+	}
+	return 0;
+}
+
+/* Open an output file relative to pfd. *direct says whether to try O_DIRECT,
+ * and is cleared if the file system won't have it.
+ */
+static int open_output(int pfd, const xchar* leaf, uint8_t* direct)
+{
+	int oflags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	int fd = openat(pfd, leaf, oflags | (*direct ? O_DIRECT : 0), 0666);
+	if (fd < 0 && errno == EACCES)
+	{
+		/* An existing read-only file; see filesys_ensure_writable */
+		fchmodat(pfd, leaf, S_IWUSR, 0);
+		fd = openat(pfd, leaf, oflags | (*direct ? O_DIRECT : 0), 0666);
+	}
+	if (fd < 0 && *direct && errno == EINVAL)
+	{
+		/* The file system doesn't do O_DIRECT */
+		*direct = 0;
+		fd = openat(pfd, leaf, oflags, 0666);
+	}
+	return fd;
+}
+
+static int batch_queue(filesys_batch* b, xchar* path, uint8_t* buf,
+ size_t len);
+static void batch_wait_path(filesys_batch* b, const xchar* path);
+
+/* Open a file whose creation was put off for the batch, after all: it's
+ * too big to hand over in one piece. Waits until nothing queued is still
+ * writing to the same path.
+ */
+static int writer_open_deferred(filesys_writer* w)
+{
+	if (w->fd >= 0)
+		return 0;
+	if (!w->path)
+	{
+		/* An earlier attempt already failed */
+		errno = EBADF;
+		return -1;
+	}
+	uint8_t direct = 0;
+	batch_wait_path(w->batch, w->path);
+	w->fd = open_output(AT_FDCWD, w->path, &direct);
+	free(w->path);
+	w->path = 0;
+	return (w->fd < 0) ? -1 : 0;
+}
+
+static int writer_flush(filesys_writer* w)
+{
+	if (w->buf_used == 0)
+		return 0;
+	if (writer_open_deferred(w) != 0)
+		return -1;
+	/* O_DIRECT can only write whole blocks; the tail of the file goes
+	 * through the page cache as usual
+	 */
+	if (w->direct && w->buf_used % WRITER_ALIGN != 0)
+	{
+		int fl = fcntl(w->fd, F_GETFL);
+		if (fl == -1 || fcntl(w->fd, F_SETFL, fl & ~O_DIRECT) == -1)
+			return -1;
+		w->direct = 0;
+	}
+	int ret = writer_write_out(w, w->buf, w->buf_used);
+	w->buf_used = 0;
+	return ret;
+}
+
+static int writer_alloc(filesys_writer* w)
+{
+	if (w->buf)
+		return 0;
+	void* p;
+	if (posix_memalign(&p, WRITER_ALIGN, w->buf_size) != 0)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	w->buf = p;
+	return 0;
+}
+
+filesys_writer* filesys_writer_open(filesys_dir_cache* dc,
+ filesys_batch* batch, const xchar* path, uint8_t flags)
+{
+	uint8_t direct = (flags & XARC_XFLAG_DIRECT_IO) && O_DIRECT;
+	int fd = -1;
+	xchar* deferred = 0;
+	if (batch && !direct)
+	{
+		deferred = malloc(sizeof(xchar) * (xstrlen(path) + 1));
+		xstrcpy(deferred, path);
+	}
+	else
+	{
+		const xchar* leaf;
+		int pfd = dir_parent_fd(dc, path, xstrlen(path), &leaf);
+		fd = open_output(pfd, leaf, &direct);
+		if (fd < 0)
+			return 0;
+	}
+
+	filesys_writer* w = malloc(sizeof(filesys_writer));
+	w->fd = fd;
+	w->batch = batch;
+	w->path = deferred;
+	w->direct = direct;
+	w->buf = 0;
+	w->buf_size = WRITER_BUFSIZE;
+	w->buf_used = 0;
+	return w;
+}
+
+void filesys_writer_reserve(filesys_writer* w, uint64_t size)
+{
+	/* Small files get a buffer just big enough to write them in one go */
+	if (!w->buf && size < WRITER_BUFSIZE)
+	{
+		w->buf_size = (size + WRITER_ALIGN - 1) / WRITER_ALIGN * WRITER_ALIGN;
+		if (w->buf_size == 0)
+			w->buf_size = WRITER_ALIGN;
+	}
+#ifdef __linux__
+	/* Preallocate anything that takes more than one write, so the file
+	 * system can lay it out in one piece. KEEP_SIZE leaves the file's size
+	 * alone, so a failed extraction doesn't leave a file padded with zeros.
+	 * Failure (e.g. no support in this file system) is harmless.
+	 */
+	if (size > WRITER_BUFSIZE && w->fd >= 0)
+		fallocate(w->fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+#endif
+}
+
+int filesys_writer_space(filesys_writer* w, void** space, size_t* avail)
+{
+	if (writer_alloc(w) != 0)
+		return -1;
+	if (w->buf_used == w->buf_size && writer_flush(w) != 0)
+		return -1;
+	*space = w->buf + w->buf_used;
+	*avail = w->buf_size - w->buf_used;
+	return 0;
+}
+
+void filesys_writer_commit(filesys_writer* w, size_t len)
+{
+	w->buf_used += len;
+}
+
+int filesys_writer_write(filesys_writer* w, const void* buf, size_t len)
+{
+	const uint8_t* src = (const uint8_t*)buf;
+	/* Big writes go straight to the file when there's nothing buffered,
+	 * unless O_DIRECT needs them to come from the aligned buffer
+	 */
+	if (!w->direct && w->fd >= 0 && w->buf_used == 0 && len >= w->buf_size)
+		return writer_write_out(w, src, len);
+
+	while (len > 0)
+	{
+		void* space;
+		size_t avail;
+		if (filesys_writer_space(w, &space, &avail) != 0)
+			return -1;
+		if (avail > len)
+			avail = len;
+		memcpy(space, src, avail);
+		filesys_writer_commit(w, avail);
+		src += avail;
+		len -= avail;
+	}
+	return 0;
+}
+
+int filesys_writer_copy(filesys_writer* w, filesys_reader* r, uint64_t len,
+ uint64_t* copied)
+{
+	*copied = 0;
+#ifdef __linux__
+	/* O_DIRECT output has to come from the aligned buffer, and a file small
+	 * enough to go to the batch in one piece is better off staying there
+	 */
+	uint8_t in_kernel = !w->direct;
+	if (w->fd < 0 && len <= w->buf_size - w->buf_used)
+		in_kernel = 0;
+	if (in_kernel)
+	{
+		if (writer_open_deferred(w) != 0 || writer_flush(w) != 0)
+			return -1;
+		/* copy_file_range where the file systems allow it (it may even share
+		 * the blocks), sendfile where they don't
+		 */
+		uint8_t use_sendfile = 0;
+		while (len > 0)
+		{
+			size_t chunk = (len > COPY_CHUNK) ? COPY_CHUNK : (size_t)len;
+			ssize_t n;
+			if (!use_sendfile)
+				n = copy_file_range(r->fd, 0, w->fd, 0, chunk, 0);
+			else
+				n = sendfile(w->fd, r->fd, 0, chunk);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if (!use_sendfile && (errno == EXDEV || errno == EINVAL
+				 || errno == ENOSYS || errno == EOPNOTSUPP))
+				{
+					use_sendfile = 1;
+					continue;
+				}
+				if (use_sendfile && (errno == EINVAL || errno == ENOSYS))
+					break;
+				return -1;
+			}
+			/* The input ended early */
+			if (n == 0)
+				return 0;
+			*copied += n;
+			len -= n;
+		}
+	}
+#endif
+
+	/* Otherwise, through the buffer */
+	while (len > 0)
+	{
+		void* space;
+		size_t avail;
+		if (filesys_writer_space(w, &space, &avail) != 0)
+			return -1;
+		if (avail > len)
+			avail = (size_t)len;
+		size_t got;
+		if (filesys_reader_read(r, space, avail, &got) != 0)
+			return -1;
+		filesys_writer_commit(w, got);
+		*copied += got;
+		len -= got;
+		if (got < avail)
+			break;
+	}
+	return 0;
+}
+
+int filesys_writer_close(filesys_writer* w)
+{
+	if (w->fd < 0)
+	{
+		/* Never opened: the batch takes it from here, buffer and all */
+		int ret = -1;
+		if (w->path)
+			ret = batch_queue(w->batch, w->path, w->buf, w->buf_used);
+		else
+			free(w->buf);
+		free(w);
+		return ret;
+	}
+
+	int ret = writer_flush(w);
+	int err = errno;
+	if (close(w->fd) != 0 && ret == 0)
+	{
+		ret = -1;
+		err = errno;
+	}
+	free(w->buf);
+	free(w);
+	errno = err;
+	return ret;
+}
+
+
+filesys_reader* filesys_reader_open(const xchar* path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		int err = errno;
+		close(fd);
+		errno = err;
+		return 0;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	filesys_reader* r = malloc(sizeof(filesys_reader));
+	r->fd = fd;
+	r->seekable = S_ISREG(st.st_mode);
+	r->size = (uint64_t)st.st_size;
+	r->mod_time = (int64_t)st.st_mtime;
+	r->map = 0;
+	return r;
+}
+
+int filesys_reader_read(filesys_reader* r, void* buf, size_t len,
+ size_t* got)
+{
+	uint8_t* dst = (uint8_t*)buf;
+	*got = 0;
+	while (len > 0)
+	{
+		ssize_t n = read(r->fd, dst, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (n == 0)
+			break;
+		dst += n;
+		len -= n;
+		*got += n;
+	}
+	return 0;
+}
+
+int filesys_reader_skip(filesys_reader* r, uint64_t len, uint64_t* skipped)
+{
+	*skipped = 0;
+	if (r->seekable)
+	{
+		/* lseek would happily go past the end, so stop there ourselves */
+		off_t pos = lseek(r->fd, 0, SEEK_CUR);
+		if (pos < 0)
+			return -1;
+		uint64_t left = (r->size > (uint64_t)pos) ? r->size - pos : 0;
+		if (len > left)
+			len = left;
+		if (lseek(r->fd, (off_t)len, SEEK_CUR) < 0)
+			return -1;
+		*skipped = len;
+		return 0;
+	}
+
+	/* Not a regular file (a pipe, say): read and throw away */
+	uint8_t scratch[65536];
+	while (len > 0)
+	{
+		size_t got;
+		size_t want = (len > sizeof(scratch)) ? sizeof(scratch) : (size_t)len;
+		if (filesys_reader_read(r, scratch, want, &got) != 0)
+			return -1;
+		*skipped += got;
+		len -= got;
+		if (got < want)
+			break;
+	}
+	return 0;
+}
+
+int filesys_reader_seek(filesys_reader* r, uint64_t offset)
+{
+	if (!r->seekable)
+	{
+		errno = ESPIPE;
+		return -1;
+	}
+	return (lseek(r->fd, (off_t)offset, SEEK_SET) < 0) ? -1 : 0;
+}
+
+int filesys_reader_stamp(filesys_reader* r, uint64_t* size, int64_t* mod_time)
+{
+	if (!r->seekable)
+		return -1;
+	*size = r->size;
+	*mod_time = r->mod_time;
+	return 0;
+}
+
+const void* filesys_reader_map(filesys_reader* r, size_t* size)
+{
+	if (!r->map)
+	{
+		if (!r->seekable || r->size == 0 || r->size > SIZE_MAX)
+			return 0;
+		void* map = mmap(0, (size_t)r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+		if (map == MAP_FAILED)
+			return 0;
+#ifdef MADV_SEQUENTIAL
+		madvise(map, (size_t)r->size, MADV_SEQUENTIAL);
+#endif
+		r->map = map;
+	}
+	*size = (size_t)r->size;
+	return r->map;
+}
+
+void filesys_reader_close(filesys_reader* r)
+{
+	if (r->map)
+		munmap(r->map, (size_t)r->size);
+	close(r->fd);
+	free(r);
+}
+
+
+#if FILESYS_IO_URING
+
+/* Files in flight at once. Each holds a slot in the ring's registered file
+ * table from its open to its close.
+ */
+#define BATCH_SLOTS 64
+/* Each file takes up to three submission entries (open, write, close) */
+#define BATCH_SQ_ENTRIES 256
+/* Submit to the kernel after this many files have been queued */
+#define BATCH_SUBMIT_EVERY 16
+/* Don't keep more than this much data waiting to be written */
+#define BATCH_MAX_BYTES (16 * 1024 * 1024)
+
+typedef struct
+{
+	uint8_t busy;
+	/* Completions still to come for this file's chain */
+	uint8_t waiting;
+	/* Set if any step of the chain failed */
+	uint8_t failed;
+	/* Properties to apply once the file is closed */
+	uint8_t set_mode;
+	uint8_t set_time;
+	int32_t mode;
+	time_t mtime;
+	xchar* path;
+	uint32_t hash;
+	uint8_t* buf;
+	size_t len;
+} batch_file;
+
+struct _filesys_batch
+{
+	int ring_fd;
+	void* sq_ring;
+	size_t sq_ring_size;
+	void* cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe* cqes;
+	/* Entries placed in the ring but not yet submitted */
+	unsigned to_submit;
+	unsigned files_since_submit;
+	batch_file files[BATCH_SLOTS];
+	size_t in_flight;
+	size_t in_flight_bytes;
+	/* Slot of the file queued most recently, whose properties may still be
+	 * coming, or -1
+	 */
+	int last;
+	/* The first failure that couldn't be recovered from */
+	int err;
+	xchar* err_path;
+};
+
+static int batch_enter(filesys_batch* b, unsigned min_complete)
+{
+	while (1)
+	{
+		int ret = (int)syscall(__NR_io_uring_enter, b->ring_fd, b->to_submit,
+		 min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+		if (ret >= 0)
+		{
+			b->to_submit -= ((unsigned)ret < b->to_submit) ? (unsigned)ret
+			 : b->to_submit;
+			b->files_since_submit = 0;
+			return 0;
+		}
+		if (errno != EINTR)
+			return -1;
+	}
+}
+
+static struct io_uring_sqe* batch_get_sqe(filesys_batch* b)
+{
+	unsigned tail = *b->sq_tail;
+	struct io_uring_sqe* sqe = &b->sqes[tail & b->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	b->sq_array[tail & b->sq_mask] = tail & b->sq_mask;
+	/* The kernel only looks at the entry once the tail moves past it */
+	__atomic_store_n(b->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++b->to_submit;
+	return sqe;
+}
+
+/* Write a file with regular system calls, after the ring couldn't */
+static int batch_write_sync(batch_file* f)
+{
+	uint8_t direct = 0;
+	int fd = open_output(AT_FDCWD, f->path, &direct);
+	if (fd < 0)
+		return -1;
+	filesys_writer w;
+	memset(&w, 0, sizeof(filesys_writer));
+	w.fd = fd;
+	int ret = writer_write_out(&w, f->buf, f->len);
+	int err = errno;
+	if (close(fd) != 0 && ret == 0)
+	{
+		ret = -1;
+		err = errno;
+	}
+	errno = err;
+	return ret;
+}
+
+/* A file's chain has completed; deal with failure, then apply whatever
+ * properties were put off until now
+ */
+static void batch_file_done(filesys_batch* b, int slot)
+{
+	batch_file* f = &b->files[slot];
+	if (f->failed && batch_write_sync(f) != 0 && !b->err)
+	{
+		b->err = errno;
+		b->err_path = f->path;
+		f->path = 0;
+	}
+	if (f->path)
+	{
+		if (f->set_mode)
+			chmod(f->path, f->mode);
+		if (f->set_time)
+		{
+			struct utimbuf utb;
+			utb.actime = f->mtime;
+			utb.modtime = f->mtime;
+			utime(f->path, &utb);
+		}
+	}
+	free(f->path);
+	free(f->buf);
+	f->busy = 0;
+	--b->in_flight;
+	b->in_flight_bytes -= f->len;
+	if (b->last == slot)
+		b->last = -1;
+}
+
+/* Handle whatever completions are ready, first waiting for at least one if
+ * asked to
+ */
+static void batch_reap(filesys_batch* b, uint8_t wait)
+{
+	if ((wait || b->to_submit > 0) && batch_enter(b, wait ? 1 : 0) != 0)
+	{
+		/* Nothing can be submitted or waited for; stop everything waiting
+		 * on the ring and write it all the slow way
+		 */
+		int slot;
+		for (slot = 0; slot < BATCH_SLOTS; ++slot)
+		{
+			if (b->files[slot].busy)
+			{
+				b->files[slot].failed = 1;
+				batch_file_done(b, slot);
+			}
+		}
+		return;
+	}
+
+	unsigned head = *b->cq_head;
+	unsigned tail = __atomic_load_n(b->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head)
+	{
+		struct io_uring_cqe* cqe = &b->cqes[head & b->cq_mask];
+		int slot = (int)(cqe->user_data >> 2);
+		batch_file* f = &b->files[slot];
+		/* A short write counts as failure too */
+		if (cqe->res < 0 || ((cqe->user_data & 3) == 1
+		 && (size_t)cqe->res != f->len))
+			f->failed = 1;
+		if (--f->waiting == 0)
+			batch_file_done(b, slot);
+	}
+	__atomic_store_n(b->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void batch_wait_path(filesys_batch* b, const xchar* path)
+{
+	uint32_t hash = dir_key_hash(path, xstrlen(path));
+	int slot;
+	for (slot = 0; slot < BATCH_SLOTS; ++slot)
+	{
+		batch_file* f = &b->files[slot];
+		while (f->busy && f->hash == hash && strcmp(f->path, path) == 0)
+			batch_reap(b, 1);
+	}
+}
+
+/* Queue open -> write -> close for a file whose data is all in buf. The
+ * batch takes over path and buf.
+ */
+static int batch_queue(filesys_batch* b, xchar* path, uint8_t* buf,
+ size_t len)
+{
+	if (b->err)
+	{
+		free(path);
+		free(buf);
+		errno = b->err;
+		return -1;
+	}
+
+	/* An archive can hold the same file twice; the later one has to win */
+	batch_wait_path(b, path);
+	while (b->in_flight == BATCH_SLOTS || (b->in_flight > 0
+	 && b->in_flight_bytes + len > BATCH_MAX_BYTES))
+		batch_reap(b, 1);
+
+	int slot = 0;
+	while (b->files[slot].busy)
+		++slot;
+	batch_file* f = &b->files[slot];
+	memset(f, 0, sizeof(batch_file));
+	f->busy = 1;
+	f->path = path;
+	f->hash = dir_key_hash(path, xstrlen(path));
+	f->buf = buf;
+	f->len = len;
+	++b->in_flight;
+	b->in_flight_bytes += len;
+	b->last = slot;
+
+	/* The open puts the file straight into the registered file table, so
+	 * the write and close can refer to it without waiting for its fd
+	 */
+	struct io_uring_sqe* sqe = batch_get_sqe(b);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)path;
+	sqe->len = 0666;
+	sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	sqe->file_index = slot + 1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = ((uint64_t)slot << 2) | 0;
+	++f->waiting;
+	if (len > 0)
+	{
+		sqe = batch_get_sqe(b);
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = slot;
+		sqe->addr = (uintptr_t)buf;
+		sqe->len = (uint32_t)len;
+		sqe->off = 0;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+		sqe->user_data = ((uint64_t)slot << 2) | 1;
+		++f->waiting;
+	}
+	sqe = batch_get_sqe(b);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = slot + 1;
+	sqe->user_data = ((uint64_t)slot << 2) | 2;
+	++f->waiting;
+
+	/* Submit every so often, and pick up whatever has finished meanwhile */
+	if (++b->files_since_submit >= BATCH_SUBMIT_EVERY)
+		batch_reap(b, 0);
+	return 0;
+}
+
+static int8_t batch_defer_mode(filesys_batch* b, const xchar* path,
+ int32_t mode)
+{
+	if (!b || b->last < 0 || strcmp(b->files[b->last].path, path) != 0)
+		return 0;
+	b->files[b->last].set_mode = 1;
+	b->files[b->last].mode = mode;
+	return 1;
+}
+
+static int8_t batch_defer_time(filesys_batch* b, const xchar* path, time_t t)
+{
+	if (!b || b->last < 0 || strcmp(b->files[b->last].path, path) != 0)
+		return 0;
+	b->files[b->last].set_time = 1;
+	b->files[b->last].mtime = t;
+	return 1;
+}
+
+static void batch_unmap(filesys_batch* b)
+{
+	if (b->sqes && b->sqes != MAP_FAILED)
+		munmap(b->sqes, b->sqes_size);
+	if (b->cq_ring && b->cq_ring != MAP_FAILED && b->cq_ring != b->sq_ring)
+		munmap(b->cq_ring, b->cq_ring_size);
+	if (b->sq_ring && b->sq_ring != MAP_FAILED)
+		munmap(b->sq_ring, b->sq_ring_size);
+	close(b->ring_fd);
+	free(b);
 }
 
+filesys_batch* filesys_batch_create(void)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(struct io_uring_params));
+	int fd = (int)syscall(__NR_io_uring_setup, BATCH_SQ_ENTRIES, &p);
+	if (fd < 0)
+		return 0;
+	/* Opening into (and closing from) the registered file table needs Linux
+	 * 5.15; CQE_SKIP came a little later and is the nearest feature bit to
+	 * check for
+	 */
+	if (!(p.features & IORING_FEAT_CQE_SKIP))
+	{
+		close(fd);
+		return 0;
+	}
+
+	filesys_batch* b = malloc(sizeof(filesys_batch));
+	memset(b, 0, sizeof(filesys_batch));
+	b->ring_fd = fd;
+	b->last = -1;
+
+	/* Map the rings; newer kernels share one mapping for both */
+	b->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	b->cq_ring_size = p.cq_off.cqes
+	 + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (b->cq_ring_size > b->sq_ring_size)
+			b->sq_ring_size = b->cq_ring_size;
+		b->cq_ring_size = b->sq_ring_size;
+	}
+	b->sq_ring = mmap(0, b->sq_ring_size, PROT_READ | PROT_WRITE,
+	 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (b->sq_ring == MAP_FAILED)
+	{
+		batch_unmap(b);
+		return 0;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		b->cq_ring = b->sq_ring;
+	else
+	{
+		b->cq_ring = mmap(0, b->cq_ring_size, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (b->cq_ring == MAP_FAILED)
+		{
+			batch_unmap(b);
+			return 0;
+		}
+	}
+	b->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	b->sqes = mmap(0, b->sqes_size, PROT_READ | PROT_WRITE,
+	 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (b->sqes == MAP_FAILED)
+	{
+		batch_unmap(b);
+		return 0;
+	}
+	uint8_t* sq = (uint8_t*)b->sq_ring;
+	uint8_t* cq = (uint8_t*)b->cq_ring;
+	b->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+	b->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+	b->sq_array = (unsigned*)(sq + p.sq_off.array);
+	b->cq_head = (unsigned*)(cq + p.cq_off.head);
+	b->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+	b->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+	b->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	/* An empty registered file table for the files in flight */
+	int fds[BATCH_SLOTS];
+	int i;
+	for (i = 0; i < BATCH_SLOTS; ++i)
+		fds[i] = -1;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, fds,
+	 BATCH_SLOTS) != 0)
+	{
+		batch_unmap(b);
+		return 0;
+	}
+	return b;
+}
+
+int filesys_batch_finish(filesys_batch* b)
+{
+	while (b->in_flight > 0)
+		batch_reap(b, 1);
+	if (b->err)
+	{
+		errno = b->err;
+		return -1;
+	}
+	return 0;
+}
+
+const xchar* filesys_batch_error_path(filesys_batch* b)
+{
+	return b->err_path;
+}
+
+void filesys_batch_free(filesys_batch* b)
+{
+	filesys_batch_finish(b);
+	free(b->err_path);
+	batch_unmap(b);
+}
+
+#else /* !FILESYS_IO_URING */
+
+/* No batching here; filesys_batch_create says so, and nothing else gets
+ * called without a batch
+ */
+struct _filesys_batch
+{
+	int unused;
+};
+
+static int batch_queue(filesys_batch* b __attribute__((unused)),
+ xchar* path __attribute__((unused)), uint8_t* buf __attribute__((unused)),
+ size_t len __attribute__((unused)))
+{
+	return -1;
+}
+
+static void batch_wait_path(filesys_batch* b __attribute__((unused)),
+ const xchar* path __attribute__((unused)))
+{
+}
+
+static int8_t batch_defer_mode(filesys_batch* b __attribute__((unused)),
+ const xchar* path __attribute__((unused)),
+ int32_t mode __attribute__((unused)))
+{
+	return 0;
+}
+
+static int8_t batch_defer_time(filesys_batch* b __attribute__((unused)),
+ const xchar* path __attribute__((unused)), time_t t __attribute__((unused)))
+{
+	return 0;
+}
+
+filesys_batch* filesys_batch_create(void)
+{
+	return 0;
+}
+
+int filesys_batch_finish(filesys_batch* b __attribute__((unused)))
+{
+	return 0;
+}
+
+const xchar* filesys_batch_error_path(filesys_batch* b __attribute__((unused)))
+{
+	return 0;
+}
+
+void filesys_batch_free(filesys_batch* b __attribute__((unused)))
+{
+}
+
+#endif
@@ -21,11 +21,13 @@
 
 #include "filesys.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <io.h>
 #include <malloc.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <tchar.h>
 #include <time.h>
@@ -53,12 +55,14 @@ int8_t filesys_is_dir_sep(xchar ch)
 	return (ch == XC('/') || ch == XC('\\'));
 }
 
-void filesys_set_attributes_win(const xchar* path, uint32_t attr)
+void filesys_set_attributes_win(filesys_batch* batch __attribute__((unused)),
+ const xchar* path, uint32_t attr)
 {
 	SetFileAttributes(path, attr);
 }
 
-void filesys_set_attributes_unix(const xchar* path, int32_t mode)
+void filesys_set_attributes_unix(filesys_batch* batch __attribute__((unused)),
+ const xchar* path, int32_t mode)
 {
 	_tchmod(path, mode);
 }
@@ -87,15 +91,16 @@ void filesys_time_unix(uintmax_t utime, xarc_time_t* xtime)
 	xtime->nano = 0;
 }
 
-void filesys_set_modtime_dos(const xchar* path, uint16_t dosdate,
- uint16_t dostime)
+void filesys_set_modtime_dos(filesys_batch* batch, const xchar* path,
+ uint16_t dosdate, uint16_t dostime)
 {
 	FILETIME ft;
 	if (DosDateTimeToFileTime(dosdate, dostime, &ft))
-		filesys_set_modtime_winft(path, (const win_filetime*)&ft);
+		filesys_set_modtime_winft(batch, path, (const win_filetime*)&ft);
 }
 
-void filesys_set_modtime_winft(const xchar* path, const win_filetime* wintime)
+void filesys_set_modtime_winft(filesys_batch* batch __attribute__((unused)),
+ const xchar* path, const win_filetime* wintime)
 {
 	HANDLE h = CreateFile(path, FILE_WRITE_ATTRIBUTES, 0, 0, OPEN_EXISTING,
 	 FILE_FLAG_BACKUP_SEMANTICS, 0);
@@ -106,13 +111,14 @@ void filesys_set_modtime_winft(const xchar* path, const win_filetime* wintime)
 	}
 }
 
-void filesys_set_modtime_unix(const xchar* path, uintmax_t utime)
+void filesys_set_modtime_unix(filesys_batch* batch, const xchar* path,
+ uintmax_t utime)
 {
 	uint64_t ft64 = ((uint64_t)utime + SECONDS_1601_1970) * __UINT64_C(10000000);
 	FILETIME ft;
 	ft.dwLowDateTime = ft64;
     ft.dwHighDateTime = ft64 >> 32;
-    filesys_set_modtime_winft(path, (const win_filetime*)&ft);
+    filesys_set_modtime_winft(batch, path, (const win_filetime*)&ft);
 }
 
 #if XARC_NATIVE_WCHAR
@@ -199,3 +205,372 @@ int filesys_mkdir(const xchar* path)
 	return _mkdir(path);
 #endif
 }
+
+
+
+/* Windows has nothing like openat, so there are no directory handles to
+ * keep; the cache just remembers the last few directories found or created,
+ * which is where consecutive entries usually go.
+ */
+#define DIR_CACHE_SLOTS 16
+
+struct _filesys_dir_cache
+{
+	xchar* paths[DIR_CACHE_SLOTS];
+	size_t next;
+};
+
+static size_t dir_key_len(const xchar* path)
+{
+	size_t len = xstrlen(path);
+	while (len > 1 && filesys_is_dir_sep(path[len - 1]))
+		--len;
+	return len;
+}
+
+static void dir_remember(filesys_dir_cache* dc, const xchar* path, size_t len)
+{
+	xchar* copy = malloc(sizeof(xchar) * (len + 1));
+	memcpy(copy, path, sizeof(xchar) * len);
+	copy[len] = XC('\0');
+	free(dc->paths[dc->next]);
+	dc->paths[dc->next] = copy;
+	dc->next = (dc->next + 1) % DIR_CACHE_SLOTS;
+}
+
+filesys_dir_cache* filesys_dir_cache_create(void)
+{
+	filesys_dir_cache* dc = malloc(sizeof(filesys_dir_cache));
+	memset(dc, 0, sizeof(filesys_dir_cache));
+	return dc;
+}
+
+void filesys_dir_cache_free(filesys_dir_cache* dc)
+{
+	size_t i;
+	for (i = 0; i < DIR_CACHE_SLOTS; ++i)
+		free(dc->paths[i]);
+	free(dc);
+}
+
+int8_t filesys_dir_cache_exists(filesys_dir_cache* dc, const xchar* dir_path)
+{
+	size_t len = dir_key_len(dir_path);
+	size_t i;
+	for (i = 0; i < DIR_CACHE_SLOTS; ++i)
+	{
+		if (dc->paths[i] && xstrlen(dc->paths[i]) == len
+		 && memcmp(dc->paths[i], dir_path, sizeof(xchar) * len) == 0)
+			return 1;
+	}
+	if (!filesys_dir_exists(dir_path))
+		return 0;
+	dir_remember(dc, dir_path, len);
+	return 1;
+}
+
+int filesys_dir_cache_mkdir(filesys_dir_cache* dc, const xchar* path)
+{
+	if (filesys_mkdir(path) != 0)
+		return -1;
+	dir_remember(dc, path, dir_key_len(path));
+	return 0;
+}
+
+/* Writers buffer up to this much before writing it out */
+#define WRITER_BUFSIZE (1024 * 1024)
+
+/* There's no O_DIRECT equivalent for the CRT's file descriptors
+ * (FILE_FLAG_NO_BUFFERING needs CreateFile), so XARC_XFLAG_DIRECT_IO is
+ * ignored here.
+ */
+struct _filesys_writer
+{
+	int fd;
+	uint8_t* buf;
+	size_t buf_size;
+	size_t buf_used;
+};
+
+static int writer_write_out(filesys_writer* w, const uint8_t* buf, size_t len)
+{
+	while (len > 0)
+	{
+		unsigned int chunk = (len > 0x40000000) ? 0x40000000 : (unsigned int)len;
+		int wr = _write(w->fd, buf, chunk);
+		if (wr < 0)
+			return -1;
+		buf += wr;
+		len -= wr;
+	}
+	return 0;
+}
+
+static int writer_flush(filesys_writer* w)
+{
+	int ret = writer_write_out(w, w->buf, w->buf_used);
+	w->buf_used = 0;
+	return ret;
+}
+
+filesys_writer* filesys_writer_open(filesys_dir_cache* dc
+ __attribute__((unused)), filesys_batch* batch __attribute__((unused)),
+ const xchar* path,
+ uint8_t flags __attribute__((unused)))
+{
+	filesys_ensure_writable(path);
+#if XARC_NATIVE_WCHAR
+	int fd = _wopen(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+	 _S_IREAD | _S_IWRITE);
+#else
+	int fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+	 _S_IREAD | _S_IWRITE);
+#endif
+	if (fd < 0)
+		return 0;
+
+	filesys_writer* w = malloc(sizeof(filesys_writer));
+	w->fd = fd;
+	w->buf = 0;
+	w->buf_size = WRITER_BUFSIZE;
+	w->buf_used = 0;
+	return w;
+}
+
+void filesys_writer_reserve(filesys_writer* w, uint64_t size)
+{
+	/* Small files get a buffer just big enough to write them in one go */
+	if (!w->buf && size < WRITER_BUFSIZE)
+		w->buf_size = (size > 0) ? (size_t)size : 1;
+}
+
+int filesys_writer_space(filesys_writer* w, void** space, size_t* avail)
+{
+	if (!w->buf)
+	{
+		w->buf = malloc(w->buf_size);
+		if (!w->buf)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	if (w->buf_used == w->buf_size && writer_flush(w) != 0)
+		return -1;
+	*space = w->buf + w->buf_used;
+	*avail = w->buf_size - w->buf_used;
+	return 0;
+}
+
+void filesys_writer_commit(filesys_writer* w, size_t len)
+{
+	w->buf_used += len;
+}
+
+int filesys_writer_write(filesys_writer* w, const void* buf, size_t len)
+{
+	const uint8_t* src = (const uint8_t*)buf;
+	/* Big writes go straight to the file when there's nothing buffered */
+	if (w->buf_used == 0 && len >= w->buf_size)
+		return writer_write_out(w, src, len);
+
+	while (len > 0)
+	{
+		void* space;
+		size_t avail;
+		if (filesys_writer_space(w, &space, &avail) != 0)
+			return -1;
+		if (avail > len)
+			avail = len;
+		memcpy(space, src, avail);
+		filesys_writer_commit(w, avail);
+		src += avail;
+		len -= avail;
+	}
+	return 0;
+}
+
+int filesys_writer_copy(filesys_writer* w, filesys_reader* r, uint64_t len,
+ uint64_t* copied)
+{
+	/* No file-to-file copy without going through CreateFile handles; the
+	 * data passes through the buffer
+	 */
+	*copied = 0;
+	while (len > 0)
+	{
+		void* space;
+		size_t avail;
+		if (filesys_writer_space(w, &space, &avail) != 0)
+			return -1;
+		if (avail > len)
+			avail = (size_t)len;
+		size_t got;
+		if (filesys_reader_read(r, space, avail, &got) != 0)
+			return -1;
+		filesys_writer_commit(w, got);
+		*copied += got;
+		len -= got;
+		if (got < avail)
+			break;
+	}
+	return 0;
+}
+
+int filesys_writer_close(filesys_writer* w)
+{
+	int ret = writer_flush(w);
+	int err = errno;
+	if (_close(w->fd) != 0 && ret == 0)
+	{
+		ret = -1;
+		err = errno;
+	}
+	free(w->buf);
+	free(w);
+	errno = err;
+	return ret;
+}
+
+struct _filesys_reader
+{
+	int fd;
+	/* The size of the file, so that skipping past the end is noticed */
+	uint64_t size;
+	/* The modification time when the file was opened */
+	int64_t mod_time;
+	/* The file mapping and its view, once <filesys_reader_map> has been
+	 * called
+	 */
+	HANDLE mapping;
+	void* map;
+};
+
+filesys_reader* filesys_reader_open(const xchar* path)
+{
+#if XARC_NATIVE_WCHAR
+	int fd = _wopen(path, _O_RDONLY | _O_BINARY | _O_SEQUENTIAL);
+#else
+	int fd = _open(path, _O_RDONLY | _O_BINARY | _O_SEQUENTIAL);
+#endif
+	if (fd < 0)
+		return 0;
+	struct __stat64 st;
+	if (_fstat64(fd, &st) != 0)
+	{
+		int err = errno;
+		_close(fd);
+		errno = err;
+		return 0;
+	}
+	filesys_reader* r = malloc(sizeof(filesys_reader));
+	r->fd = fd;
+	r->size = (uint64_t)st.st_size;
+	r->mod_time = (int64_t)st.st_mtime;
+	r->mapping = 0;
+	r->map = 0;
+	return r;
+}
+
+int filesys_reader_read(filesys_reader* r, void* buf, size_t len,
+ size_t* got)
+{
+	uint8_t* dst = (uint8_t*)buf;
+	*got = 0;
+	while (len > 0)
+	{
+		unsigned int chunk = (len > 0x40000000) ? 0x40000000 : (unsigned int)len;
+		int n = _read(r->fd, dst, chunk);
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			break;
+		dst += n;
+		len -= n;
+		*got += n;
+	}
+	return 0;
+}
+
+int filesys_reader_skip(filesys_reader* r, uint64_t len, uint64_t* skipped)
+{
+	*skipped = 0;
+	__int64 pos = _telli64(r->fd);
+	if (pos < 0)
+		return -1;
+	uint64_t left = (r->size > (uint64_t)pos) ? r->size - pos : 0;
+	if (len > left)
+		len = left;
+	if (_lseeki64(r->fd, (__int64)len, SEEK_CUR) < 0)
+		return -1;
+	*skipped = len;
+	return 0;
+}
+
+int filesys_reader_seek(filesys_reader* r, uint64_t offset)
+{
+	return (_lseeki64(r->fd, (__int64)offset, SEEK_SET) < 0) ? -1 : 0;
+}
+
+int filesys_reader_stamp(filesys_reader* r, uint64_t* size, int64_t* mod_time)
+{
+	*size = r->size;
+	*mod_time = r->mod_time;
+	return 0;
+}
+
+const void* filesys_reader_map(filesys_reader* r, size_t* size)
+{
+	if (!r->map)
+	{
+		if (r->size == 0 || r->size > SIZE_MAX)
+			return 0;
+		HANDLE mapping = CreateFileMapping((HANDLE)_get_osfhandle(r->fd), 0,
+		 PAGE_READONLY, 0, 0, 0);
+		if (!mapping)
+			return 0;
+		void* map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!map)
+		{
+			CloseHandle(mapping);
+			return 0;
+		}
+		r->mapping = mapping;
+		r->map = map;
+	}
+	*size = (size_t)r->size;
+	return r->map;
+}
+
+void filesys_reader_close(filesys_reader* r)
+{
+	if (r->map)
+	{
+		UnmapViewOfFile(r->map);
+		CloseHandle(r->mapping);
+	}
+	_close(r->fd);
+	free(r);
+}
+
+/* No batched output on Windows (yet); every file is written as it's
+ * extracted
+ */
+filesys_batch* filesys_batch_create(void)
+{
+	return 0;
+}
+
+int filesys_batch_finish(filesys_batch* b __attribute__((unused)))
+{
+	return 0;
+}
+
+const xchar* filesys_batch_error_path(filesys_batch* b __attribute__((unused)))
+{
+	return 0;
+}
+
+void filesys_batch_free(filesys_batch* b __attribute__((unused)))
+{
+}
@@ -0,0 +1,82 @@
+/* File: libxarc/inflate_whole.h
+ * Decompression of complete DEFLATE streams whose decompressed size is known
+ * up front (ZIP entries, BGZF blocks) in a single call. The implementation is
+ * chosen at build time: plain ZLIB inflate, or libdeflate, which is much
+ * faster when the whole input and output are in memory.
+ */
+
+/* Copyright 2013 John Eubank.
+
+   This file is part of XARC.
+
+   XARC is free software: you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   XARC is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with XARC.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef INFLATE_WHOLE_H_INC
+#define INFLATE_WHOLE_H_INC
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stddef.h>
+
+
+/* Section: Types */
+
+
+/* Type: inflate_whole
+ * An opaque decompressor; reusable, but only by one thread at a time.
+ */
+typedef struct _inflate_whole inflate_whole;
+
+
+/* Section: Functions */
+
+
+/* Function: inflate_whole_create
+ * Create a decompressor.
+ *
+ * Returns:
+ *   A new decompressor, or NULL if out of memory.
+ */
+inflate_whole* inflate_whole_create(void);
+/* Function: inflate_whole_free
+ * Destroy a decompressor created by <inflate_whole_create>.
+ */
+void inflate_whole_free(inflate_whole* iw);
+/* Function: inflate_whole_run
+ * Decompress a raw DEFLATE stream (no ZLIB or GZIP wrapper).
+ *
+ * Parameters:
+ *   iw - The decompressor
+ *   in - The compressed data; the stream may end before the end of it
+ *   in_len - The number of bytes at "in"
+ *   out - Where to put the decompressed data
+ *   out_len - The exact decompressed size
+ *   in_used - If not NULL, set to the length of the compressed stream
+ *
+ * Returns:
+ *   0 if the stream decompressed to exactly out_len bytes; -1 if it's
+ *   corrupt, is a different size, or either length is over 4 GiB.
+ */
+int inflate_whole_run(inflate_whole* iw, const void* in, size_t in_len,
+ void* out, size_t out_len, size_t* in_used);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // INFLATE_WHOLE_H_INC
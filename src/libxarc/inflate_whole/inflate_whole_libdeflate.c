@@ -0,0 +1,68 @@
+/* File: libxarc/inflate_whole/inflate_whole_libdeflate.c
+ * <inflate_whole> on top of libdeflate.
+ */
+
+/* Copyright 2013 John Eubank.
+
+   This file is part of XARC.
+
+   XARC is free software: you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   XARC is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with XARC.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "inflate_whole.h"
+
+#include <limits.h>
+#include <malloc.h>
+#include <libdeflate.h>
+
+
+struct _inflate_whole
+{
+	struct libdeflate_decompressor* d;
+};
+
+inflate_whole* inflate_whole_create(void)
+{
+	inflate_whole* iw = malloc(sizeof(inflate_whole));
+	if (!iw)
+		return 0;
+	iw->d = libdeflate_alloc_decompressor();
+	if (!iw->d)
+	{
+		free(iw);
+		return 0;
+	}
+	return iw;
+}
+
+void inflate_whole_free(inflate_whole* iw)
+{
+	libdeflate_free_decompressor(iw->d);
+	free(iw);
+}
+
+int inflate_whole_run(inflate_whole* iw, const void* in, size_t in_len,
+ void* out, size_t out_len, size_t* in_used)
+{
+	if (in_len > UINT_MAX || out_len > UINT_MAX)
+		return -1;
+	size_t got_in;
+	/* With no actual_out, anything but exactly out_len bytes is an error */
+	if (libdeflate_deflate_decompress_ex(iw->d, in, in_len, out, out_len,
+	 &got_in, 0) != LIBDEFLATE_SUCCESS)
+		return -1;
+	if (in_used)
+		*in_used = got_in;
+	return 0;
+}
@@ -0,0 +1,72 @@
+/* File: libxarc/inflate_whole/inflate_whole_zlib.c
+ * <inflate_whole> on top of ZLIB.
+ */
+
+/* Copyright 2013 John Eubank.
+
+   This file is part of XARC.
+
+   XARC is free software: you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   XARC is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with XARC.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "inflate_whole.h"
+
+#include <limits.h>
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+
+struct _inflate_whole
+{
+	z_stream strm;
+};
+
+inflate_whole* inflate_whole_create(void)
+{
+	inflate_whole* iw = malloc(sizeof(inflate_whole));
+	if (!iw)
+		return 0;
+	memset(&iw->strm, 0, sizeof(z_stream));
+	if (inflateInit2(&iw->strm, -MAX_WBITS) != Z_OK)
+	{
+		free(iw);
+		return 0;
+	}
+	return iw;
+}
+
+void inflate_whole_free(inflate_whole* iw)
+{
+	inflateEnd(&iw->strm);
+	free(iw);
+}
+
+int inflate_whole_run(inflate_whole* iw, const void* in, size_t in_len,
+ void* out, size_t out_len, size_t* in_used)
+{
+	if (in_len > UINT_MAX || out_len > UINT_MAX)
+		return -1;
+	z_stream* zs = &iw->strm;
+	inflateReset(zs);
+	zs->next_in = (Bytef*)in;
+	zs->avail_in = (uInt)in_len;
+	zs->next_out = (Bytef*)out;
+	zs->avail_out = (uInt)out_len;
+	if (inflate(zs, Z_FINISH) != Z_STREAM_END || zs->avail_out != 0)
+		return -1;
+	if (in_used)
+		*in_used = in_len - zs->avail_in;
+	return 0;
+}
@@ -31,6 +31,30 @@
 #include "xarc_impl.h"
 
 
+/* Struct: sz_mem_stream
+ * typedef struct {...} sz_mem_stream - A 7-zip look-ahead stream that reads
+ * straight from an in-memory archive, without any intermediate buffer.
+ */
+typedef struct
+{
+	/* Field: vt
+	 * 7-zip look-ahead stream interface.
+	 */
+	ILookInStream vt;
+	/* Field: buf
+	 * The caller's buffer holding the archive.
+	 */
+	const Byte* buf;
+	/* Field: len
+	 * Size of <buf> in bytes.
+	 */
+	size_t len;
+	/* Field: pos
+	 * Current read position in <buf>.
+	 */
+	size_t pos;
+} sz_mem_stream;
+
 /* Struct: m_7z_extra
  * typedef struct {...} m_7z_extra - Data specific to the 7-zip archive module.
  */
@@ -44,10 +68,36 @@ typedef struct
 	 * 7-zip seeking impl.
 	 */
 	CLookToRead2 lookstream;
+	/* Field: memstream
+	 * 7-zip seeking impl for archives in memory.
+	 */
+	sz_mem_stream memstream;
+	/* Field: look
+	 * Whichever of <lookstream> or <memstream> the archive is read through.
+	 */
+	ILookInStream* look;
 	/* Field: db
 	 * 7-zip archive database.
 	 */
 	CSzArEx db;
+	/* Field: shared_db
+	 * Nonzero if <db> is a shallow copy of another object's database (see
+	 * <m_7z_clone>), which must not be freed by this object.
+	 */
+	uint8_t shared_db;
+	/* Field: archive_path
+	 * Copy of the path the archive was opened from, so that <m_7z_clone> can
+	 * open another stream on it. NULL if the archive is in memory.
+	 */
+	xchar* archive_path;
+	/* Field: archive_buf
+	 * The caller's buffer, if the archive was opened from memory.
+	 */
+	const Byte* archive_buf;
+	/* Field: archive_len
+	 * Size of <archive_buf> in bytes.
+	 */
+	size_t archive_len;
 	/* Field: entry
 	 * Index in archive database of current item.
 	 */
@@ -76,6 +126,18 @@ typedef struct
 	 * Maintained by 7-zip decompressor as a cache until the archive is closed.
 	 */
 	size_t out_buffer_size;
+	/* Field: stream_open
+	 * Nonzero once the current entry has been unpacked for <m_7z_item_read>.
+	 */
+	uint8_t stream_open;
+	/* Field: stream_offset
+	 * Offset within <out_buffer> of the next byte for <m_7z_item_read>.
+	 */
+	size_t stream_offset;
+	/* Field: stream_remaining
+	 * Bytes of the current entry not yet returned by <m_7z_item_read>.
+	 */
+	size_t stream_remaining;
 } m_7z_extra;
 #define M_7Z(x) ((m_7z_extra*)((void*)x + sizeof(struct _xarc)))
 
@@ -83,13 +145,19 @@ typedef struct
 /* Section: Global Data */
 
 
-xarc_result_t m_7z_open(xarc* x, const xchar* file, uint8_t type);
+xarc_result_t m_7z_open(xarc* x, const xarc_source* src, uint8_t type);
 xarc_result_t m_7z_close(xarc* x);
 xarc_result_t m_7z_next_item(xarc* x);
 xarc_result_t m_7z_item_get_info(xarc* x, xarc_item_info* info);
-xarc_result_t m_7z_item_extract(xarc* x, FILE* to, size_t* written);
+xarc_result_t m_7z_item_extract(xarc* x, filesys_writer* to,
+ size_t* written);
+xarc_result_t m_7z_item_open_stream(xarc* x);
+xarc_result_t m_7z_item_read(xarc* x, void* buf, size_t len, size_t* got);
 xarc_result_t m_7z_item_set_props(xarc* x, const xchar* path);
 const xchar* m_7z_error_description(xarc* x, int32_t error_id);
+xarc_result_t m_7z_clone(xarc* x, xarc** clone_out);
+xarc_result_t m_7z_item_tell(xarc* x, xarc_item_pos* pos);
+xarc_result_t m_7z_item_seek(xarc* x, const xarc_item_pos* pos);
 
 
 /* Link m_7z_open as the opener function for the mod_7z archive module. */
@@ -104,8 +172,13 @@ handler_funcs sz_funcs = {
 	m_7z_next_item,
 	m_7z_item_get_info,
 	m_7z_item_extract,
+	m_7z_item_open_stream,
+	m_7z_item_read,
 	m_7z_item_set_props,
-	m_7z_error_description
+	m_7z_error_description,
+	m_7z_clone,
+	m_7z_item_tell,
+	m_7z_item_seek
 };
 
 
@@ -159,18 +232,78 @@ static WRes InFile_OpenX(CSzFile *p, const xchar *name)
 static const size_t kInputBufSize = (size_t) 1 << 18;
 
 
-/* Function: m_7z_open
- * Open a file as a 7-zip archive.
- *
- * See also: <XARC_DEFINE_MODULE(name, open_func, extra_size)>
+/* sz_mem_stream's implementation of ILookInStream */
+static SRes sz_mem_look(const ILookInStream* pp, const void** buf, size_t* size)
+{
+	sz_mem_stream* p = CONTAINER_FROM_VTBL(pp, sz_mem_stream, vt);
+	size_t avail = p->len - p->pos;
+	if (*size > avail)
+		*size = avail;
+	*buf = p->buf + p->pos;
+	return SZ_OK;
+}
+
+static SRes sz_mem_skip(const ILookInStream* pp, size_t offset)
+{
+	sz_mem_stream* p = CONTAINER_FROM_VTBL(pp, sz_mem_stream, vt);
+	p->pos += offset;
+	return SZ_OK;
+}
+
+static SRes sz_mem_read(const ILookInStream* pp, void* buf, size_t* size)
+{
+	sz_mem_stream* p = CONTAINER_FROM_VTBL(pp, sz_mem_stream, vt);
+	size_t avail = p->len - p->pos;
+	if (*size > avail)
+		*size = avail;
+	memcpy(buf, p->buf + p->pos, *size);
+	p->pos += *size;
+	return SZ_OK;
+}
+
+static SRes sz_mem_seek(const ILookInStream* pp, Int64* pos, ESzSeek origin)
+{
+	sz_mem_stream* p = CONTAINER_FROM_VTBL(pp, sz_mem_stream, vt);
+	Int64 base;
+	switch (origin)
+	{
+		case SZ_SEEK_SET:
+			base = 0;
+			break;
+		case SZ_SEEK_CUR:
+			base = (Int64)p->pos;
+			break;
+		case SZ_SEEK_END:
+			base = (Int64)p->len;
+			break;
+		default:
+			return SZ_ERROR_PARAM;
+	}
+	if (base + *pos < 0 || base + *pos > (Int64)p->len)
+		return SZ_ERROR_READ;
+	p->pos = (size_t)(base + *pos);
+	*pos = (Int64)p->pos;
+	return SZ_OK;
+}
+
+
+/* Set up the stream objects 7-zip reads through: the archive file with a
+ * look-ahead buffer, or the in-memory archive directly.
  */
-xarc_result_t m_7z_open(xarc* x, const xchar* file, uint8_t type __attribute__((unused)))
+static xarc_result_t open_streams(xarc* x, const xchar* file)
 {
-	/* Clear our own allocated space */
-	memset(M_7Z(x), 0, sizeof(m_7z_extra));
-	/* Set this <xarc> object to use the 7-zip implementation of <handler_funcs>
-	 */
-	X_BASE(x)->impl = &sz_funcs;
+	if (!file)
+	{
+		M_7Z(x)->memstream.vt.Look = sz_mem_look;
+		M_7Z(x)->memstream.vt.Skip = sz_mem_skip;
+		M_7Z(x)->memstream.vt.Read = sz_mem_read;
+		M_7Z(x)->memstream.vt.Seek = sz_mem_seek;
+		M_7Z(x)->memstream.buf = M_7Z(x)->archive_buf;
+		M_7Z(x)->memstream.len = M_7Z(x)->archive_len;
+		M_7Z(x)->memstream.pos = 0;
+		M_7Z(x)->look = &M_7Z(x)->memstream.vt;
+		return XARC_OK;
+	}
 
 	/* Try to open the file for reading */
 	if (InFile_OpenX(&M_7Z(x)->instream.file, file))
@@ -198,6 +331,42 @@ xarc_result_t m_7z_open(xarc* x, const xchar* file, uint8_t type __attribute__((
 	M_7Z(x)->lookstream.bufSize = kInputBufSize;
 	M_7Z(x)->lookstream.realStream = &M_7Z(x)->instream.vt;
 	LookToRead2_Init(&M_7Z(x)->lookstream);
+	M_7Z(x)->look = &M_7Z(x)->lookstream.vt;
+
+	return XARC_OK;
+}
+
+
+/* Function: m_7z_open
+ * Open a file as a 7-zip archive.
+ *
+ * See also: <XARC_DEFINE_MODULE(name, open_func, extra_size)>
+ */
+xarc_result_t m_7z_open(xarc* x, const xarc_source* src,
+ uint8_t type __attribute__((unused)))
+{
+	/* Clear our own allocated space */
+	memset(M_7Z(x), 0, sizeof(m_7z_extra));
+	/* Set this <xarc> object to use the 7-zip implementation of <handler_funcs>
+	 */
+	X_BASE(x)->impl = &sz_funcs;
+
+	/* Keep the path or buffer around for <m_7z_clone> */
+	if (src->path)
+	{
+		M_7Z(x)->archive_path = malloc(sizeof(xchar)
+		 * (xstrlen(src->path) + 1));
+		xstrcpy(M_7Z(x)->archive_path, src->path);
+	}
+	else
+	{
+		M_7Z(x)->archive_buf = (const Byte*)src->buf;
+		M_7Z(x)->archive_len = src->len;
+	}
+
+	xarc_result_t ret = open_streams(x, M_7Z(x)->archive_path);
+	if (ret != XARC_OK)
+		return ret;
 
 	/* Initialize 7-zip's CRC table */
 	CrcGenerateTable();
@@ -205,12 +374,11 @@ xarc_result_t m_7z_open(xarc* x, const xchar* file, uint8_t type __attribute__((
 	/* Initialize the 7-zip database object */
 	SzArEx_Init(&M_7Z(x)->db);
 	/* Try to open the file stream as a 7-zip archive */
-	if (SzArEx_Open(&M_7Z(x)->db, &M_7Z(x)->lookstream.vt, &g_alloc,
+	if (SzArEx_Open(&M_7Z(x)->db, M_7Z(x)->look, &g_alloc,
 	 &g_alloc_temp) != SZ_OK)
 	{
-		File_Close(&M_7Z(x)->instream.file);
 		return xarc_set_error(x, XARC_ERR_NOT_VALID_ARCHIVE, 0,
-		 XC("Failed to open '%s' as a 7z archive"), file);
+		 XC("Failed to open '%s' as a 7z archive"), src->name);
 	}
 
 	return XARC_OK;
@@ -227,8 +395,14 @@ xarc_result_t m_7z_close(xarc* x)
 		IAlloc_Free(&g_alloc, M_7Z(x)->out_buffer);
 	if (M_7Z(x)->entry_path)
 		free(M_7Z(x)->entry_path);
-	SzArEx_Free(&M_7Z(x)->db, &g_alloc);
-	File_Close(&M_7Z(x)->instream.file);
+	if (M_7Z(x)->archive_path)
+		free(M_7Z(x)->archive_path);
+	if (M_7Z(x)->lookstream.buf)
+		ISzAlloc_Free(&g_alloc, M_7Z(x)->lookstream.buf);
+	if (!M_7Z(x)->shared_db)
+		SzArEx_Free(&M_7Z(x)->db, &g_alloc);
+	if (M_7Z(x)->archive_path)
+		File_Close(&M_7Z(x)->instream.file);
 	return XARC_OK;
 }
 
@@ -247,6 +421,7 @@ xarc_result_t m_7z_next_item(xarc* x)
 	}
 	/* Increment the entry index */
 	++(M_7Z(x)->entry);
+	M_7Z(x)->stream_open = 0;
 	/* If we had retrieved the last entry's path, free it now */
 	if (M_7Z(x)->entry_path)
 	{
@@ -304,11 +479,12 @@ xarc_result_t m_7z_item_get_info(xarc* x, xarc_item_info* info)
 }
 
 /* Function: m_7z_item_extract
- * Extract the current file item to an open FILE stream.
+ * Extract the current file item to an open <filesys_writer>.
  *
  * See also: <handler_funcs.item_extract>
  */
-xarc_result_t m_7z_item_extract(xarc* x, FILE* to, size_t* written)
+xarc_result_t m_7z_item_extract(xarc* x, filesys_writer* to,
+ size_t* written)
 {
 	/* 7-zip will store the offset within the output buffer cache where it has
 	 * placed the decompressed data and where we may start reading from.
@@ -322,7 +498,7 @@ xarc_result_t m_7z_item_extract(xarc* x, FILE* to, size_t* written)
 	 * allocating the necessary memory. TODO: This is obviously broken for large
 	 * enough files.
 	 */
-	SRes res = SzArEx_Extract(&M_7Z(x)->db, &M_7Z(x)->lookstream.vt,
+	SRes res = SzArEx_Extract(&M_7Z(x)->db, M_7Z(x)->look,
 	 M_7Z(x)->entry, &M_7Z(x)->block_index, &M_7Z(x)->out_buffer,
 	 &M_7Z(x)->out_buffer_size, &offset, &out_processed, &g_alloc,
 	 &g_alloc_temp);
@@ -331,9 +507,10 @@ xarc_result_t m_7z_item_extract(xarc* x, FILE* to, size_t* written)
 		return xarc_set_error(x, XARC_MODULE_ERROR, res,
 		 XC("7zlib failed to unpack file"));
 	}
-	/* Write out the unpacked data to the FILE stream. */
-	int wr = fwrite(M_7Z(x)->out_buffer + offset, 1, out_processed, to);
-	if (wr <= 0 || (size_t)wr != out_processed)
+	/* Write out the unpacked data to the file. */
+	filesys_writer_reserve(to, out_processed);
+	if (filesys_writer_write(to, M_7Z(x)->out_buffer + offset,
+	 out_processed) != 0)
 	{
 		return xarc_set_error_filesys(x, XC("Failed to write %"PRIuMAX" bytes"),
 		 out_processed);
@@ -343,6 +520,50 @@ xarc_result_t m_7z_item_extract(xarc* x, FILE* to, size_t* written)
 	return XARC_OK;
 }
 
+/* Function: m_7z_item_open_stream
+ * Unpack the current file item, ready to be handed out by <m_7z_item_read>.
+ *
+ * See also: <handler_funcs.item_open_stream>
+ */
+xarc_result_t m_7z_item_open_stream(xarc* x)
+{
+	/* 7-zip unpacks whole files (whole solid blocks, in fact) into its output
+	 * buffer cache; reads are served from there.
+	 */
+	SRes res = SzArEx_Extract(&M_7Z(x)->db, M_7Z(x)->look,
+	 M_7Z(x)->entry, &M_7Z(x)->block_index, &M_7Z(x)->out_buffer,
+	 &M_7Z(x)->out_buffer_size, &M_7Z(x)->stream_offset,
+	 &M_7Z(x)->stream_remaining, &g_alloc, &g_alloc_temp);
+	if (res != SZ_OK)
+	{
+		return xarc_set_error(x, XARC_MODULE_ERROR, res,
+		 XC("7zlib failed to unpack file"));
+	}
+	M_7Z(x)->stream_open = 1;
+	return XARC_OK;
+}
+
+/* Function: m_7z_item_read
+ * Copy the next piece of the unpacked file item into the caller's buffer.
+ *
+ * See also: <handler_funcs.item_read>
+ */
+xarc_result_t m_7z_item_read(xarc* x, void* buf, size_t len, size_t* got)
+{
+	if (!M_7Z(x)->stream_open)
+		return xarc_set_error(x, XARC_ERR_NO_STREAM, 0, 0);
+	if (len > M_7Z(x)->stream_remaining)
+		len = M_7Z(x)->stream_remaining;
+	if (len > 0)
+	{
+		memcpy(buf, M_7Z(x)->out_buffer + M_7Z(x)->stream_offset, len);
+		M_7Z(x)->stream_offset += len;
+		M_7Z(x)->stream_remaining -= len;
+	}
+	*got = len;
+	return XARC_OK;
+}
+
 /* Function: m_7z_item_set_props
  * Apply the entry's metadata to the written file.
  *
@@ -355,13 +576,13 @@ xarc_result_t m_7z_item_set_props(xarc* x, const xchar* path)
 	 */
 	if (SzBitWithVals_Check(&(M_7Z(x)->db.Attribs), M_7Z(x)->entry))
 	{
-		filesys_set_attributes_win(path,
+		filesys_set_attributes_win(X_BASE(x)->batch, path,
 		 M_7Z(x)->db.Attribs.Vals[M_7Z(x)->entry]);
 	}
 	/* If the item has a last-modified time, apply it. */
 	if (SzBitWithVals_Check(&(M_7Z(x)->db.MTime), M_7Z(x)->entry))
 	{
-		filesys_set_modtime_winft(path,
+		filesys_set_modtime_winft(X_BASE(x)->batch, path,
 		 (const win_filetime*)&M_7Z(x)->db.MTime.Vals[M_7Z(x)->entry]);
 	}
 	return XARC_OK;
@@ -382,3 +603,80 @@ const xchar* m_7z_error_description(xarc* x __attribute__((unused)),
 	/* Otherwise, return the string indexed in the <sz_error_names> table. */
 	return sz_error_names[error_id - 1];
 }
+
+/* Function: m_7z_clone
+ * Open another stream on the same archive, sharing the parsed database.
+ *
+ * See also: <handler_funcs.clone>
+ */
+xarc_result_t m_7z_clone(xarc* x, xarc** clone_out)
+{
+	xarc* c = malloc(sizeof(struct _xarc) + sizeof(m_7z_extra));
+	memset(c, 0, sizeof(struct _xarc) + sizeof(m_7z_extra));
+	X_BASE(c)->impl = &sz_funcs;
+	if (M_7Z(x)->archive_path)
+	{
+		M_7Z(c)->archive_path = malloc(sizeof(xchar)
+		 * (xstrlen(M_7Z(x)->archive_path) + 1));
+		xstrcpy(M_7Z(c)->archive_path, M_7Z(x)->archive_path);
+	}
+	M_7Z(c)->archive_buf = M_7Z(x)->archive_buf;
+	M_7Z(c)->archive_len = M_7Z(x)->archive_len;
+
+	/* The database is only read during extraction, so the clone can use a
+	 * shallow copy of it. Each clone has its own stream and folder cache.
+	 */
+	M_7Z(c)->db = M_7Z(x)->db;
+	M_7Z(c)->shared_db = 1;
+	if (open_streams(c, M_7Z(c)->archive_path) != XARC_OK)
+	{
+		xarc_error* e = X_BASE(c)->error;
+		xarc_result_t ret = xarc_set_error(x, e->xarc_id, e->library_error_id,
+		 XC("%s"), e->error_additional);
+		xarc_close(c);
+		return ret;
+	}
+
+	*clone_out = c;
+	return XARC_OK;
+}
+
+/* Function: m_7z_item_tell
+ * Get the database index of the current item.
+ *
+ * See also: <handler_funcs.item_tell>
+ */
+xarc_result_t m_7z_item_tell(xarc* x, xarc_item_pos* pos)
+{
+	UInt32 folder = M_7Z(x)->db.FileToFolder[M_7Z(x)->entry];
+	pos->offset = 0;
+	pos->index = M_7Z(x)->entry;
+	/* Files in the same folder (solid block) are decoded together; files with
+	 * no data don't belong to any folder.
+	 */
+	pos->group = (folder == (UInt32)-1) ?
+	 (((uint64_t)1 << 32) | M_7Z(x)->entry) : folder;
+	return XARC_OK;
+}
+
+/* Function: m_7z_item_seek
+ * Make the item at a database index the current item.
+ *
+ * See also: <handler_funcs.item_seek>
+ */
+xarc_result_t m_7z_item_seek(xarc* x, const xarc_item_pos* pos)
+{
+	if (pos->index >= M_7Z(x)->db.NumFiles)
+	{
+		return xarc_set_error(x, XARC_MODULE_ERROR, SZ_ERROR_PARAM,
+		 XC("7z entry index out of range"));
+	}
+	M_7Z(x)->entry = (uint32_t)pos->index;
+	M_7Z(x)->stream_open = 0;
+	if (M_7Z(x)->entry_path)
+	{
+		free(M_7Z(x)->entry_path);
+		M_7Z(x)->entry_path = 0;
+	}
+	return XARC_OK;
+}
@@ -20,8 +20,10 @@
    along with XARC.  If not, see <http://www.gnu.org/licenses/>.  */
 
 
+#include <limits.h>
 #include <string.h>
 #include "filesys.h"
+#include "inflate_whole.h"
 #include "unzip.h"
 #include "xarc_impl.h"
 
@@ -40,12 +42,43 @@ typedef struct
 	 * Minizip archive file object.
 	 */
 	unzFile file;
+	/* Field: archive_path
+	 * Copy of the path the archive was opened from, so that <m_zip_clone> can
+	 * open another cursor on it. NULL if the archive is in memory.
+	 */
+	xchar* archive_path;
+	/* Field: archive_buf
+	 * The caller's buffer, if the archive was opened from memory.
+	 */
+	const uint8_t* archive_buf;
+	/* Field: archive_len
+	 * Size of <archive_buf> in bytes.
+	 */
+	size_t archive_len;
 	/* Field: item_path
 	 * Relative path of current item.
 	 *
 	 * NULL unless <m_zip_item_get_info> has been called for the current item.
 	 */
 	xchar* item_path;
+	/* Field: stream_open
+	 * Nonzero while the current item is open in minizip for
+	 * <m_zip_item_read>.
+	 */
+	uint8_t stream_open;
+	/* Field: whole
+	 * Decompressor for entries small enough to decode in one call; created
+	 * the first time one is extracted.
+	 */
+	inflate_whole* whole;
+	/* Field: whole_in
+	 * Buffer for the compressed data of such entries.
+	 */
+	uint8_t* whole_in;
+	/* Field: whole_in_size
+	 * Size of <whole_in> in bytes.
+	 */
+	size_t whole_in_size;
 #if XARC_NATIVE_WCHAR
 	/* Since minizip only knows about narrow-char strings, we have to convert
 	 * its error strings to wide-char and store them.
@@ -55,17 +88,26 @@ typedef struct
 } m_zip_extra;
 #define M_ZIP(x) ((m_zip_extra*)((void*)x + sizeof(struct _xarc)))
 
+/* The largest compressed size of an entry that's decoded in one call */
+#define WHOLE_MAX (4 * 1024 * 1024)
+
 
 /* Section: Global Data */
 
 
-xarc_result_t m_zip_open(xarc* x, const xchar* file, uint8_t type);
+xarc_result_t m_zip_open(xarc* x, const xarc_source* src, uint8_t type);
 xarc_result_t m_zip_close(xarc* x);
 xarc_result_t m_zip_next_item(xarc* x);
 xarc_result_t m_zip_item_get_info(xarc* x, xarc_item_info* info);
-xarc_result_t m_zip_item_extract(xarc* x, FILE* to, size_t* written);
+xarc_result_t m_zip_item_extract(xarc* x, filesys_writer* to,
+ size_t* written);
+xarc_result_t m_zip_item_open_stream(xarc* x);
+xarc_result_t m_zip_item_read(xarc* x, void* buf, size_t len, size_t* got);
 xarc_result_t m_zip_item_set_props(xarc* x, const xchar* path);
 const xchar* m_zip_error_description(xarc* x, int32_t error_id);
+xarc_result_t m_zip_clone(xarc* x, xarc** clone_out);
+xarc_result_t m_zip_item_tell(xarc* x, xarc_item_pos* pos);
+xarc_result_t m_zip_item_seek(xarc* x, const xarc_item_pos* pos);
 
 
 /* Link m_zip_open as the opener function for the mod_minizip archive module. */
@@ -80,8 +122,13 @@ handler_funcs zip_funcs = {
 	m_zip_next_item,
 	m_zip_item_get_info,
 	m_zip_item_extract,
+	m_zip_item_open_stream,
+	m_zip_item_read,
 	m_zip_item_set_props,
-	m_zip_error_description
+	m_zip_error_description,
+	m_zip_clone,
+	m_zip_item_tell,
+	m_zip_item_seek
 };
 
 /* Variable: minizip_descriptors
@@ -106,13 +153,193 @@ static xarc_result_t set_error_zip(xarc* x, int mzerror)
 	 xarc_set_error(x, XARC_MODULE_ERROR, mzerror, 0);
 }
 
+/* Extract a DEFLATE entry whose compressed data fits in memory and whose
+ * decompressed data fits in the space the writer has free, in a single
+ * <inflate_whole_run> call. minizip hands over the compressed data as it is,
+ * and the CRC is checked here.
+ */
+static xarc_result_t extract_whole(xarc* x, filesys_writer* to,
+ const unz_file_info* ufi, void* space, size_t* written)
+{
+	m_zip_extra* mz = M_ZIP(x);
+	size_t in_len = ufi->compressed_size;
+	if (mz->whole_in_size < in_len)
+	{
+		free(mz->whole_in);
+		mz->whole_in_size = in_len;
+		mz->whole_in = malloc(in_len);
+	}
+
+	int method;
+	int level;
+	int ret = unzOpenCurrentFile2(mz->file, &method, &level, 1);
+	if (ret != UNZ_OK)
+		return set_error_zip(x, ret);
+	size_t got = 0;
+	while (got < in_len)
+	{
+		ret = unzReadCurrentFile(mz->file, mz->whole_in + got,
+		 (unsigned)(in_len - got));
+		if (ret < 0)
+			return set_error_zip(x, ret);
+		if (ret == 0)
+			break;
+		got += ret;
+	}
+	ret = unzCloseCurrentFile(mz->file);
+	if (ret != UNZ_OK)
+		return set_error_zip(x, ret);
+
+	if (got < in_len || inflate_whole_run(mz->whole, mz->whole_in, in_len,
+	 space, ufi->uncompressed_size, 0) != 0)
+		return set_error_zip(x, Z_DATA_ERROR);
+	if (crc32(0, space, ufi->uncompressed_size) != ufi->crc)
+		return set_error_zip(x, UNZ_CRCERROR);
+	filesys_writer_commit(to, ufi->uncompressed_size);
+	*written = ufi->uncompressed_size;
+	return XARC_OK;
+}
+
+/* Close the current item if it was left open by <m_zip_item_open_stream> */
+static void close_stream(xarc* x)
+{
+	if (M_ZIP(x)->stream_open)
+	{
+		unzCloseCurrentFile(M_ZIP(x)->file);
+		M_ZIP(x)->stream_open = 0;
+	}
+}
+
+
+/* Section: In-memory archives
+ * minizip reads through a table of file functions. For archives held in
+ * memory, these functions read straight from the caller's buffer.
+ */
+
+
+/* A read cursor on an in-memory archive */
+typedef struct
+{
+	const uint8_t* buf;
+	ZPOS64_T len;
+	ZPOS64_T pos;
+} zip_mem_stream;
+
+/* The "filename" minizip passes in is the module's <m_zip_extra> */
+static voidpf ZCALLBACK zip_mem_open(voidpf opaque __attribute__((unused)),
+ const void* filename, int mode __attribute__((unused)))
+{
+	const m_zip_extra* mz = (const m_zip_extra*)filename;
+	zip_mem_stream* ms = malloc(sizeof(zip_mem_stream));
+	ms->buf = mz->archive_buf;
+	ms->len = mz->archive_len;
+	ms->pos = 0;
+	return ms;
+}
+
+static uLong ZCALLBACK zip_mem_read(voidpf opaque __attribute__((unused)),
+ voidpf stream, void* buf, uLong size)
+{
+	zip_mem_stream* ms = (zip_mem_stream*)stream;
+	if (ms->pos >= ms->len)
+		return 0;
+	if (size > ms->len - ms->pos)
+		size = (uLong)(ms->len - ms->pos);
+	memcpy(buf, ms->buf + ms->pos, size);
+	ms->pos += size;
+	return size;
+}
+
+static uLong ZCALLBACK zip_mem_write(voidpf opaque __attribute__((unused)),
+ voidpf stream __attribute__((unused)),
+ const void* buf __attribute__((unused)), uLong size __attribute__((unused)))
+{
+	/* Archives are only ever opened for reading */
+	return 0;
+}
+
+static ZPOS64_T ZCALLBACK zip_mem_tell(voidpf opaque __attribute__((unused)),
+ voidpf stream)
+{
+	return ((zip_mem_stream*)stream)->pos;
+}
+
+static long ZCALLBACK zip_mem_seek(voidpf opaque __attribute__((unused)),
+ voidpf stream, ZPOS64_T offset, int origin)
+{
+	zip_mem_stream* ms = (zip_mem_stream*)stream;
+	ZPOS64_T base;
+	switch (origin)
+	{
+		case ZLIB_FILEFUNC_SEEK_SET:
+			base = 0;
+			break;
+		case ZLIB_FILEFUNC_SEEK_CUR:
+			base = ms->pos;
+			break;
+		case ZLIB_FILEFUNC_SEEK_END:
+			base = ms->len;
+			break;
+		default:
+			return -1;
+	}
+	if (offset > ms->len - base)
+		return -1;
+	ms->pos = base + offset;
+	return 0;
+}
+
+static int ZCALLBACK zip_mem_close(voidpf opaque __attribute__((unused)),
+ voidpf stream)
+{
+	free(stream);
+	return 0;
+}
+
+static int ZCALLBACK zip_mem_error(voidpf opaque __attribute__((unused)),
+ voidpf stream __attribute__((unused)))
+{
+	return 0;
+}
+
+
+/* Open a minizip cursor on the archive the <xarc> object refers to, whether
+ * it's a file or in memory.
+ */
+static unzFile open_unzfile(xarc* x)
+{
+	zlib_filefunc64_def zfuncs;
+	if (!M_ZIP(x)->archive_path)
+	{
+		zfuncs.zopen64_file = zip_mem_open;
+		zfuncs.zread_file = zip_mem_read;
+		zfuncs.zwrite_file = zip_mem_write;
+		zfuncs.ztell64_file = zip_mem_tell;
+		zfuncs.zseek64_file = zip_mem_seek;
+		zfuncs.zclose_file = zip_mem_close;
+		zfuncs.zerror_file = zip_mem_error;
+		zfuncs.opaque = 0;
+		return unzOpen2_64(M_ZIP(x), &zfuncs);
+	}
+
+	/* Fill out a zlib_filefunc64_def object to tell minizip whether to use
+	 * Windows functions or standard 64-bit fopen functions
+	 */
+#if defined(_WIN32) || defined(_WIN64)
+	fill_win32_filefunc64(&zfuncs);
+#else
+	fill_fopen64_filefunc(&zfuncs);
+#endif
+	return unzOpen2_64((const char*)M_ZIP(x)->archive_path, &zfuncs);
+}
+
 
 /* Function: m_zip_open
  * Open a file as a ZIP archive.
  *
  * See also: <XARC_DEFINE_MODULE(name, open_func, extra_size)>
  */
-xarc_result_t m_zip_open(xarc* x, const xchar* file,
+xarc_result_t m_zip_open(xarc* x, const xarc_source* src,
  uint8_t type __attribute__((unused)))
 {
 	/* Clear our own allocated space */
@@ -122,21 +349,25 @@ xarc_result_t m_zip_open(xarc* x, const xchar* file,
 	 */
 	X_BASE(x)->impl = &zip_funcs;
 
-	/* Fill out a zlib_filefunc64_def object to tell minizip whether to use
-	 * Windows functions or standard 64-bit fopen functions
-	 */
-	zlib_filefunc64_def zfuncs;
-#if defined(_WIN32) || defined(_WIN64)
-	fill_win32_filefunc64(&zfuncs);
-#else
-	fill_fopen64_filefunc(&zfuncs);
-#endif
+	/* Keep the path or buffer around for <m_zip_clone> */
+	if (src->path)
+	{
+		M_ZIP(x)->archive_path = malloc(sizeof(xchar)
+		 * (xstrlen(src->path) + 1));
+		xstrcpy(M_ZIP(x)->archive_path, src->path);
+	}
+	else
+	{
+		M_ZIP(x)->archive_buf = src->buf;
+		M_ZIP(x)->archive_len = src->len;
+	}
+
 	/* Try to open the file as a ZIP archive */
-	unzFile f = unzOpen2_64((const char*)file, &zfuncs);
+	unzFile f = open_unzfile(x);
 	if (!f)
 	{
 		return xarc_set_error(x, XARC_ERR_NOT_VALID_ARCHIVE, 0,
-		 XC("minizip failed to open '%s' as a ZIP archive"), file);
+		 XC("minizip failed to open '%s' as a ZIP archive"), src->name);
 	}
 	M_ZIP(x)->file = f;
 
@@ -156,6 +387,11 @@ xarc_result_t m_zip_close(xarc* x)
 #endif
 	if (M_ZIP(x)->item_path)
 		free(M_ZIP(x)->item_path);
+	if (M_ZIP(x)->archive_path)
+		free(M_ZIP(x)->archive_path);
+	if (M_ZIP(x)->whole)
+		inflate_whole_free(M_ZIP(x)->whole);
+	free(M_ZIP(x)->whole_in);
 	int ret = UNZ_OK;
 	if (M_ZIP(x)->file)
 		ret = unzClose(M_ZIP(x)->file);
@@ -171,6 +407,7 @@ xarc_result_t m_zip_close(xarc* x)
  */
 xarc_result_t m_zip_next_item(xarc* x)
 {
+	close_stream(x);
 	int ret = unzGoToNextFile(M_ZIP(x)->file);
 	if (ret == UNZ_END_OF_LIST_OF_FILE)
 		return xarc_set_error(x, XARC_NO_MORE_ITEMS, ret, 0);
@@ -243,38 +480,64 @@ xarc_result_t m_zip_item_get_info(xarc* x, xarc_item_info* info)
 }
 
 /* Function: m_zip_item_extract
- * Extract the current file item to an open FILE stream.
+ * Extract the current file item to an open <filesys_writer>.
  *
  * See also: <handler_funcs.item_extract>
  */
-xarc_result_t m_zip_item_extract(xarc* x, FILE* to, size_t* written)
+xarc_result_t m_zip_item_extract(xarc* x, filesys_writer* to,
+ size_t* written)
 {
+	close_stream(x);
+	/* The central directory tells us how big the entry is */
+	unz_file_info ufi;
+	int ret = unzGetCurrentFileInfo(M_ZIP(x)->file, &ufi, 0, 0, 0, 0, 0, 0);
+	if (ret != UNZ_OK)
+		return set_error_zip(x, ret);
+	filesys_writer_reserve(to, ufi.uncompressed_size);
+
+	/* Unencrypted DEFLATE entries that fit in the writer's buffer are decoded
+	 * in one go.
+	 */
+	if (ufi.compression_method == Z_DEFLATED && !(ufi.flag & 1)
+	 && ufi.uncompressed_size > 0 && ufi.compressed_size <= WHOLE_MAX)
+	{
+		void* space;
+		size_t avail;
+		if (filesys_writer_space(to, &space, &avail) != 0)
+			return xarc_set_error_filesys(x, 0);
+		if (!M_ZIP(x)->whole && avail >= ufi.uncompressed_size)
+			M_ZIP(x)->whole = inflate_whole_create();
+		if (M_ZIP(x)->whole && avail >= ufi.uncompressed_size)
+			return extract_whole(x, to, &ufi, space, written);
+	}
+
 	/* Tell minizip to get ready to extract the current item */
-	int ret = unzOpenCurrentFile(M_ZIP(x)->file);
+	ret = unzOpenCurrentFile(M_ZIP(x)->file);
 	if (ret != UNZ_OK)
 		return set_error_zip(x, ret);
 
-	/* Get unpacked data from minizip and write it out, 4096 bytes at a time. */
+	/* Have minizip unpack straight into the writer's buffer, as much as fits
+	 * at a time.
+	 */
 	*written = 0;
-	char buf[4096];
 	while (1)
 	{
-		ret = unzReadCurrentFile(M_ZIP(x)->file, buf, 4096);
+		void* space;
+		size_t avail;
+		if (filesys_writer_space(to, &space, &avail) != 0)
+			return xarc_set_error_filesys(x, 0);
+		if (avail > UINT_MAX)
+			avail = UINT_MAX;
+		ret = unzReadCurrentFile(M_ZIP(x)->file, space, (unsigned)avail);
 		/* Less than 0 means an error occurred */
 		if (ret < 0)
 			return set_error_zip(x, ret);
 		/* 0 means we reached the end of the entry */
 		if (ret == 0)
 			break;
-		/* Write out whatever data we got */
-		size_t wr = fwrite(buf, 1, ret, to);
 		/* Keep <written> up-to-date on the amount of data written out */
-		if (wr > 0)
-			*written += wr;
-		/* If we didn't write all the data we wanted to, something odd happened.
-		 */
-		if (wr != (size_t)ret)
-			return xarc_set_error_filesys(x, 0);
+		filesys_writer_commit(to, ret);
+		*written += ret;
 	}
 
 	/* Tell minizip we're done extracting. At this point it may verify the CRC
@@ -287,6 +550,61 @@ xarc_result_t m_zip_item_extract(xarc* x, FILE* to, size_t* written)
 	return XARC_OK;
 }
 
+/* Function: m_zip_item_open_stream
+ * Open the current file item in minizip for reading.
+ *
+ * See also: <handler_funcs.item_open_stream>
+ */
+xarc_result_t m_zip_item_open_stream(xarc* x)
+{
+	close_stream(x);
+	int ret = unzOpenCurrentFile(M_ZIP(x)->file);
+	if (ret != UNZ_OK)
+		return set_error_zip(x, ret);
+	M_ZIP(x)->stream_open = 1;
+	return XARC_OK;
+}
+
+/* Function: m_zip_item_read
+ * Inflate the current file item straight into the caller's buffer.
+ *
+ * See also: <handler_funcs.item_read>
+ */
+xarc_result_t m_zip_item_read(xarc* x, void* buf, size_t len, size_t* got)
+{
+	if (!M_ZIP(x)->stream_open)
+		return xarc_set_error(x, XARC_ERR_NO_STREAM, 0, 0);
+
+	while (*got < len)
+	{
+		/* minizip takes an unsigned length; it fills as much of it as it can
+		 * before returning.
+		 */
+		size_t want = len - *got;
+		if (want > UINT_MAX)
+			want = UINT_MAX;
+		int ret = unzReadCurrentFile(M_ZIP(x)->file, (char*)buf + *got,
+		 (unsigned)want);
+		/* Less than 0 means an error occurred */
+		if (ret < 0)
+			return set_error_zip(x, ret);
+		/* 0 means we reached the end of the entry. Closing the entry is when
+		 * minizip verifies its CRC.
+		 */
+		if (ret == 0)
+		{
+			M_ZIP(x)->stream_open = 0;
+			ret = unzCloseCurrentFile(M_ZIP(x)->file);
+			if (ret != UNZ_OK)
+				return set_error_zip(x, ret);
+			break;
+		}
+		*got += ret;
+	}
+
+	return XARC_OK;
+}
+
 /* Function: m_zip_item_set_props
  * Apply the entry's metadata to the written file.
  *
@@ -304,10 +622,12 @@ xarc_result_t m_zip_item_set_props(xarc* x, const xchar* path)
 	 * systems will interpret as best they can)
 	 */
 	if (ufi.version >> 8 == 0 || ufi.version >> 8 == 10)
-		filesys_set_attributes_win(path, ufi.external_fa);
+		filesys_set_attributes_win(X_BASE(x)->batch, path,
+		 ufi.external_fa);
 
 	/* Apply the entry's last-modified timestamp */
-	filesys_set_modtime_dos(path, ufi.dosDate >> 16, ufi.dosDate);
+	filesys_set_modtime_dos(X_BASE(x)->batch, path, ufi.dosDate >> 16,
+	 ufi.dosDate);
 
 	return XARC_OK;
 }
@@ -344,3 +664,72 @@ const xchar* m_zip_error_description(xarc* x, int32_t error_id)
 #endif
 	}
 }
+
+/* Function: m_zip_clone
+ * Open an independent minizip cursor on the same archive.
+ *
+ * See also: <handler_funcs.clone>
+ */
+xarc_result_t m_zip_clone(xarc* x, xarc** clone_out)
+{
+	xarc* c = malloc(sizeof(struct _xarc) + sizeof(m_zip_extra));
+	memset(c, 0, sizeof(struct _xarc) + sizeof(m_zip_extra));
+	X_BASE(c)->impl = &zip_funcs;
+	if (M_ZIP(x)->archive_path)
+	{
+		M_ZIP(c)->archive_path = malloc(sizeof(xchar)
+		 * (xstrlen(M_ZIP(x)->archive_path) + 1));
+		xstrcpy(M_ZIP(c)->archive_path, M_ZIP(x)->archive_path);
+	}
+	M_ZIP(c)->archive_buf = M_ZIP(x)->archive_buf;
+	M_ZIP(c)->archive_len = M_ZIP(x)->archive_len;
+
+	/* Each clone gets its own unzFile, and so its own file handle and
+	 * read position
+	 */
+	M_ZIP(c)->file = open_unzfile(c);
+	if (!M_ZIP(c)->file)
+	{
+		xarc_close(c);
+		return xarc_set_error(x, XARC_ERR_NOT_VALID_ARCHIVE, 0,
+		 XC("minizip failed to reopen the ZIP archive"));
+	}
+
+	*clone_out = c;
+	return XARC_OK;
+}
+
+/* Function: m_zip_item_tell
+ * Get the central directory position of the current item.
+ *
+ * See also: <handler_funcs.item_tell>
+ */
+xarc_result_t m_zip_item_tell(xarc* x, xarc_item_pos* pos)
+{
+	unz64_file_pos fp;
+	int ret = unzGetFilePos64(M_ZIP(x)->file, &fp);
+	if (ret != UNZ_OK)
+		return set_error_zip(x, ret);
+	pos->offset = fp.pos_in_zip_directory;
+	pos->index = fp.num_of_file;
+	/* Every ZIP entry is compressed independently */
+	pos->group = fp.num_of_file;
+	return XARC_OK;
+}
+
+/* Function: m_zip_item_seek
+ * Make the item at a central directory position the current item.
+ *
+ * See also: <handler_funcs.item_seek>
+ */
+xarc_result_t m_zip_item_seek(xarc* x, const xarc_item_pos* pos)
+{
+	close_stream(x);
+	unz64_file_pos fp;
+	fp.pos_in_zip_directory = pos->offset;
+	fp.num_of_file = pos->index;
+	int ret = unzGoToFilePos64(M_ZIP(x)->file, &fp);
+	if (ret != UNZ_OK)
+		return set_error_zip(x, ret);
+	return XARC_OK;
+}
@@ -45,6 +45,23 @@ typedef struct
 	 * See: <xarc_decompress_impl>
 	 */
 	xarc_decompress_impl* decomp;
+	/* Field: inbuf
+	 * Decompressed archive data, read ahead <UNTAR_BUFSIZE> bytes at a time.
+	 * Headers are parsed straight out of it.
+	 */
+	uint8_t* inbuf;
+	/* Field: in_pos
+	 * Offset in <inbuf> of the next byte of the archive.
+	 */
+	size_t in_pos;
+	/* Field: in_len
+	 * The number of bytes of <inbuf> that hold data.
+	 */
+	size_t in_len;
+	/* Field: in_eof
+	 * Set once the decompressor has run out of data.
+	 */
+	uint8_t in_eof;
 	/* Field: entry_properties
 	 * Bitfield holding the current entry's platform-independent flags.
 	 *
@@ -54,7 +71,17 @@ typedef struct
 	/* Field: entry_bytes_remaining
 	 * The size of the current entry if it's a file
 	 */
-	size_t entry_bytes_remaining;
+	uint64_t entry_bytes_remaining;
+	/* Field: entry_padding
+	 * The number of padding bytes between the end of the current entry's data
+	 * and the next TAR block.
+	 */
+	size_t entry_padding;
+	/* Field: stream_open
+	 * Nonzero once <m_untar_item_open_stream> has been called for the current
+	 * entry.
+	 */
+	uint8_t stream_open;
 	/* Field: entry_path
 	 * The relative path of the current entry.
 	 *
@@ -65,7 +92,7 @@ typedef struct
 	/* Field: entry_time
 	 * The last-modified timestamp of the current entry.
 	 */
-	int32_t entry_time;
+	int64_t entry_time;
 	/* Field: entry_mode
 	 * The Unix-style filesystem attributes (permissions) of the current entry.
 	 */
@@ -87,6 +114,9 @@ typedef struct
 #define DIRTYPE  '5'            /* directory */
 #define FIFOTYPE '6'            /* FIFO special */
 #define CONTTYPE '7'            /* reserved */
+/* POSIX.1-2001 (pax) extensions */
+#define XHDTYPE  'x'            /* extended header for the next entry */
+#define XGLTYPE  'g'            /* global extended header */
 /* GNU tar extensions */
 #define GNUTYPE_DUMPDIR  'D'    /* file names from dumped directory */
 #define GNUTYPE_LONGLINK 'K'    /* long link name */
@@ -99,8 +129,17 @@ typedef struct
 #define BLOCKSIZE     512
 #define SHORTNAMESIZE 100
 
+/* The amount of decompressed data to read ahead at a time */
+#define UNTAR_BUFSIZE (1024 * 1024)
+/* Reads of entry data at least this big skip <inbuf> and go straight from the
+ * decompressor into the caller's buffer
+ */
+#define UNTAR_DIRECT_MIN 65536
+/* The most pax extended header data we'll take for one entry */
+#define UNTAR_MAX_PAX (16 * 1024 * 1024)
+
 /* The TAR header has a constant size (i.e. no variable-length fields); we can
- * read an entire header object in with a single read op. */
+ * parse a header block right where it sits in the read-ahead buffer. */
 struct tar_header
 {                               /* byte offset */
   char name[100];               /*   0 */
@@ -119,15 +158,19 @@ struct tar_header
   char devmajor[8];             /* 329 */
   char devminor[8];             /* 337 */
   char prefix[155];             /* 345 */
-                                /* 500 */
+  char padding[12];             /* 500 */
+                                /* 512 (BLOCKSIZE) */
 };
 
 
-xarc_result_t m_untar_open(xarc* x, const xchar* file, uint8_t type);
+xarc_result_t m_untar_open(xarc* x, const xarc_source* src, uint8_t type);
 xarc_result_t m_untar_close(xarc* x);
 xarc_result_t m_untar_next_item(xarc* x);
 xarc_result_t m_untar_item_get_info(xarc* x, xarc_item_info* info);
-xarc_result_t m_untar_item_extract(xarc* x, FILE* to, size_t* written);
+xarc_result_t m_untar_item_extract(xarc* x, filesys_writer* to,
+ size_t* written);
+xarc_result_t m_untar_item_open_stream(xarc* x);
+xarc_result_t m_untar_item_read(xarc* x, void* buf, size_t len, size_t* got);
 xarc_result_t m_untar_item_set_props(xarc* x, const xchar* path);
 const xchar* m_untar_error_description(xarc* x, int32_t error_id);
 
@@ -149,8 +192,14 @@ handler_funcs untar_funcs = {
 	m_untar_next_item,
 	m_untar_item_get_info,
 	m_untar_item_extract,
+	m_untar_item_open_stream,
+	m_untar_item_read,
 	m_untar_item_set_props,
-	m_untar_error_description
+	m_untar_error_description,
+	/* A TAR stream can only be read front to back */
+	0,
+	0,
+	0
 };
 
 
@@ -163,9 +212,9 @@ handler_funcs untar_funcs = {
  * Integers are stored in octal string form in a TAR archive; this converts them
  * to native integer form.
  */
-static int32_t untgz_getoct(char* p, int32_t width)
+static int64_t untgz_getoct(const char* p, int32_t width)
 {
-	int32_t result = 0;
+	int64_t result = 0;
 	char c;
 	while (width--)
 	{
@@ -181,6 +230,290 @@ static int32_t untgz_getoct(char* p, int32_t width)
 	return result;
 }
 
+/* Function: tar_number
+ * Convert a TAR numeric field to native integer
+ *
+ * Numbers that don't fit in the octal form (files of 8 GiB and up, for one)
+ * are stored by GNU tar and others in base-256 instead: the high bit of the
+ * first byte is set, and the rest of the field is a big-endian binary value.
+ * Returns -1 for anything that isn't a valid, non-negative number.
+ */
+static int64_t tar_number(const char* p, int32_t width)
+{
+	const uint8_t* u = (const uint8_t*)p;
+	if (!(u[0] & 0x80))
+		return untgz_getoct(p, width);
+	/* The next bit is the sign; nothing we read can be negative */
+	if (u[0] & 0x40)
+		return -1;
+	int64_t result = u[0] & 0x3f;
+	int32_t i;
+	for (i = 1; i < width; ++i)
+	{
+		if (result > (INT64_MAX >> 8))
+			return -1;
+		result = (result << 8) | u[i];
+	}
+	return result;
+}
+
+/* Function: header_checksum_ok
+ * Verify a TAR header block's checksum
+ *
+ * The checksum is the sum of all bytes in the block, with the 'chksum' field
+ * itself counted as spaces. Some old tar implementations summed signed chars,
+ * so either sum is accepted.
+ */
+static uint8_t header_checksum_ok(const struct tar_header* th)
+{
+	int64_t stored = untgz_getoct(th->chksum, 8);
+	if (stored == -1)
+		return 0;
+	const uint8_t* ub = (const uint8_t*)th;
+	const int8_t* sb = (const int8_t*)th;
+	int32_t usum = 0, ssum = 0;
+	size_t i;
+	for (i = 0; i < BLOCKSIZE; ++i)
+	{
+		if (i >= 148 && i < 156)
+		{
+			usum += ' ';
+			ssum += ' ';
+		}
+		else
+		{
+			usum += ub[i];
+			ssum += sb[i];
+		}
+	}
+	return (stored == usum || stored == ssum);
+}
+
+/* Function: fill_input
+ * Make at least "want" bytes of the archive available in <inbuf> at <in_pos>,
+ * unless the archive runs out first. Whatever hasn't been used yet is moved to
+ * the front of the buffer, and the rest of it is filled in one read.
+ */
+static xarc_result_t fill_input(xarc* x, size_t want)
+{
+	m_untar_extra* m = M_UNTAR(x);
+	if (m->in_len - m->in_pos >= want || m->in_eof)
+		return XARC_OK;
+
+	memmove(m->inbuf, m->inbuf + m->in_pos, m->in_len - m->in_pos);
+	m->in_len -= m->in_pos;
+	m->in_pos = 0;
+
+	size_t count = UNTAR_BUFSIZE - m->in_len;
+	xarc_result_t ret = m->decomp->read(x, m->decomp, m->inbuf + m->in_len,
+	 &count);
+	/* Running out partway through the buffer is expected; whoever needed more
+	 * than was there will say so
+	 */
+	if (ret == XARC_DECOMPRESS_EOF)
+	{
+		m->in_eof = 1;
+		xarc_clear_error(x);
+	}
+	else if (ret != XARC_OK)
+		return ret;
+	m->in_len += count;
+	return XARC_OK;
+}
+
+/* Function: read_input
+ * Copy the next "len" bytes of the archive into "buf", adding the amount
+ * copied to "got". Large reads with nothing buffered go straight from the
+ * decompressor into "buf".
+ */
+static xarc_result_t read_input(xarc* x, void* buf, size_t len, size_t* got)
+{
+	m_untar_extra* m = M_UNTAR(x);
+	uint8_t* out = (uint8_t*)buf;
+	while (len > 0)
+	{
+		if (m->in_pos == m->in_len && len >= UNTAR_DIRECT_MIN && !m->in_eof)
+		{
+			size_t count = len;
+			xarc_result_t ret = m->decomp->read(x, m->decomp, out, &count);
+			if (ret == XARC_DECOMPRESS_EOF)
+			{
+				m->in_eof = 1;
+				xarc_clear_error(x);
+			}
+			else if (ret != XARC_OK)
+				return ret;
+			*got += count;
+			return XARC_OK;
+		}
+
+		xarc_result_t ret = fill_input(x, 1);
+		if (ret != XARC_OK)
+			return ret;
+		size_t avail = m->in_len - m->in_pos;
+		if (avail == 0)
+			break;
+		if (avail > len)
+			avail = len;
+		memcpy(out, m->inbuf + m->in_pos, avail);
+		m->in_pos += avail;
+		out += avail;
+		len -= avail;
+		*got += avail;
+	}
+	return XARC_OK;
+}
+
+/* Function: skip_input
+ * Pass over the next "len" bytes of the archive. Whatever is beyond the
+ * buffered data is skipped by the decompressor (see <xarc_decompress_skip>)
+ * rather than read into <inbuf>. Sets an M_UNTAR_TRUNCATED error with the
+ * message "what" if the archive ends first.
+ */
+static xarc_result_t skip_input(xarc* x, uint64_t len, const xchar* what)
+{
+	m_untar_extra* m = M_UNTAR(x);
+	size_t avail = m->in_len - m->in_pos;
+	if (avail > len)
+		avail = (size_t)len;
+	m->in_pos += avail;
+	len -= avail;
+	if (len == 0)
+		return XARC_OK;
+
+	uint64_t count = len;
+	if (!m->in_eof)
+	{
+		xarc_result_t ret = xarc_decompress_skip(x, m->decomp, &count);
+		if (ret == XARC_DECOMPRESS_EOF)
+		{
+			m->in_eof = 1;
+			xarc_clear_error(x);
+		}
+		else if (ret != XARC_OK)
+			return ret;
+	}
+	else
+		count = 0;
+	if (count != len)
+		return xarc_set_error(x, XARC_MODULE_ERROR, M_UNTAR_TRUNCATED, what);
+	return XARC_OK;
+}
+
+/* Function: padded_size
+ * The number of bytes taken up in the archive by "size" bytes of data, which
+ * is always padded out to a whole number of blocks.
+ */
+static uint64_t padded_size(uint64_t size)
+{
+	return (size + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+}
+
+/* Function: read_entry_string
+ * Read a header extension of "size" bytes (a GNU long name, or pax extended
+ * header records) that follows the current header block, and the padding
+ * after it. Returns a NUL-terminated copy in "*str", which the caller must
+ * free.
+ */
+static xarc_result_t read_entry_string(xarc* x, int64_t size, char** str)
+{
+	size_t got = 0;
+	*str = malloc(size + 1);
+	xarc_result_t ret = read_input(x, *str, (size_t)size, &got);
+	if (ret == XARC_OK && got != (size_t)size)
+	{
+		ret = xarc_set_error(x, XARC_MODULE_ERROR, M_UNTAR_TRUNCATED,
+		 XC("Unexpected EOF while reading tar header"));
+	}
+	if (ret == XARC_OK)
+	{
+		ret = skip_input(x, padded_size(size) - size,
+		 XC("Unexpected EOF while reading tar header"));
+	}
+	if (ret != XARC_OK)
+	{
+		free(*str);
+		*str = 0;
+		return ret;
+	}
+	(*str)[size] = '\0';
+	return XARC_OK;
+}
+
+/* Function: set_entry_path
+ * Store a UTF-8 path as the current entry's path, converted to native format.
+ */
+static void set_entry_path(xarc* x, const char* path8)
+{
+	size_t lenl = filesys_localize_utf8(path8, -1, 0, 0);
+	M_UNTAR(x)->entry_path = realloc(M_UNTAR(x)->entry_path,
+	 sizeof(xchar) * lenl);
+	filesys_localize_utf8(path8, -1, M_UNTAR(x)->entry_path, lenl);
+}
+
+/* Function: parse_pax_records
+ * Pick out the pax extended header records we use from "data": 'path',
+ * 'size' and 'mtime'. Each record has the form "<length> <key>=<value>\n",
+ * where the length covers the whole record. "*size" and "*mtime" are left
+ * alone if there's no such record.
+ */
+static xarc_result_t parse_pax_records(xarc* x, const char* data,
+ size_t data_len, int64_t* size, int64_t* mtime)
+{
+	size_t pos = 0;
+	while (pos < data_len)
+	{
+		/* The record length, in decimal */
+		size_t rec_len = 0;
+		size_t p = pos;
+		while (p < data_len && data[p] >= '0' && data[p] <= '9'
+		 && rec_len < data_len)
+			rec_len = rec_len * 10 + (data[p++] - '0');
+		if (p == pos || p >= data_len || data[p] != ' ' || rec_len == 0
+		 || rec_len > data_len - pos || data[pos + rec_len - 1] != '\n')
+		{
+			return xarc_set_error(x, XARC_MODULE_ERROR, M_UNTAR_CORRUPT,
+			 XC("Invalid pax extended header"));
+		}
+		const char* key = data + p + 1;
+		const char* end = data + pos + rec_len - 1;
+		const char* eq = memchr(key, '=', end - key);
+		pos += rec_len;
+		if (!eq)
+			continue;
+		size_t key_len = eq - key;
+		const char* value = eq + 1;
+
+		if (key_len == 4 && memcmp(key, "path", 4) == 0)
+		{
+			char* path8 = malloc(end - value + 1);
+			memcpy(path8, value, end - value);
+			path8[end - value] = '\0';
+			set_entry_path(x, path8);
+			free(path8);
+		}
+		else if ((key_len == 4 && memcmp(key, "size", 4) == 0)
+		 || (key_len == 5 && memcmp(key, "mtime", 5) == 0))
+		{
+			/* Decimal; mtime may have a fractional part, which is dropped */
+			int64_t n = 0;
+			const char* v = value;
+			while (v < end && *v >= '0' && *v <= '9' && n <= (INT64_MAX - 9) / 10)
+				n = n * 10 + (*v++ - '0');
+			if (v == value || (v < end && *v != '.'))
+			{
+				return xarc_set_error(x, XARC_MODULE_ERROR, M_UNTAR_CORRUPT,
+				 XC("Invalid value in pax extended header"));
+			}
+			if (key[0] == 's')
+				*size = n;
+			else
+				*mtime = n;
+		}
+	}
+	return XARC_OK;
+}
+
 /* Function: read_tar_headers
  * Read the TAR headers for an entry
  *
@@ -190,123 +523,140 @@ static int32_t untgz_getoct(char* p, int32_t width)
  */
 static xarc_result_t read_tar_headers(xarc* x)
 {
+	m_untar_extra* m = M_UNTAR(x);
 	/* Free the path stored for the previous entry, if there was one. */
-	if (M_UNTAR(x)->entry_path)
+	if (m->entry_path)
 	{
-		free(M_UNTAR(x)->entry_path);
-		M_UNTAR(x)->entry_path = 0;
+		free(m->entry_path);
+		m->entry_path = 0;
 	}
 	/* Clear the previous entry's properties, if there was one. */
-	M_UNTAR(x)->entry_properties = 0;
+	m->entry_properties = 0;
+	m->stream_open = 0;
+
+	/* Values from a pax extended header, which override the next header's */
+	int64_t pax_size = -1;
+	int64_t pax_mtime = -1;
 
 	/* Keep reading header blocks until we know that the next block is either
 	 * data for the current entry, or a new entry. */
-	size_t read_count;
-	struct tar_header th;
 	while (1)
 	{
-		/* A TAR block is BLOCKSIZE bytes (512 currently). Try to get 1 block
-		 * from the decompressor.
-		 */
-		read_count = BLOCKSIZE;
-		xarc_result_t ret = M_UNTAR(x)->decomp->read(x, M_UNTAR(x)->decomp, &th,
-		 &read_count);
-		/* If the return is not okay and not EOF, the decompressor has already
-		 * set the appropriate error state in the <xarc> object, so just return
-		 * the decompressor's error code.
+		/* A TAR block is BLOCKSIZE bytes (512 currently). Make sure there's
+		 * a whole one in the buffer.
 		 */
-		if (ret != XARC_OK && ret != XARC_DECOMPRESS_EOF)
+		xarc_result_t ret = fill_input(x, BLOCKSIZE);
+		if (ret != XARC_OK)
 			return ret;
-		/* If no data was read, we've reached the end of the archive. */
-		if (read_count == 0)
+		size_t avail = m->in_len - m->in_pos;
+		/* If no data is left, we've reached the end of the archive. */
+		if (avail == 0)
 		{
 			return xarc_set_error(x, XARC_NO_MORE_ITEMS, 0,
 			 XC("EOF reached on TAR archive"));
 		}
-		/* If we didn't read exactly BLOCKSIZE bytes, the TAR archive is
-		 * invalid (truncated); all TAR archives are written in multiples of
+		/* If there's less than a block, the TAR archive is invalid
+		 * (truncated); all TAR archives are written in multiples of
 		 * BLOCKSIZE.
 		 */
-		if (read_count != BLOCKSIZE)
+		if (avail < BLOCKSIZE)
 		{
 			return xarc_set_error(x, XARC_MODULE_ERROR, M_UNTAR_TRUNCATED,
 			 XC("Unable to read full tar header block"));
 		}
+		const struct tar_header* th
+		 = (const struct tar_header*)(m->inbuf + m->in_pos);
 
 		/* If the header has an empty string in the 'name' field, it signifies
 		 * the end of the archive.
 		 */
-		if (th.name[0] == 0)
+		if (th->name[0] == 0)
 		{
 			return xarc_set_error(x, XARC_NO_MORE_ITEMS, 0,
 			 XC("EOF reached on TAR archive"));
 		}
 
+		/* Anything that fails the checksum isn't a TAR header at all. */
+		if (!header_checksum_ok(th))
+		{
+			return xarc_set_error(x, XARC_MODULE_ERROR, M_UNTAR_CORRUPT,
+			 XC("Invalid tar header checksum"));
+		}
+
 		/* Retrieve the entry's permissions and last-modified timestamp for
 		 * every header block. Not sure if this is correct...
 		 */
-		M_UNTAR(x)->entry_mode = untgz_getoct(th.mode, 8);
-		M_UNTAR(x)->entry_time = untgz_getoct(th.mtime, 12);
-		/* untgz_getoct returns -1 if the string didn't represent a valid
+		int64_t mode = tar_number(th->mode, 8);
+		m->entry_time = tar_number(th->mtime, 12);
+		/* tar_number returns -1 if the field didn't represent a valid
 		 * integer.
 		 */
-		if (M_UNTAR(x)->entry_mode == -1 || M_UNTAR(x)->entry_time == -1)
+		if (mode == -1 || m->entry_time == -1)
 		{
 			return xarc_set_error(x, XARC_MODULE_ERROR, M_UNTAR_CORRUPT,
 			 XC("Invalid values in tar header"));
 		}
+		m->entry_mode = (int32_t)mode;
+		if (pax_mtime >= 0)
+			m->entry_time = pax_mtime;
 
 		/* Retrieve the entry's relative path from within the constant-length
 		 * 'name' field, *unless* the entry type is GNUTYPE_LONGLINK or
 		 * GNUTYPE_LONGNAME. In that case, the entry's path is too long to fit
 		 * in the field, and it is instead stored right after this header block.
+		 * A pax header may have supplied the path already, too.
 		 */
-		if (th.typeflag != GNUTYPE_LONGLINK && th.typeflag != GNUTYPE_LONGNAME
-		 && !M_UNTAR(x)->entry_path)
+		char typeflag = th->typeflag;
+		if (typeflag != GNUTYPE_LONGLINK && typeflag != GNUTYPE_LONGNAME
+		 && typeflag != XHDTYPE && typeflag != XGLTYPE && !m->entry_path)
 		{
 			/* SHORTNAMESIZE is the constant length of the 'name' field. */
 			char path8[SHORTNAMESIZE + 1];
-			strncpy(path8, th.name, SHORTNAMESIZE);
+			strncpy(path8, th->name, SHORTNAMESIZE);
 			/* strncpy will copy the terminating NUL if the string is *shorter*
 			 * than SHORTNAMESIZE, but if not we have to tack it on ourselves.
 			 */
 			path8[SHORTNAMESIZE] = '\0';
 			/* The TAR format stores strings in UTF-8 format. Need to convert
 			 * to native format. */
-			size_t lenl = filesys_localize_utf8(path8, -1, 0, 0);
-			M_UNTAR(x)->entry_path = malloc(sizeof(xchar) * lenl);
-			filesys_localize_utf8(path8, -1, M_UNTAR(x)->entry_path, lenl);
+			set_entry_path(x, path8);
 		}
 
+		/* The 'size' field of the header contains the size of the data that
+		 * follows it, in bytes, unless a pax header said otherwise.
+		 */
+		int64_t size = (pax_size >= 0) ? pax_size : tar_number(th->size, 12);
+		if (size < 0)
+		{
+			return xarc_set_error(x, XARC_MODULE_ERROR, M_UNTAR_CORRUPT,
+			 XC("Invalid value for size of entry"));
+		}
+
+		/* Done with this header block; anything that follows may refill the
+		 * buffer, after which "th" is no longer valid.
+		 */
+		m->in_pos += BLOCKSIZE;
+
 		/* The type of entry in this header determines whether we are done
 		 * reading headers or need to keep going.
 		 */
-		switch (th.typeflag)
+		switch (typeflag)
 		{
 			/* DIRTYPE - This entry is a directory, and we are done. */
 			case DIRTYPE:
-				M_UNTAR(x)->entry_properties |= XARC_PROP_DIR;
-				M_UNTAR(x)->entry_bytes_remaining = 0;
+				m->entry_properties |= XARC_PROP_DIR;
+				m->entry_bytes_remaining = 0;
+				m->entry_padding = 0;
 				return XARC_OK;
-			/* REGTYPE/AREGTYPE - This entry is a file, and we are ready to read
-			 * the file data.
+			/* REGTYPE/AREGTYPE/CONTTYPE - This entry is a file, and we are
+			 * ready to read the file data.
 			 */
 			case REGTYPE:
 			case AREGTYPE:
-				{
-					/* The 'size' field of the header contains the size of the
-					 * file, in bytes.
-					 */
-					int32_t fsize = untgz_getoct(th.size, 12);
-					if (fsize < 0)
-					{
-						return xarc_set_error(x, XARC_MODULE_ERROR,
-						 M_UNTAR_CORRUPT,
-						 XC("Invalid value for size of entry"));
-					}
-					M_UNTAR(x)->entry_bytes_remaining = fsize;
-					return XARC_OK;
-				}
+			case CONTTYPE:
+				m->entry_bytes_remaining = (uint64_t)size;
+				m->entry_padding = (size_t)(padded_size(size) - size);
+				return XARC_OK;
 			/* GNUTYPE_LONGLINK/GNUTYPE_LONGNAME - This entry has a path that is
 			 * too long for the 'name' field; instead, the path is stored in one
 			 * or more of the next blocks, and after that a normal header.
@@ -314,104 +664,121 @@ static xarc_result_t read_tar_headers(xarc* x)
 			case GNUTYPE_LONGLINK:
 			case GNUTYPE_LONGNAME:
 				{
-					/* The 'size' field of this header contains the length of
-					 * the path string, in bytes.
-					 */
-					int32_t name_len = untgz_getoct(th.size, 12);
-					/* untgz_getoct returns -1 if the string didn't represent a
-					 * valid integer.
-					 */
-					if (name_len < 1)
+					/* The size here is the length of the path string */
+					if (size < 1 || size > UNTAR_MAX_PAX)
 					{
 						return xarc_set_error(x, XARC_MODULE_ERROR,
 						 M_UNTAR_CORRUPT,
 						 XC("Invalid value for length of long name"));
 					}
-
-					/* Read in the long path */
-					char* path8 = malloc(name_len + 1);
-					read_count = name_len;
-					ret = M_UNTAR(x)->decomp->read(x, M_UNTAR(x)->decomp, path8,
-					 &read_count);
-					/* If the return is not okay and not EOF, the decompressor
-					 * has already set the appropriate error state in the <xarc>
-					 * object, so just return the decompressor's error code.
-					 */
-					if (ret != XARC_OK && ret != XARC_DECOMPRESS_EOF)
+					char* path8;
+					ret = read_entry_string(x, size, &path8);
+					if (ret != XARC_OK)
 						return ret;
-					/* However, if we encountered EOF then the TAR is definitely
-					 * not complete; we still needed at least a standard header
-					 * block.
-					 */
-					if (read_count != (size_t)name_len)
-					{
-						return xarc_set_error(x, XARC_MODULE_ERROR,
-						 M_UNTAR_TRUNCATED,
-						 XC("Unexpected EOF while reading long name"));
-					}
-					/* TAR long names don't come with terminating NULs, so we
-					 * have to add it.
-					 */
-					path8[name_len] = '\0';
-
 					/* TAR strings are UTF-8; convert to native format */
-					size_t lenl = filesys_localize_utf8(path8, name_len + 1, 0,
-					 0);
-					M_UNTAR(x)->entry_path = realloc(M_UNTAR(x)->entry_path,
-					 sizeof(xchar) * lenl);
-					filesys_localize_utf8(path8, name_len + 1,
-					 M_UNTAR(x)->entry_path, lenl);
+					set_entry_path(x, path8);
 					free(path8);
-
-					/* Now we have to read and discard empty data to make up the
-					 * rest of the TAR block
-					 */
-					read_count = BLOCKSIZE - (name_len % BLOCKSIZE);
-					if (read_count > 0)
+				}
+				break;
+			/* XHDTYPE - pax extended header records for the entry that
+			 * follows.
+			 */
+			case XHDTYPE:
+				{
+					if (size > UNTAR_MAX_PAX)
 					{
-						/* Try to get the rest of the data from the decompressor
-						 */
-						ret = M_UNTAR(x)->decomp->read(x, M_UNTAR(x)->decomp,
-						 &th, &read_count);
-						/* If unsuccessful, the decompressor has already set the
-						 * error state
-						 */
-						if (ret != XARC_OK && ret != XARC_DECOMPRESS_EOF)
-							return ret;
-						if (read_count !=
-						 (size_t)(BLOCKSIZE - (name_len % BLOCKSIZE)))
-						{
-							return xarc_set_error(x, XARC_MODULE_ERROR,
-							 M_UNTAR_TRUNCATED,
-							 XC("Unexpected EOF while reading long name"));
-						}
+						return xarc_set_error(x, XARC_MODULE_ERROR,
+						 M_UNTAR_CORRUPT,
+						 XC("Invalid value for size of pax header"));
 					}
+					char* data;
+					ret = read_entry_string(x, size, &data);
+					if (ret != XARC_OK)
+						return ret;
+					ret = parse_pax_records(x, data, (size_t)size, &pax_size,
+					 &pax_mtime);
+					free(data);
+					if (ret != XARC_OK)
+						return ret;
 				}
 				break;
 			/* Any other header type is currently not supported, but we should
-			 * go ahead and free the last entry's path
+			 * go ahead and free the last entry's path, and skip any data the
+			 * entry carries. Links, devices and FIFOs have none, whatever
+			 * their size field says.
 			 */
 			default:
-				if (M_UNTAR(x)->entry_path)
+				if (m->entry_path)
 				{
-					free(M_UNTAR(x)->entry_path);
-					M_UNTAR(x)->entry_path = 0;
+					free(m->entry_path);
+					m->entry_path = 0;
 				}
+				if (typeflag < LNKTYPE || typeflag > FIFOTYPE)
+				{
+					ret = skip_input(x, padded_size(size),
+					 XC("Unexpected EOF while reading tar entry"));
+					if (ret != XARC_OK)
+						return ret;
+				}
+				pax_size = -1;
+				pax_mtime = -1;
 				break;
 		}
 	}
 }
 
 
+/* Function: read_entry_data
+ * Read up to "len" bytes of the current entry's data into "buf", adding the
+ * amount read to "got". Once the last of the data has been read, the padding
+ * after it is skipped as well, so that the next TAR block is up next.
+ */
+static xarc_result_t read_entry_data(xarc* x, void* buf, size_t len,
+ size_t* got)
+{
+	if (len > M_UNTAR(x)->entry_bytes_remaining)
+		len = (size_t)M_UNTAR(x)->entry_bytes_remaining;
+	if (len > 0)
+	{
+		size_t count = 0;
+		xarc_result_t ret = read_input(x, buf, len, &count);
+		/* If we got an error code, the necessary error state has already been
+		 * set in the <xarc> object, so just return the code */
+		if (ret != XARC_OK)
+			return ret;
+		*got += count;
+		M_UNTAR(x)->entry_bytes_remaining -= count;
+		/* If we didn't get everything, the archive is corrupt or truncated */
+		if (count != len)
+		{
+			return xarc_set_error(x, XARC_MODULE_ERROR,
+			 M_UNTAR_TRUNCATED, XC("Unexpected EOF while reading tar entry"));
+		}
+	}
+
+	if (M_UNTAR(x)->entry_bytes_remaining == 0
+	 && M_UNTAR(x)->entry_padding > 0)
+	{
+		xarc_result_t ret = skip_input(x, M_UNTAR(x)->entry_padding,
+		 XC("Unexpected EOF while reading tar entry"));
+		if (ret != XARC_OK)
+			return ret;
+		M_UNTAR(x)->entry_padding = 0;
+	}
+
+	return XARC_OK;
+}
+
+
 /* Section: Module Functions */
 
 
 /* Function: m_untar_open
- * Open a file as a TAR archive.
+ * Open a file or memory buffer as a TAR archive.
  *
  * See also: <XARC_DEFINE_MODULE(name, open_func, extra_size)>
  */
-xarc_result_t m_untar_open(xarc* x, const xchar* file, uint8_t type)
+xarc_result_t m_untar_open(xarc* x, const xarc_source* src, uint8_t type)
 {
 	/* Clear our own allocated space */
 	memset(M_UNTAR(x), 0, sizeof(m_untar_extra));
@@ -424,13 +791,23 @@ xarc_result_t m_untar_open(xarc* x, const xchar* file, uint8_t type)
 	 * necessary state will already be set and we can just return the error
 	 * code.
 	 */
-	xarc_result_t ret = xarc_decompress_open(x, file, type,
+	xarc_result_t ret = xarc_decompress_open(x, src, type,
 	 &M_UNTAR(x)->decomp);
 	if (ret != XARC_OK)
 		return ret;
+	M_UNTAR(x)->inbuf = malloc(UNTAR_BUFSIZE);
 
-	/* Read the headers for the first entry */
+	/* Read the headers for the first entry. If the very first block isn't a
+	 * valid header, the (decompressed) stream isn't a TAR archive; this is
+	 * the only place the content of a compressed archive can be checked.
+	 */
 	ret = read_tar_headers(x);
+	if (ret == XARC_MODULE_ERROR
+	 && X_BASE(x)->error->library_error_id == M_UNTAR_CORRUPT)
+	{
+		return xarc_set_error(x, XARC_ERR_NOT_VALID_ARCHIVE, 0,
+		 XC("'%s' doesn't contain a TAR archive"), src->name);
+	}
 	if (ret != XARC_OK)
 		return ret;
 
@@ -448,6 +825,7 @@ xarc_result_t m_untar_close(xarc* x)
 		free(M_UNTAR(x)->entry_path);
 	if (M_UNTAR(x)->decomp)
 		M_UNTAR(x)->decomp->close(M_UNTAR(x)->decomp);
+	free(M_UNTAR(x)->inbuf);
 	return XARC_OK;
 }
 
@@ -459,36 +837,17 @@ xarc_result_t m_untar_close(xarc* x)
 xarc_result_t m_untar_next_item(xarc* x)
 {
 	/* If the current item contained file data, the user may not have chosen to
-	 * extract it. In that case, skip over it.
+	 * extract it (or may have read only part of it). In that case, skip over
+	 * what's left, without copying it anywhere if the decompressor can help
+	 * it.
 	 */
-	if (M_UNTAR(x)->entry_bytes_remaining > 0)
-	{
-		char buf[BLOCKSIZE];
-		int32_t br = M_UNTAR(x)->entry_bytes_remaining;
-		size_t read_count;
-		while (br > 0)
-		{
-			/* Try to read in a block's worth of data */
-			read_count = BLOCKSIZE;
-			xarc_result_t ret = M_UNTAR(x)->decomp->read(x, M_UNTAR(x)->decomp,
-			 buf, &read_count);
-			/* If an error was returned, the <xarc> object's error state was
-			 * already set in the decompressor and we can just return the error
-			 * code.
-			 */
-			if (ret != XARC_OK && ret != XARC_DECOMPRESS_EOF)
-				return ret;
-			/* If we didn't read a full block, the archive is corrupt or
-			 * truncated.
-			 */
-			if (read_count != BLOCKSIZE)
-			{
-				return xarc_set_error(x, XARC_MODULE_ERROR,
-				 M_UNTAR_TRUNCATED, XC("Unexpected EOF while reading tar entry"));
-			}
-			br -= BLOCKSIZE;
-		}
-	}
+	xarc_result_t ret = skip_input(x,
+	 M_UNTAR(x)->entry_bytes_remaining + M_UNTAR(x)->entry_padding,
+	 XC("Unexpected EOF while reading tar entry"));
+	if (ret != XARC_OK)
+		return ret;
+	M_UNTAR(x)->entry_bytes_remaining = 0;
+	M_UNTAR(x)->entry_padding = 0;
 
 	/* Read the headers for the next entry */
 	return read_tar_headers(x);
@@ -511,61 +870,101 @@ xarc_result_t m_untar_item_get_info(xarc* x, xarc_item_info* info)
 }
 
 /* Function: m_untar_item_extract
- * Extract the current file item to an open FILE stream.
+ * Extract the current file item to an open <filesys_writer>.
  *
  * See also: <handler_funcs.item_extract>
  */
-xarc_result_t m_untar_item_extract(xarc* x, FILE* to, size_t* written)
+xarc_result_t m_untar_item_extract(xarc* x, filesys_writer* to,
+ size_t* written)
 {
-	/* All data will be read and written in TAR blocks */
-	char buf[BLOCKSIZE];
-	/* Tracks the number of bytes desired, and read, with the decompressor */
-	size_t count;
+	/* The header told us how big the entry is */
+	m_untar_extra* m = M_UNTAR(x);
+	filesys_writer_reserve(to, m->entry_bytes_remaining);
 
-	/* Process data one block at a time until no more data remains to be read */
-	while (M_UNTAR(x)->entry_bytes_remaining > 0)
+	/* A pass-through decompressor can copy a big entry from file to file
+	 * without reading it in. Whatever was already read ahead goes to the
+	 * writer first.
+	 */
+	size_t buffered = m->in_len - m->in_pos;
+	if (m->decomp->copy && !m->in_eof
+	 && m->entry_bytes_remaining >= buffered + UNTAR_DIRECT_MIN)
 	{
-		/* Read in a block from the decompressor */
-		count = BLOCKSIZE;
-		xarc_result_t ret = M_UNTAR(x)->decomp->read(x, M_UNTAR(x)->decomp, buf,
-		 &count);
-		/* If we got an error code, the necessary error state has already been
-		 * set in the <xarc> object, so just return the code */
-		if (ret != XARC_OK && ret != XARC_DECOMPRESS_EOF)
+		if (filesys_writer_write(to, m->inbuf + m->in_pos, buffered) != 0)
+			return xarc_set_error_filesys(x, 0);
+		m->in_pos += buffered;
+		m->entry_bytes_remaining -= buffered;
+		*written += buffered;
+
+		uint64_t count = m->entry_bytes_remaining;
+		xarc_result_t ret = m->decomp->copy(x, m->decomp, to, &count);
+		m->entry_bytes_remaining -= count;
+		*written += (size_t)count;
+		if (ret == XARC_DECOMPRESS_EOF)
+		{
+			m->in_eof = 1;
+			xarc_clear_error(x);
+		}
+		else if (ret != XARC_OK)
 			return ret;
-		/* If we didn't get a full block, the archive is corrupt or truncated */
-		if (count != BLOCKSIZE)
+		if (m->entry_bytes_remaining > 0)
 		{
 			return xarc_set_error(x, XARC_MODULE_ERROR,
 			 M_UNTAR_TRUNCATED, XC("Unexpected EOF while reading tar entry"));
 		}
+		/* Just the padding left to skip */
+		size_t none = 0;
+		return read_entry_data(x, 0, 0, &none);
+	}
 
-		/* If we only have a few bytes left for the entry (i.e. less than a full
-		 * block's worth), we need to only write the valid bytes */
-		if (count > M_UNTAR(x)->entry_bytes_remaining)
-			count = M_UNTAR(x)->entry_bytes_remaining;
-
-		/* Subtract up to a block's worth of bytes from the count of how many
-		 * are left */
-		if (M_UNTAR(x)->entry_bytes_remaining >= BLOCKSIZE)
-			M_UNTAR(x)->entry_bytes_remaining -= BLOCKSIZE;
-		else
-			M_UNTAR(x)->entry_bytes_remaining = 0;
-
-		/* Write the block out to the file; if fwrite fails,
+	/* Read from the decompressor straight into the writer's buffer until no
+	 * more data remains to be read
+	 */
+	while (m->entry_bytes_remaining > 0)
+	{
+		/* If the writer has to write out its buffer first and that fails,
 		 * <xarc_set_error_filesys> will set appropriate error state based on
 		 * errno.
 		 */
-		size_t wr = fwrite(buf, 1, count, to);
-		if (wr > 0)
-			*written += wr;
-		if (wr != count)
+		void* space;
+		size_t avail;
+		if (filesys_writer_space(to, &space, &avail) != 0)
 			return xarc_set_error_filesys(x, 0);
+
+		size_t count = 0;
+		xarc_result_t ret = read_entry_data(x, space, avail, &count);
+		filesys_writer_commit(to, count);
+		*written += count;
+		if (ret != XARC_OK)
+			return ret;
 	}
 
 	return XARC_OK;
 }
 
+/* Function: m_untar_item_open_stream
+ * Get ready to read the current file item. The data is read in place from the
+ * decompressor, so there's nothing to set up.
+ *
+ * See also: <handler_funcs.item_open_stream>
+ */
+xarc_result_t m_untar_item_open_stream(xarc* x)
+{
+	M_UNTAR(x)->stream_open = 1;
+	return XARC_OK;
+}
+
+/* Function: m_untar_item_read
+ * Decompress the current file item straight into the caller's buffer.
+ *
+ * See also: <handler_funcs.item_read>
+ */
+xarc_result_t m_untar_item_read(xarc* x, void* buf, size_t len, size_t* got)
+{
+	if (!M_UNTAR(x)->stream_open)
+		return xarc_set_error(x, XARC_ERR_NO_STREAM, 0, 0);
+	return read_entry_data(x, buf, len, got);
+}
+
 /* Function: m_untar_item_set_props
  * Apply the entry's metadata to the written file.
  *
@@ -576,8 +975,9 @@ xarc_result_t m_untar_item_set_props(xarc* x, const xchar* path)
 	/* Apply any metadata that we can convert on the current platform from TAR's
 	 * Unix format
 	 */
-	filesys_set_attributes_unix(path, M_UNTAR(x)->entry_mode);
-	filesys_set_modtime_unix(path, M_UNTAR(x)->entry_time);
+	filesys_set_attributes_unix(X_BASE(x)->batch, path,
+	 M_UNTAR(x)->entry_mode);
+	filesys_set_modtime_unix(X_BASE(x)->batch, path, M_UNTAR(x)->entry_time);
 	return XARC_OK;
 }
 
@@ -0,0 +1,147 @@
+/* File: libxarc/threads.h
+ * Platform-independent wrappers for threads and the synchronization primitives
+ * XARC's parallel extraction and decompression code needs.
+ */
+
+/* Copyright 2013 John Eubank.
+
+   This file is part of XARC.
+
+   XARC is free software: you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   XARC is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with XARC.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#ifndef THREADS_H_INC
+#define THREADS_H_INC
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stdint.h>
+
+
+/* Section: Types */
+
+
+/* Type: threads_thread
+ * An opaque handle to a running thread.
+ */
+typedef struct _threads_thread threads_thread;
+/* Type: threads_mutex
+ * An opaque handle to a mutual exclusion lock.
+ */
+typedef struct _threads_mutex threads_mutex;
+/* Type: threads_cond
+ * An opaque handle to a condition variable.
+ */
+typedef struct _threads_cond threads_cond;
+/* Callback: threads_func
+ * The entry point of a thread started with <threads_start>.
+ *
+ * Parameters:
+ *   param - The "param" argument given to <threads_start>
+ */
+typedef void (*threads_func)(void* param);
+
+
+/* Section: Functions */
+
+
+/* Function: threads_cpu_count
+ * Get the number of processors available to this process.
+ *
+ * Returns:
+ *   The number of online processors, or 1 if it can't be determined.
+ */
+uint32_t threads_cpu_count(void);
+/* Function: threads_resolve_count
+ * Turn a user-supplied thread count into the number of threads to use.
+ *
+ * Parameters:
+ *   requested - The number of threads requested, or 0 to use one thread per
+ *     available processor
+ *
+ * Returns:
+ *   The number of threads to run; always at least 1.
+ */
+uint32_t threads_resolve_count(uint32_t requested);
+/* Function: threads_start
+ * Start a new thread.
+ *
+ * Parameters:
+ *   func - The function to run on the new thread
+ *   param - A parameter passed unchanged to func
+ *
+ * Returns:
+ *   A handle that must be passed to <threads_join>, or NULL if the thread
+ *   couldn't be created.
+ */
+threads_thread* threads_start(threads_func func, void* param);
+/* Function: threads_join
+ * Wait for a thread to finish and release its handle.
+ *
+ * Parameters:
+ *   t - The handle returned by <threads_start>
+ */
+void threads_join(threads_thread* t);
+/* Function: threads_mutex_create
+ * Create a mutex.
+ *
+ * Returns:
+ *   A new mutex, or NULL if out of memory.
+ */
+threads_mutex* threads_mutex_create(void);
+/* Function: threads_mutex_free
+ * Destroy a mutex created by <threads_mutex_create>.
+ */
+void threads_mutex_free(threads_mutex* m);
+/* Function: threads_mutex_lock
+ * Acquire a mutex, blocking until it is available.
+ */
+void threads_mutex_lock(threads_mutex* m);
+/* Function: threads_mutex_unlock
+ * Release a mutex held by the calling thread.
+ */
+void threads_mutex_unlock(threads_mutex* m);
+/* Function: threads_cond_create
+ * Create a condition variable.
+ *
+ * Returns:
+ *   A new condition variable, or NULL if out of memory.
+ */
+threads_cond* threads_cond_create(void);
+/* Function: threads_cond_free
+ * Destroy a condition variable created by <threads_cond_create>.
+ */
+void threads_cond_free(threads_cond* c);
+/* Function: threads_cond_wait
+ * Atomically release a mutex and wait for the condition variable to be
+ * signalled; the mutex is held again when this function returns.
+ *
+ * Parameters:
+ *   c - The condition variable to wait on
+ *   m - A mutex held by the calling thread
+ */
+void threads_cond_wait(threads_cond* c, threads_mutex* m);
+/* Function: threads_cond_broadcast
+ * Wake every thread waiting on a condition variable.
+ */
+void threads_cond_broadcast(threads_cond* c);
+
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // THREADS_H_INC
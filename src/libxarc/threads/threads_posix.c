@@ -0,0 +1,133 @@
+/* File: libxarc/threads_posix.c
+ */
+
+/* Copyright 2013 John Eubank.
+
+   This file is part of XARC.
+
+   XARC is free software: you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   XARC is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with XARC.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "threads.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <unistd.h>
+
+
+struct _threads_thread
+{
+	pthread_t tid;
+	threads_func func;
+	void* param;
+};
+
+struct _threads_mutex
+{
+	pthread_mutex_t mtx;
+};
+
+struct _threads_cond
+{
+	pthread_cond_t cv;
+};
+
+
+static void* thread_trampoline(void* arg)
+{
+	threads_thread* t = (threads_thread*)arg;
+	t->func(t->param);
+	return 0;
+}
+
+
+uint32_t threads_cpu_count(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (uint32_t)n : 1;
+}
+
+uint32_t threads_resolve_count(uint32_t requested)
+{
+	return (requested > 0) ? requested : threads_cpu_count();
+}
+
+threads_thread* threads_start(threads_func func, void* param)
+{
+	threads_thread* t = malloc(sizeof(threads_thread));
+	if (!t)
+		return 0;
+	t->func = func;
+	t->param = param;
+	if (pthread_create(&t->tid, 0, thread_trampoline, t) != 0)
+	{
+		free(t);
+		return 0;
+	}
+	return t;
+}
+
+void threads_join(threads_thread* t)
+{
+	pthread_join(t->tid, 0);
+	free(t);
+}
+
+threads_mutex* threads_mutex_create(void)
+{
+	threads_mutex* m = malloc(sizeof(threads_mutex));
+	if (m)
+		pthread_mutex_init(&m->mtx, 0);
+	return m;
+}
+
+void threads_mutex_free(threads_mutex* m)
+{
+	pthread_mutex_destroy(&m->mtx);
+	free(m);
+}
+
+void threads_mutex_lock(threads_mutex* m)
+{
+	pthread_mutex_lock(&m->mtx);
+}
+
+void threads_mutex_unlock(threads_mutex* m)
+{
+	pthread_mutex_unlock(&m->mtx);
+}
+
+threads_cond* threads_cond_create(void)
+{
+	threads_cond* c = malloc(sizeof(threads_cond));
+	if (c)
+		pthread_cond_init(&c->cv, 0);
+	return c;
+}
+
+void threads_cond_free(threads_cond* c)
+{
+	pthread_cond_destroy(&c->cv);
+	free(c);
+}
+
+void threads_cond_wait(threads_cond* c, threads_mutex* m)
+{
+	pthread_cond_wait(&c->cv, &m->mtx);
+}
+
+void threads_cond_broadcast(threads_cond* c)
+{
+	pthread_cond_broadcast(&c->cv);
+}
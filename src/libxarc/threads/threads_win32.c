@@ -0,0 +1,145 @@
+/* File: libxarc/threads_win32.c
+ */
+
+/* Copyright 2013 John Eubank.
+
+   This file is part of XARC.
+
+   XARC is free software: you can redistribute it and/or modify it under the
+   terms of the GNU Lesser General Public License as published by the Free
+   Software Foundation, either version 3 of the License, or (at your option)
+   any later version.
+
+   XARC is distributed in the hope that it will be useful, but WITHOUT ANY
+   WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+   FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+   more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with XARC.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#include "threads.h"
+
+/* Condition variables need Vista or later */
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600
+#endif
+
+#include <malloc.h>
+#include <process.h>
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+
+struct _threads_thread
+{
+	HANDLE handle;
+	threads_func func;
+	void* param;
+};
+
+struct _threads_mutex
+{
+	CRITICAL_SECTION cs;
+};
+
+struct _threads_cond
+{
+	CONDITION_VARIABLE cv;
+};
+
+
+static unsigned __stdcall thread_trampoline(void* arg)
+{
+	threads_thread* t = (threads_thread*)arg;
+	t->func(t->param);
+	return 0;
+}
+
+
+uint32_t threads_cpu_count(void)
+{
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (si.dwNumberOfProcessors > 0) ? si.dwNumberOfProcessors : 1;
+}
+
+uint32_t threads_resolve_count(uint32_t requested)
+{
+	return (requested > 0) ? requested : threads_cpu_count();
+}
+
+threads_thread* threads_start(threads_func func, void* param)
+{
+	threads_thread* t = malloc(sizeof(threads_thread));
+	if (!t)
+		return 0;
+	t->func = func;
+	t->param = param;
+	/* _beginthreadex rather than CreateThread, so the CRT is set up for the
+	 * new thread
+	 */
+	t->handle = (HANDLE)_beginthreadex(0, 0, thread_trampoline, t, 0, 0);
+	if (!t->handle)
+	{
+		free(t);
+		return 0;
+	}
+	return t;
+}
+
+void threads_join(threads_thread* t)
+{
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+	free(t);
+}
+
+threads_mutex* threads_mutex_create(void)
+{
+	threads_mutex* m = malloc(sizeof(threads_mutex));
+	if (m)
+		InitializeCriticalSection(&m->cs);
+	return m;
+}
+
+void threads_mutex_free(threads_mutex* m)
+{
+	DeleteCriticalSection(&m->cs);
+	free(m);
+}
+
+void threads_mutex_lock(threads_mutex* m)
+{
+	EnterCriticalSection(&m->cs);
+}
+
+void threads_mutex_unlock(threads_mutex* m)
+{
+	LeaveCriticalSection(&m->cs);
+}
+
+threads_cond* threads_cond_create(void)
+{
+	threads_cond* c = malloc(sizeof(threads_cond));
+	if (c)
+		InitializeConditionVariable(&c->cv);
+	return c;
+}
+
+void threads_cond_free(threads_cond* c)
+{
+	free(c);
+}
+
+void threads_cond_wait(threads_cond* c, threads_mutex* m)
+{
+	SleepConditionVariableCS(&c->cv, &m->cs, INFINITE);
+}
+
+void threads_cond_broadcast(threads_cond* c)
+{
+	WakeAllConditionVariable(&c->cv);
+}
@@ -29,8 +29,10 @@
 #define XARC_TYPE_BEGIN(id, name) \
  const uint8_t name = id;
 #define XARC_EXTENSION(ext)
+#define XARC_MAGIC(offset, bytes)
 #define XARC_TYPE_END()
 #include <xarc/types.inc>
 #undef XARC_TYPE_BEGIN
 #undef XARC_EXTENSION
+#undef XARC_MAGIC
 #undef XARC_TYPE_END
@@ -32,9 +32,11 @@
  const xchar* const XCONCAT2(xarc_type_extensions_, name)[] = {
 #define XARC_EXTENSION(ext) \
  XC(ext),
+#define XARC_MAGIC(offset, bytes)
 #define XARC_TYPE_END() \
  0 };
 #include <xarc/types.inc>
 #undef XARC_TYPE_BEGIN
 #undef XARC_EXTENSION
+#undef XARC_MAGIC
 #undef XARC_TYPE_END
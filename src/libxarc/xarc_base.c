@@ -25,6 +25,7 @@
 #include <sys/stat.h>
 #include "xarc_impl.h"
 #include "filesys.h"
+#include "threads.h"
 
 #if defined(_WIN32) && __MSVCRT_VERSION__ < 0x0700
 #include <windows.h>
@@ -32,11 +33,12 @@
 #endif
 
 
-typedef xarc_result_t (*open_func)(xarc*, const xchar*, uint8_t);
+typedef xarc_result_t (*open_func)(xarc*, const xarc_source*, uint8_t);
 typedef struct
 {
 	const uint8_t* id;
 	const xchar* const* extensions;
+	const xarc_magic* magic;
 } arctype;
 typedef struct
 {
@@ -59,23 +61,28 @@ typedef struct
 #undef XARC_MODULE_END
 
 #define XARC_TYPE_BEGIN(id, name) \
- extern const xchar* const XCONCAT2(xarc_type_extensions_, name)[];
+ extern const xchar* const XCONCAT2(xarc_type_extensions_, name)[]; \
+ extern const xarc_magic XCONCAT2(xarc_type_magic_, name)[];
 #define XARC_EXTENSION(ext)
+#define XARC_MAGIC(offset, bytes)
 #define XARC_TYPE_END()
 #include <xarc/types.inc>
 #undef XARC_TYPE_BEGIN
 #undef XARC_EXTENSION
+#undef XARC_MAGIC
 #undef XARC_TYPE_END
 
 
 #define XARC_MODULE_BEGIN(module) \
  static arctype XCONCAT2(mod_types_, module)[] = {
 #define XARC_HANDLE_1PHASE(type) \
- { &type, XCONCAT2(xarc_type_extensions_, type) },
+ { &type, XCONCAT2(xarc_type_extensions_, type), \
+ XCONCAT2(xarc_type_magic_, type) },
 #define XARC_HANDLE_2PHASE(type, decomp) \
- { &type, XCONCAT2(xarc_type_extensions_, type) },
+ { &type, XCONCAT2(xarc_type_extensions_, type), \
+ XCONCAT2(xarc_type_magic_, type) },
 #define XARC_MODULE_END() \
- { 0, 0 } };
+ { 0, 0, 0 } };
 #include "modules.inc"
 #undef XARC_MODULE_BEGIN
 #undef XARC_HANDLE_1PHASE
@@ -102,6 +109,14 @@ static void x_init_base(struct _xarc* x)
 	memset(x, 0, sizeof(struct _xarc));
 }
 
+/* The handle's directory cache, created the first time it's needed */
+static filesys_dir_cache* dir_cache(xarc* x)
+{
+	if (!X_BASE(x)->dir_cache)
+		X_BASE(x)->dir_cache = filesys_dir_cache_create();
+	return X_BASE(x)->dir_cache;
+}
+
 static xarc_result_t recurse_ensure_dir(xarc* x, xchar* full_path,
  size_t base_len, size_t this_stop, uint8_t flags,
  xarc_extract_callback callback, void* callback_param)
@@ -109,7 +124,7 @@ static xarc_result_t recurse_ensure_dir(xarc* x, xchar* full_path,
 	xchar save = full_path[this_stop];
 	full_path[this_stop] = XC('\0');
 
-	if (!filesys_dir_exists(full_path))
+	if (!filesys_dir_cache_exists(dir_cache(x), full_path))
 	{
 		if (this_stop <= base_len)
 		{
@@ -124,7 +139,7 @@ static xarc_result_t recurse_ensure_dir(xarc* x, xchar* full_path,
 		 prev_stop, flags, callback, callback_param);
 		if (ret != XARC_OK)
 			return ret;
-		if (filesys_mkdir(full_path) != 0)
+		if (filesys_dir_cache_mkdir(dir_cache(x), full_path) != 0)
 		{
 			return xarc_set_error_filesys(x, XC("Trying to create '%s'"),
 			 full_path);
@@ -138,8 +153,61 @@ static xarc_result_t recurse_ensure_dir(xarc* x, xchar* full_path,
 }
 
 
-xarc* xarc_open(const xchar* file, uint8_t type)
+/* Identify an archive by the signatures registered in <xarc/types.inc>.
+ * For a file, the bytes read here are passed along to the opener in
+ * src->probe, so they don't need to be read again. Returns 0 if nothing
+ * matched.
+ */
+static uint8_t sniff_type(xarc_source* src, uint8_t* probe)
+{
+	const uint8_t* head;
+	size_t head_len;
+	if (src->path)
+	{
+		/* If the file can't be read, let the opener report the problem */
+		FILE* f = xfopen(src->path, XC("rb"));
+		if (!f)
+			return 0;
+		head_len = fread(probe, 1, XARC_PROBE_SIZE, f);
+		fclose(f);
+		head = probe;
+		src->probe = probe;
+		src->probe_len = head_len;
+	}
+	else
+	{
+		head = (const uint8_t*)src->buf;
+		head_len = src->len;
+	}
+
+	const module* m;
+	for (m = modules; m->opener; ++m)
+	{
+		const arctype* at;
+		for (at = m->mod_types; at->id; ++at)
+		{
+			const xarc_magic* mg;
+			for (mg = at->magic; mg->len; ++mg)
+			{
+				if (mg->offset + mg->len <= head_len
+				 && memcmp(head + mg->offset, mg->bytes, mg->len) == 0)
+					return *at->id;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Find the module for an archive and have it open the archive. */
+static xarc* open_source(xarc_source* src, uint8_t type)
 {
+	/* Look at the content first; the extension is only a fallback */
+	uint8_t probe[XARC_PROBE_SIZE];
+	if (type == 0)
+		type = sniff_type(src, probe);
+
+	/* A memory buffer has no extension to go by */
+	const xchar* file = src->path ? src->path : XC("");
 	size_t file_len = 0;
 	if (type == 0)
 		file_len = xstrlen(file);
@@ -178,16 +246,52 @@ xarc* xarc_open(const xchar* file, uint8_t type)
 		x_init_base(x);
 		xarc_set_error(x, XARC_ERR_UNRECOGNIZED_ARCHIVE, 0,
 		 XC("File '%s' with type-id %"PRIu8" didn't match any registered handlers"),
-		 file, type);
+		 src->name, type);
 		return x;
 	}
 
 	struct _xarc* x = malloc(sizeof(struct _xarc) + *m->extra_size);
 	x_init_base(x);
-	(*m->opener)(x, file, type);
+	(*m->opener)(x, src, type);
 	return x;
 }
 
+xarc* xarc_open(const xchar* file, uint8_t type)
+{
+	xarc_source src;
+	memset(&src, 0, sizeof(xarc_source));
+	src.path = file;
+	src.name = file;
+	return open_source(&src, type);
+}
+
+void xarc_open_options_init(xarc_open_options* opts)
+{
+	memset(opts, 0, sizeof(xarc_open_options));
+}
+
+xarc* xarc_open_ex(const xchar* file, const xarc_open_options* opts)
+{
+	xarc_source src;
+	memset(&src, 0, sizeof(xarc_source));
+	src.path = file;
+	src.name = file;
+	if (!opts)
+		return open_source(&src, 0);
+	src.flags = opts->flags;
+	return open_source(&src, opts->type);
+}
+
+xarc* xarc_open_memory(const void* buf, size_t len, uint8_t type)
+{
+	xarc_source src;
+	memset(&src, 0, sizeof(xarc_source));
+	src.buf = buf;
+	src.len = len;
+	src.name = XC("[memory buffer]");
+	return open_source(&src, type);
+}
+
 xarc_result_t xarc_close(xarc* x)
 {
 	if (!x)
@@ -195,6 +299,10 @@ xarc_result_t xarc_close(xarc* x)
 	xarc_result_t ret = XARC_OK;
 	if (X_BASE(x)->impl)
 		ret = X_BASE(x)->impl->close(x);
+	if (X_BASE(x)->batch)
+		filesys_batch_free(X_BASE(x)->batch);
+	if (X_BASE(x)->dir_cache)
+		filesys_dir_cache_free(X_BASE(x)->dir_cache);
 	if (X_BASE(x)->error)
 	{
 		if (X_BASE(x)->error->error_additional)
@@ -255,6 +363,10 @@ const xchar* xarc_error_description(xarc* x)
 			return XC("The path already exists as a file");
 		case XARC_ERR_NO_BASE_PATH:
 			return XC("The base path doesn't exist");
+		case XARC_ERR_ITEM_IS_DIR:
+			return XC("The entry is a directory");
+		case XARC_ERR_NO_STREAM:
+			return XC("The entry hasn't been opened for reading");
 		case XARC_OK:
 		default:
 			return XC("");
@@ -282,25 +394,23 @@ xarc_result_t xarc_item_get_info(xarc* x, xarc_item_info* info)
 	return X_BASE(x)->impl->item_get_info(x, info);
 }
 
-xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
- xarc_extract_callback callback, void* callback_param)
+/* Build the full filesystem path for the current entry below base_path, and
+ * create any subdirectories it needs. On success, *full_path_out is a heap
+ * string the caller must free, and *base_len_out is the index in it where the
+ * entry's relative path begins.
+ */
+static xarc_result_t prepare_item_path(xarc* x, const xchar* base_path,
+ const xarc_item_info* xi, uint8_t flags, xarc_extract_callback callback,
+ void* callback_param, xchar** full_path_out, size_t* base_len_out)
 {
-	if (X_BASE(x)->error)
-		return X_BASE(x)->error->xarc_id;
-
-	if (!filesys_dir_exists(base_path))
+	if (!filesys_dir_cache_exists(dir_cache(x), base_path))
 	{
 		return xarc_set_error(x, XARC_ERR_NO_BASE_PATH, 0,
 		 XC("Cannot extract to nonexistent base path '%s'"), base_path);
 	}
 
-	xarc_item_info xi;
-	xarc_result_t ret = X_BASE(x)->impl->item_get_info(x, &xi);
-	if (ret != XARC_OK)
-		return ret;
-
 	size_t base_len = xstrlen(base_path);
-	size_t item_len = xstrlen(xi.path);
+	size_t item_len = xstrlen(xi->path);
 	// Allocate buffer to hold full item path
 	xchar* full_path = malloc(sizeof(xchar) * (base_len + item_len + 2));
 	// Copy base path to buffer
@@ -312,25 +422,25 @@ xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
 		++base_len;
 	}
 	// Copy item path after base path in buffer
-	xstrcpy(full_path + base_len, xi.path);
+	xstrcpy(full_path + base_len, xi->path);
 
-	// Get directory portion of item path: dir_stop will be the index of the
-	// last char in the path's directory portion
-	size_t dir_stop = base_len + item_len - 1;
+	// Get directory portion of item path: dir_stop will be the index just
+	// past the last char in the path's directory portion
+	size_t dir_stop = base_len + item_len;
 	// If this item is a real file, drop the filename
-	if (!(xi.properties & XARC_PROP_DIR))
+	if (!(xi->properties & XARC_PROP_DIR))
 	{
-		while (!filesys_is_dir_sep(full_path[dir_stop]) && dir_stop > base_len)
+		while (dir_stop > base_len && !filesys_is_dir_sep(full_path[dir_stop - 1]))
 			--dir_stop;
 	}
 	// Drop any trailing path separators
-	while (filesys_is_dir_sep(full_path[dir_stop]) && dir_stop > base_len)
+	while (dir_stop > base_len && filesys_is_dir_sep(full_path[dir_stop - 1]))
 		--dir_stop;
 
 	if (dir_stop > base_len) //we have one or more subdirectories; create them
 	{
-		ret = recurse_ensure_dir(x, full_path, base_len,
-		 dir_stop + 1, flags, callback, callback_param);
+		xarc_result_t ret = recurse_ensure_dir(x, full_path, base_len,
+		 dir_stop, flags, callback, callback_param);
 		if (ret != XARC_OK)
 		{
 			free(full_path);
@@ -338,23 +448,91 @@ xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
 		}
 	}
 
-	if (!(xi.properties & XARC_PROP_DIR))
+	*full_path_out = full_path;
+	*base_len_out = base_len;
+	return XARC_OK;
+}
+
+/* Open full_path for output and run the module's extractor for the current
+ * entry into it.
+ */
+static xarc_result_t extract_item_file(xarc* x, const xchar* full_path,
+ uint8_t flags)
+{
+	/* Open the file for output */
+	filesys_writer* outfile = filesys_writer_open(dir_cache(x),
+	 X_BASE(x)->batch, full_path, flags);
+	if (!outfile)
 	{
-		/* Open the file for output */
-		filesys_ensure_writable(full_path);
-		FILE* outfile = xfopen(full_path, XC("wb"));
-		if (!outfile)
-		{
-			ret = xarc_set_error_filesys(x,
-			 XC("Couldn't open file '%s'"), full_path);
-			free(full_path);
-			return ret;
-		}
+		return xarc_set_error_filesys(x,
+		 XC("Couldn't open file '%s'"), full_path);
+	}
+
+	/* Run the module's decompressor */
+	size_t written = 0;
+	xarc_result_t ret = X_BASE(x)->impl->item_extract(x, outfile, &written);
+	/* Whatever is still buffered gets written now, and can fail too */
+	if (filesys_writer_close(outfile) != 0 && ret == XARC_OK)
+	{
+		/* A batch refuses more work after failing to write an earlier file;
+		 * name that one instead
+		 */
+		const xchar* failed_path = 0;
+		if (X_BASE(x)->batch)
+			failed_path = filesys_batch_error_path(X_BASE(x)->batch);
+		ret = xarc_set_error_filesys(x, XC("Couldn't write file '%s'"),
+		 failed_path ? failed_path : full_path);
+	}
+	return ret;
+}
+
+/* Start batching output for x, if asked to and if the system can */
+static void start_batch(xarc* x, uint8_t flags)
+{
+	if (flags & XARC_XFLAG_BATCH_IO)
+		X_BASE(x)->batch = filesys_batch_create();
+}
 
-		/* Run the module's decompressor */
-		size_t written;
-		ret = X_BASE(x)->impl->item_extract(x, outfile, &written);
-		fclose(outfile);
+/* Wait for everything batched on x to be written, and report the first file
+ * that couldn't be if nothing else went wrong first.
+ */
+static xarc_result_t finish_batch(xarc* x, xarc_result_t ret)
+{
+	filesys_batch* b = X_BASE(x)->batch;
+	if (!b)
+		return ret;
+	X_BASE(x)->batch = 0;
+	if (filesys_batch_finish(b) != 0 && ret == XARC_OK)
+	{
+		ret = xarc_set_error_filesys(x, XC("Couldn't write file '%s'"),
+		 filesys_batch_error_path(b));
+	}
+	filesys_batch_free(b);
+	return ret;
+}
+
+
+xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
+ xarc_extract_callback callback, void* callback_param)
+{
+	if (X_BASE(x)->error)
+		return X_BASE(x)->error->xarc_id;
+
+	xarc_item_info xi;
+	xarc_result_t ret = X_BASE(x)->impl->item_get_info(x, &xi);
+	if (ret != XARC_OK)
+		return ret;
+
+	xchar* full_path;
+	size_t base_len;
+	ret = prepare_item_path(x, base_path, &xi, flags, callback, callback_param,
+	 &full_path, &base_len);
+	if (ret != XARC_OK)
+		return ret;
+
+	if (!(xi.properties & XARC_PROP_DIR))
+	{
+		ret = extract_item_file(x, full_path, flags);
 		if (ret != XARC_OK)
 		{
 			free(full_path);
@@ -381,3 +559,379 @@ xarc_result_t xarc_item_extract(xarc* x, const xchar* base_path, uint8_t flags,
 	return XARC_OK;
 }
 
+xarc_result_t xarc_item_open_stream(xarc* x)
+{
+	if (X_BASE(x)->error)
+		return X_BASE(x)->error->xarc_id;
+
+	xarc_item_info xi;
+	xarc_result_t ret = X_BASE(x)->impl->item_get_info(x, &xi);
+	if (ret != XARC_OK)
+		return ret;
+	if (xi.properties & XARC_PROP_DIR)
+	{
+		return xarc_set_error(x, XARC_ERR_ITEM_IS_DIR, 0,
+		 XC("'%s' is a directory"), xi.path);
+	}
+
+	return X_BASE(x)->impl->item_open_stream(x);
+}
+
+xarc_result_t xarc_item_read(xarc* x, void* buf, size_t len, size_t* got)
+{
+	*got = 0;
+	if (X_BASE(x)->error)
+		return X_BASE(x)->error->xarc_id;
+	return X_BASE(x)->impl->item_read(x, buf, len, got);
+}
+
+
+/* Section: Parallel extraction
+ *
+ * <xarc_extract_all> walks the archive once on the calling thread, creating
+ * directories and recording a bookmark for every file entry. Worker threads,
+ * each with its own clone of the <xarc> object, then claim groups of file
+ * entries and extract them. Meanwhile the calling thread replays every
+ * callback in archive order as the entries they refer to are finished.
+ */
+
+
+/* The states of an extract_event */
+#define EV_PENDING	0
+#define EV_DONE		1
+#define EV_FAILED	2
+
+/* Something to report to the user's callback: either a directory that was
+ * created during the walk, or a file entry to be extracted by a worker.
+ */
+typedef struct
+{
+	/* Heap string: the full path of the file, or the directory's relative
+	 * path */
+	xchar* path;
+	/* Index in path where the relative path begins */
+	size_t rel_at;
+	uint8_t properties;
+	/* Nonzero if this is a file entry for the workers */
+	uint8_t is_file;
+	/* EV_PENDING until a worker has finished with the file */
+	int8_t state;
+	xarc_item_pos pos;
+} extract_event;
+
+typedef struct
+{
+	xarc* x;
+	/* <XARC extraction flags> for the whole run */
+	uint8_t flags;
+	extract_event* events;
+	size_t num_events;
+	size_t max_events;
+	/* Indexes into events of the file entries, in archive order */
+	size_t* files;
+	size_t num_files;
+	/* Index in files of the next entry for a worker to claim */
+	size_t next_file;
+	/* Set when any worker fails; the rest stop claiming work */
+	int8_t abort;
+	/* The clone that reported the first failure */
+	xarc* failed;
+	threads_mutex* lock;
+	threads_cond* progress;
+} extract_run;
+
+typedef struct
+{
+	extract_run* run;
+	xarc* clone;
+	threads_thread* thread;
+} extract_worker;
+
+
+static extract_event* push_event(extract_run* run)
+{
+	if (run->num_events == run->max_events)
+	{
+		run->max_events = run->max_events ? run->max_events * 2 : 256;
+		run->events = realloc(run->events,
+		 sizeof(extract_event) * run->max_events);
+	}
+	extract_event* ev = &run->events[run->num_events++];
+	memset(ev, 0, sizeof(extract_event));
+	return ev;
+}
+
+/* Stands in for the user's callback while walking the archive, so that
+ * directory callbacks can be replayed later in the right order.
+ */
+static void queue_dir_callback(void* param, const xchar* path,
+ uint8_t properties)
+{
+	extract_run* run = (extract_run*)param;
+	extract_event* ev = push_event(run);
+	ev->path = malloc(sizeof(xchar) * (xstrlen(path) + 1));
+	xstrcpy(ev->path, path);
+	ev->properties = properties;
+}
+
+static void extract_worker_main(void* param)
+{
+	extract_run* run = ((extract_worker*)param)->run;
+	xarc* c = ((extract_worker*)param)->clone;
+	const handler_funcs* impl = X_BASE(c)->impl;
+	start_batch(c, run->flags);
+
+	while (1)
+	{
+		/* Claim the next group of entries that share decoding work */
+		threads_mutex_lock(run->lock);
+		if (run->abort || run->next_file >= run->num_files)
+		{
+			threads_mutex_unlock(run->lock);
+			break;
+		}
+		size_t first = run->next_file;
+		size_t last = first + 1;
+		while (last < run->num_files && run->events[run->files[last]].pos.group
+		 == run->events[run->files[first]].pos.group)
+			++last;
+		run->next_file = last;
+		threads_mutex_unlock(run->lock);
+
+		size_t f;
+		for (f = first; f < last; ++f)
+		{
+			extract_event* ev = &run->events[run->files[f]];
+			xarc_result_t ret = XARC_OK;
+			if (run->abort)
+				ret = XARC_MODULE_ERROR;
+			if (ret == XARC_OK)
+				ret = impl->item_seek(c, &ev->pos);
+			if (ret == XARC_OK)
+				ret = extract_item_file(c, ev->path, run->flags);
+			if (ret == XARC_OK)
+				ret = impl->item_set_props(c, ev->path);
+
+			threads_mutex_lock(run->lock);
+			if (ret == XARC_OK)
+				ev->state = EV_DONE;
+			else
+			{
+				ev->state = EV_FAILED;
+				if (!run->abort)
+				{
+					run->abort = 1;
+					run->failed = c;
+				}
+			}
+			threads_cond_broadcast(run->progress);
+			threads_mutex_unlock(run->lock);
+		}
+	}
+
+	/* Files this worker handed off may not have been written yet */
+	if (finish_batch(c, XARC_OK) != XARC_OK)
+	{
+		threads_mutex_lock(run->lock);
+		if (!run->failed)
+		{
+			run->abort = 1;
+			run->failed = c;
+		}
+		threads_mutex_unlock(run->lock);
+	}
+}
+
+/* Walk every remaining entry on the calling thread. Directories are created
+ * here; file entries are queued for the workers.
+ */
+static xarc_result_t walk_entries(extract_run* run, const xchar* base_path,
+ uint8_t flags)
+{
+	xarc* x = run->x;
+	xarc_result_t ret;
+	do
+	{
+		xarc_item_info xi;
+		ret = X_BASE(x)->impl->item_get_info(x, &xi);
+		if (ret != XARC_OK)
+			return ret;
+
+		xchar* full_path;
+		size_t base_len;
+		ret = prepare_item_path(x, base_path, &xi, flags, queue_dir_callback,
+		 run, &full_path, &base_len);
+		if (ret != XARC_OK)
+			return ret;
+
+		if (xi.properties & XARC_PROP_DIR)
+		{
+			ret = X_BASE(x)->impl->item_set_props(x, full_path);
+			free(full_path);
+			if (ret != XARC_OK)
+				return ret;
+		}
+		else
+		{
+			extract_event* ev = push_event(run);
+			ev->path = full_path;
+			ev->rel_at = base_len;
+			ev->is_file = 1;
+			ret = X_BASE(x)->impl->item_tell(x, &ev->pos);
+			if (ret != XARC_OK)
+				return ret;
+		}
+
+		ret = X_BASE(x)->impl->next_item(x);
+	} while (ret == XARC_OK);
+
+	return (ret == XARC_NO_MORE_ITEMS) ? XARC_OK : ret;
+}
+
+static xarc_result_t extract_all_serial(xarc* x, const xchar* base_path,
+ const xarc_extract_options* opts)
+{
+	xarc_result_t ret;
+	start_batch(x, opts->flags);
+	do
+	{
+		ret = xarc_item_extract(x, base_path, opts->flags, opts->callback,
+		 opts->callback_param);
+		if (ret != XARC_OK)
+			break;
+		ret = xarc_next_item(x);
+	} while (ret == XARC_OK);
+	if (ret == XARC_NO_MORE_ITEMS)
+		ret = XARC_OK;
+	return finish_batch(x, ret);
+}
+
+
+void xarc_extract_options_init(xarc_extract_options* opts)
+{
+	memset(opts, 0, sizeof(xarc_extract_options));
+}
+
+xarc_result_t xarc_extract_all(xarc* x, const xchar* base_path,
+ const xarc_extract_options* opts)
+{
+	xarc_extract_options defaults;
+	if (!opts)
+	{
+		xarc_extract_options_init(&defaults);
+		opts = &defaults;
+	}
+
+	if (X_BASE(x)->error)
+		return X_BASE(x)->error->xarc_id;
+
+	uint32_t num_threads = threads_resolve_count(opts->threads);
+	if (num_threads < 2 || !X_BASE(x)->impl->clone)
+		return extract_all_serial(x, base_path, opts);
+
+	extract_run run;
+	memset(&run, 0, sizeof(extract_run));
+	run.x = x;
+	run.flags = opts->flags;
+
+	/* Create directories and collect the file entries */
+	xarc_result_t walk_ret = walk_entries(&run, base_path, opts->flags);
+	size_t i;
+	run.files = malloc(sizeof(size_t) * (run.num_events + 1));
+	for (i = 0; i < run.num_events; ++i)
+	{
+		if (run.events[i].is_file)
+			run.files[run.num_files++] = i;
+	}
+
+	/* Start one worker per thread, each with its own clone of the archive.
+	 * The clones are made here so that any error lands on the caller's
+	 * object.
+	 */
+	if (num_threads > run.num_files)
+		num_threads = run.num_files;
+	extract_worker* workers = malloc(sizeof(extract_worker) * (num_threads + 1));
+	uint32_t num_workers = 0;
+	xarc_result_t ret = XARC_OK;
+	run.lock = threads_mutex_create();
+	run.progress = threads_cond_create();
+	while (num_workers < num_threads)
+	{
+		extract_worker* w = &workers[num_workers];
+		w->run = &run;
+		ret = X_BASE(x)->impl->clone(x, &w->clone);
+		if (ret != XARC_OK)
+			break;
+		w->thread = threads_start(extract_worker_main, w);
+		++num_workers;
+		if (!w->thread)
+			break;
+	}
+	/* If no thread could be started, extract on the calling thread */
+	if (num_workers > 0 && !workers[num_workers - 1].thread)
+		extract_worker_main(&workers[num_workers - 1]);
+
+	/* Replay callbacks in archive order as the workers finish each file */
+	i = 0;
+	if (ret == XARC_OK)
+	{
+		for (; i < run.num_events; ++i)
+		{
+			extract_event* ev = &run.events[i];
+			if (ev->is_file)
+			{
+				threads_mutex_lock(run.lock);
+				/* Every file before a failed one has been claimed, so this
+				 * can't wait forever even if the workers stop early
+				 */
+				while (ev->state == EV_PENDING)
+					threads_cond_wait(run.progress, run.lock);
+				int8_t state = ev->state;
+				threads_mutex_unlock(run.lock);
+				if (state != EV_DONE)
+					break;
+			}
+			if (opts->callback && (ev->is_file
+			 || (opts->flags & XARC_XFLAG_CALLBACK_DIRS)))
+			{
+				opts->callback(opts->callback_param, ev->path + ev->rel_at,
+				 ev->properties);
+			}
+		}
+	}
+
+	/* Wait for the workers, stopping them early if anything failed */
+	threads_mutex_lock(run.lock);
+	if (ret != XARC_OK || i < run.num_events)
+		run.abort = 1;
+	threads_mutex_unlock(run.lock);
+	uint32_t w;
+	for (w = 0; w < num_workers; ++w)
+	{
+		if (workers[w].thread)
+			threads_join(workers[w].thread);
+	}
+
+	/* Report the first error: a failed worker, then a failure while walking
+	 * the archive
+	 */
+	if (ret == XARC_OK && run.failed)
+	{
+		xarc_error* e = X_BASE(run.failed)->error;
+		ret = xarc_set_error(x, e->xarc_id, e->library_error_id,
+		 e->error_additional ? XC("%s") : 0, e->error_additional);
+	}
+	if (ret == XARC_OK)
+		ret = walk_ret;
+
+	for (w = 0; w < num_workers; ++w)
+		xarc_close(workers[w].clone);
+	free(workers);
+	threads_cond_free(run.progress);
+	threads_mutex_free(run.lock);
+	for (i = 0; i < run.num_events; ++i)
+		free(run.events[i].path);
+	free(run.events);
+	free(run.files);
+	return ret;
+}
@@ -25,6 +25,10 @@
 #include "xarc_impl.h"
 
 
+/* The piece size for skipping by decoding into a scratch buffer */
+#define SKIP_SCRATCH_SIZE 65536
+
+
 typedef struct
 {
 	const uint8_t* id;
@@ -48,10 +52,12 @@ typedef struct
 #define XARC_TYPE_BEGIN(id, name) \
  extern const xchar* const XCONCAT2(xarc_type_extensions_, name)[];
 #define XARC_EXTENSION(ext)
+#define XARC_MAGIC(offset, bytes)
 #define XARC_TYPE_END()
 #include <xarc/types.inc>
 #undef XARC_TYPE_BEGIN
 #undef XARC_EXTENSION
+#undef XARC_MAGIC
 #undef XARC_TYPE_END
 
 static decompressor decompressors[] = {
@@ -69,9 +75,11 @@ static decompressor decompressors[] = {
 };
 
 
-xarc_result_t xarc_decompress_open(xarc* x, const xchar* path,
+xarc_result_t xarc_decompress_open(xarc* x, const xarc_source* src,
  uint8_t type, xarc_decompress_impl** impl)
 {
+	/* A memory buffer has no extension to go by */
+	const xchar* path = src->path ? src->path : XC("");
 	size_t path_len = 0;
 	if (type == 0)
 		path_len = xstrlen(path);
@@ -102,8 +110,31 @@ xarc_result_t xarc_decompress_open(xarc* x, const xchar* path,
 	{
 		return xarc_set_error(x, XARC_ERR_UNRECOGNIZED_COMPRESSION, 0,
 		 XC("File '%s' with type-id %"PRIu8" didn't match any registered decompressors"),
-		 path, type);
+		 src->name, type);
 	}
 
-	return (*dc->opener)(x, path, impl);
+	return (*dc->opener)(x, src, impl);
+}
+
+xarc_result_t xarc_decompress_skip(xarc* x, xarc_decompress_impl* impl,
+ uint64_t* skip_inout)
+{
+	if (impl->skip)
+		return impl->skip(x, impl, skip_inout);
+
+	uint8_t scratch[SKIP_SCRATCH_SIZE];
+	uint64_t left = *skip_inout;
+	while (left > 0)
+	{
+		size_t count = (left > SKIP_SCRATCH_SIZE) ? SKIP_SCRATCH_SIZE
+		 : (size_t)left;
+		xarc_result_t ret = impl->read(x, impl, scratch, &count);
+		left -= count;
+		if (ret != XARC_OK)
+		{
+			*skip_inout -= left;
+			return ret;
+		}
+	}
+	return XARC_OK;
 }
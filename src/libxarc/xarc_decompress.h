@@ -28,6 +28,7 @@ extern "C" {
 
 
 #include "xarc.h"
+#include "xarc_impl.h"
 
 
 /* Section: Types */
@@ -40,9 +41,13 @@ struct _xarc_decompress_impl;
  * out the base members with appropriate decompressor-specific functions, and
  * assign the pointer to the "impl_out" parameter.
  *
+ * The compressed data may be in a file or in memory (see <xarc_source>). In
+ * memory, decompressors should read straight from the caller's buffer rather
+ * than copying it.
+ *
  * Parameters:
  *   x - The <xarc> object being used (for setting errors)
- *   path - Path to the file to open for decompression
+ *   src - The compressed data to open for decompression
  *   impl_out - If the file is successfully opened for decompression, will be
  *     set to point to an object that extends <xarc_decompress_impl>
  *
@@ -50,7 +55,7 @@ struct _xarc_decompress_impl;
  *   XARC_OK - If the file was successfully opened for decompression
  *   <xarc_result_t> - Any error that occurred (see <XARC result codes>)
  */
-typedef xarc_result_t (*decomp_open_func)(xarc* x, const xchar* path,
+typedef xarc_result_t (*decomp_open_func)(xarc* x, const xarc_source* src,
  struct _xarc_decompress_impl** impl_out);
 
 /* Struct: xarc_decompress_impl
@@ -99,6 +104,51 @@ typedef struct _xarc_decompress_impl
 	 */
 	const xchar* (*error_desc)(struct _xarc_decompress_impl* impl,
 	 int32_t error_id);
+	/* Function: skip
+	 * Optional. Move forward in the decompressed stream without handing over
+	 * the data. Decompressors that can find their place without decoding
+	 * everything in between (uncompressed or indexed input) should provide
+	 * this; if NULL, <xarc_decompress_skip> decodes the data and discards it.
+	 *
+	 * Parameters:
+	 *   x - The <xarc> object being used (for setting errors)
+	 *   impl - Pointer to an object extending <xarc_decompress_impl>
+	 *   skip_inout - Pointer to the number of bytes to skip when this function
+	 *     is called, which will be set to the number actually skipped when
+	 *     this function returns
+	 *
+	 * Returns:
+	 *   XARC_OK - If the full amount requested was skipped
+	 *   XARC_DECOMPRESS_EOF - If the end of the decompression stream was
+	 *     reached first
+	 *   <xarc_result_t> - Any other error that occurred (see <XARC result
+	 *     codes>)
+	 */
+	xarc_result_t (*skip)(xarc* x, struct _xarc_decompress_impl* impl,
+	 uint64_t* skip_inout);
+	/* Function: copy
+	 * Optional. Write the next stretch of the stream straight to an output
+	 * file (see <filesys_writer_copy>). Only worth providing for data that
+	 * is stored uncompressed in a file, where it can go from file to file
+	 * without being read in; everything else is read into the writer's
+	 * buffer.
+	 *
+	 * Parameters:
+	 *   x - The <xarc> object being used (for setting errors)
+	 *   impl - Pointer to an object extending <xarc_decompress_impl>
+	 *   to - The output file
+	 *   copy_inout - Pointer to the number of bytes to copy when this
+	 *     function is called, which will be set to the number actually
+	 *     copied when this function returns
+	 *
+	 * Returns:
+	 *   XARC_OK - If the full amount requested was copied
+	 *   XARC_DECOMPRESS_EOF - If the end of the stream was reached first
+	 *   <xarc_result_t> - Any other error that occurred (see <XARC result
+	 *     codes>)
+	 */
+	xarc_result_t (*copy)(xarc* x, struct _xarc_decompress_impl* impl,
+	 struct _filesys_writer* to, uint64_t* copy_inout);
 } xarc_decompress_impl;
 
 
@@ -106,11 +156,11 @@ typedef struct _xarc_decompress_impl
 
 
 /* Function: xarc_decompress_open
- * Open a file for decompression reading.
+ * Open a file or memory buffer for decompression reading.
  *
  * Parameters:
  *   x - The <xarc> object being used (for setting errors)
- *   path - Path to the file to open
+ *   src - The file or buffer to open
  *   decomp_type - ID specifying the type of compression on the file (see
  *     <Decompression types>)
  *   impl_out - If the file is successfully opened for decompression, will be
@@ -120,9 +170,27 @@ typedef struct _xarc_decompress_impl
  *   XARC_OK - If the file was successfully opened for decompression
  *   <xarc_result_t> - Any error that occurred (see <XARC result codes>)
  */
-xarc_result_t xarc_decompress_open(xarc* x, const xchar* path,
+xarc_result_t xarc_decompress_open(xarc* x, const xarc_source* src,
  uint8_t decomp_type, xarc_decompress_impl** impl_out);
 
+/* Function: xarc_decompress_skip
+ * Move forward in a decompression stream, discarding the data. Uses the
+ * decompressor's own <xarc_decompress_impl.skip> if it has one, and otherwise
+ * reads the data into a scratch buffer in large pieces.
+ *
+ * Parameters:
+ *   x - The <xarc> object being used (for setting errors)
+ *   impl - The open decompression stream
+ *   skip_inout - Pointer to the number of bytes to skip when this function is
+ *     called, which will be set to the number actually skipped when this
+ *     function returns
+ *
+ * Returns:
+ *   The same as <xarc_decompress_impl.read>
+ */
+xarc_result_t xarc_decompress_skip(xarc* x, xarc_decompress_impl* impl,
+ uint64_t* skip_inout);
+
 
 #ifndef XCONCAT2
 #define INNER_CONCAT2(a, b) a ## b
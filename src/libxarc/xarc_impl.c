@@ -78,3 +78,13 @@ xarc_result_t xarc_set_error_filesys(xarc* x, const xchar* addl_fmt, ...)
 	}
 	return XARC_FILESYSTEM_ERROR;
 }
+
+void xarc_clear_error(xarc* x)
+{
+	if (!X_BASE(x)->error)
+		return;
+	if (X_BASE(x)->error->error_additional)
+		free(X_BASE(x)->error->error_additional);
+	free(X_BASE(x)->error);
+	X_BASE(x)->error = 0;
+}
@@ -35,6 +35,9 @@ extern "C" {
 /* Section: Types */
 
 struct _handler_funcs;
+struct _filesys_dir_cache;
+struct _filesys_batch;
+struct _filesys_writer;
 
 /* Struct: xarc_error
  * Details of an error that has occurred in XARC or one of its component
@@ -62,6 +65,94 @@ typedef struct
 	xchar* error_additional;
 } xarc_error;
 
+/* Struct: xarc_source
+ * Where an archive's data is read from: either a file in the filesystem, or a
+ * caller-owned buffer in memory (see <xarc_open_memory>).
+ */
+typedef struct
+{
+	/* Field: path
+	 * Path to the archive file, or NULL if the archive is in memory.
+	 */
+	const xchar* path;
+	/* Field: buf
+	 * The archive's data, if <path> is NULL. Modules must read it in place;
+	 * it stays valid until the <xarc> object is closed.
+	 */
+	const void* buf;
+	/* Field: len
+	 * Size of <buf> in bytes.
+	 */
+	size_t len;
+	/* Field: name
+	 * The path, or a placeholder for in-memory archives; for use in error
+	 * messages.
+	 */
+	const xchar* name;
+	/* Field: probe
+	 * The first bytes of the file, if they were already read while detecting
+	 * the archive type; otherwise NULL. An opener that reads the file from
+	 * the start should use these bytes and continue reading the file at
+	 * <probe_len>, rather than reading them again. Always NULL for archives
+	 * in memory.
+	 */
+	const uint8_t* probe;
+	/* Field: probe_len
+	 * Size of <probe> in bytes; at most <XARC_PROBE_SIZE>.
+	 */
+	size_t probe_len;
+	/* Field: flags
+	 * The <XARC open flags> given to <xarc_open_ex>.
+	 */
+	uint8_t flags;
+} xarc_source;
+
+/* Define: XARC_PROBE_SIZE
+ * How much of a file is read to detect its archive type.
+ */
+#define XARC_PROBE_SIZE 4096
+
+/* Struct: xarc_magic
+ * A signature that identifies an archive type by its content; generated from
+ * the XARC_MAGIC entries in <xarc/types.inc>.
+ */
+typedef struct
+{
+	/* Field: offset
+	 * Where the signature must appear in the file.
+	 */
+	size_t offset;
+	/* Field: bytes
+	 * The signature itself.
+	 */
+	const uint8_t* bytes;
+	/* Field: len
+	 * Size of <bytes>; 0 marks the end of a list of signatures.
+	 */
+	size_t len;
+} xarc_magic;
+
+/* Struct: xarc_item_pos
+ * A module-defined bookmark for an archive entry, used to move another
+ * <xarc> object over the same archive to that entry.
+ */
+typedef struct
+{
+	/* Field: offset
+	 * Module-specific location of the entry, such as a directory offset.
+	 */
+	uint64_t offset;
+	/* Field: index
+	 * Module-specific index of the entry.
+	 */
+	uint64_t index;
+	/* Field: group
+	 * Entries with the same group share decoding work (for example, files in
+	 * the same solid block) and are best extracted in order by one thread.
+	 */
+	uint64_t group;
+} xarc_item_pos;
+
 /* Struct: _xarc
  * The actual implementation of the opaque <xarc> object.
  */
@@ -77,6 +168,16 @@ struct _xarc
 	 * NULL, no error has occurred yet.
 	 */
 	xarc_error* error;
+	/* Field: dir_cache
+	 * Directories known to exist from extracting earlier entries (see
+	 * <filesys_dir_cache>). Created on first extraction; NULL until then.
+	 */
+	struct _filesys_dir_cache* dir_cache;
+	/* Field: batch
+	 * Output being written in the background during <xarc_extract_all> with
+	 * <XARC_XFLAG_BATCH_IO> (see <filesys_batch>); NULL otherwise.
+	 */
+	struct _filesys_batch* batch;
 };
 
 /* Struct: handler_funcs
@@ -139,19 +240,57 @@ typedef struct _handler_funcs
 	 *
 	 * This function will only be called for entries that are actual files, not
 	 * directories (or symlinks, etc.). The module must update the "written"
-	 * parameter to reflect the number of bytes written into the file stream.
+	 * parameter to reflect the number of bytes written into the file.
+	 *
+	 * If the module knows the entry's size up front, it should pass it to
+	 * <filesys_writer_reserve> before writing. Where the decoder can write
+	 * into a caller's buffer, <filesys_writer_space> saves a copy.
 	 *
 	 * Parameters:
 	 *   x - The <xarc> object
-	 *   to - An already-opened file to stream the data to
+	 *   to - An already-opened <filesys_writer> to write the data to
 	 *   written - Pointer to a size_t that must be set to the number of bytes
-	 *     written into the file stream
+	 *     written into the file
 	 *
 	 * Returns:
 	 *   XARC_OK - If the entry was successfully extracted
 	 *   <xarc_result_t> - Any error that occurred (see <XARC result codes>)
 	 */
-	xarc_result_t (*item_extract)(xarc* x, FILE* to, size_t* written);
+	xarc_result_t (*item_extract)(xarc* x, struct _filesys_writer* to,
+	 size_t* written);
+	/* Function: item_open_stream
+	 * Get the current entry ready to be read with <item_read>.
+	 *
+	 * Like <item_extract>, this will only be called for file entries.
+	 *
+	 * Parameters:
+	 *   x - The <xarc> object
+	 *
+	 * Returns:
+	 *   XARC_OK - If the entry is ready to be read
+	 *   <xarc_result_t> - Any error that occurred (see <XARC result codes>)
+	 */
+	xarc_result_t (*item_open_stream)(xarc* x);
+	/* Function: item_read
+	 * Decode the next piece of the current entry straight into a caller's
+	 * buffer.
+	 *
+	 * The buffer must be filled completely unless the end of the entry is
+	 * reached. If <item_open_stream> hasn't been called since the archive
+	 * moved to the current entry, must set & return XARC_ERR_NO_STREAM.
+	 *
+	 * Parameters:
+	 *   x - The <xarc> object
+	 *   buf - The buffer to fill
+	 *   len - Size of the buffer in bytes
+	 *   got - Pointer to a size_t (already 0) that must be set to the number
+	 *     of bytes placed in the buffer
+	 *
+	 * Returns:
+	 *   XARC_OK - If no errors occurred, including at the end of the entry
+	 *   <xarc_result_t> - Any error that occurred (see <XARC result codes>)
+	 */
+	xarc_result_t (*item_read)(xarc* x, void* buf, size_t len, size_t* got);
 	/* Function: item_set_props
 	 * After extraction, apply metadata for the current item in the filesystem.
 	 *
@@ -188,6 +327,52 @@ typedef struct _handler_funcs
 	 *   A string describing the error type indicated by the supplied ID
 	 */
 	const xchar* (*error_description)(xarc* x, int32_t error_id);
+	/* Function: clone
+	 * Optional. Open another, independent <xarc> object over the same
+	 * archive, for use by a worker thread in <xarc_extract_all>.
+	 *
+	 * The clone must be allocated with malloc (base plus extra portion) so it
+	 * can be released with <xarc_close>. It may share read-only state with the
+	 * original, as long as it can read and extract entries concurrently with
+	 * the original and with other clones. Modules that can't do this should
+	 * leave this function NULL, and will be extracted serially.
+	 *
+	 * Parameters:
+	 *   x - The <xarc> object to clone
+	 *   clone_out - Set to the new <xarc> object if successful
+	 *
+	 * Returns:
+	 *   XARC_OK - If the clone was created
+	 *   <xarc_result_t> - Any error that occurred (see <XARC result codes>)
+	 */
+	xarc_result_t (*clone)(xarc* x, xarc** clone_out);
+	/* Function: item_tell
+	 * Optional (required if <clone> is provided). Get a bookmark for the
+	 * current entry.
+	 *
+	 * Parameters:
+	 *   x - The <xarc> object
+	 *   pos - Set to the current entry's position (see <xarc_item_pos>)
+	 *
+	 * Returns:
+	 *   XARC_OK - If the position was retrieved
+	 *   <xarc_result_t> - Any error that occurred (see <XARC result codes>)
+	 */
+	xarc_result_t (*item_tell)(xarc* x, xarc_item_pos* pos);
+	/* Function: item_seek
+	 * Optional (required if <clone> is provided). Make the entry at a
+	 * bookmark from <item_tell> the current entry.
+	 *
+	 * Parameters:
+	 *   x - The <xarc> object
+	 *   pos - A position returned by <item_tell> on this object or the object
+	 *     it was cloned from
+	 *
+	 * Returns:
+	 *   XARC_OK - If the entry is now current
+	 *   <xarc_result_t> - Any error that occurred (see <XARC result codes>)
+	 */
+	xarc_result_t (*item_seek)(xarc* x, const xarc_item_pos* pos);
 } handler_funcs;
 
 
@@ -236,6 +421,17 @@ xarc_result_t xarc_set_error(xarc* x, xarc_result_t status,
  *   XARC_FILESYSTEM_ERROR (see <XARC result codes>)
  */
 xarc_result_t xarc_set_error_filesys(xarc* x, const xchar* addl_fmt, ...);
+/* Function: xarc_clear_error
+ * Take the <xarc> object back out of an errored state.
+ *
+ * For a module that expected the error and has dealt with it, such as the
+ * XARC_DECOMPRESS_EOF from a decompressor read that was allowed to come up
+ * short.
+ *
+ * Parameters:
+ *   x - The <xarc> object
+ */
+void xarc_clear_error(xarc* x);
 
 
 /* Section: Macros */
@@ -259,8 +455,10 @@ xarc_result_t xarc_set_error_filesys(xarc* x, const xchar* addl_fmt, ...);
  *
  * The "open_func" argument must be a function pointer matching the following
  * signature:
- * |	xarc_result_t (*)(xarc* x, const xchar* file, uint8_t type);
- * In addition to whatever is necessary to open the archive file, this
+ * |	xarc_result_t (*)(xarc* x, const xarc_source* src, uint8_t type);
+ * The archive may be a file or a buffer in memory (see <xarc_source>); modules
+ * must support both. In addition to whatever is necessary to open the archive,
+ * this
  * "open_func" must do the following things:
  *  - Initialize the memory allocated immediately after the base (struct
  *      <_xarc>) portion of the object, per the extra_size argument of the
@@ -287,21 +485,29 @@ xarc_result_t xarc_set_error_filesys(xarc* x, const xchar* addl_fmt, ...);
  * |		m_mymod_next_item,
  * |		m_mymod_item_get_info,
  * |		m_mymod_item_extract,
+ * |		m_mymod_item_open_stream,
+ * |		m_mymod_item_read,
  * |		m_mymod_item_set_props,
- * |		m_mymod_error_description
+ * |		m_mymod_error_description,
+ * |		0,
+ * |		0,
+ * |		0
  * |	};
  * |
  * |	#define M_MYMOD(x) ((m_mymod_extra*)((void*)x + sizeof(struct _xarc)))
  * |
- * |	xarc_result_t m_mymod_open(xarc* x, const xchar* file, uint8_t type)
+ * |	xarc_result_t m_mymod_open(xarc* x, const xarc_source* src,
+ * |	 uint8_t type)
  * |	{
  * |		memset(M_MYMOD(x), 0, sizeof(m_mymod_extra));
  * |		X_BASE(x)->impl = &mymod_funcs;
- * |		M_MYMOD(x)->state_thingy = try_to_open_my_archive(file);
+ * |		M_MYMOD(x)->state_thingy = src->path ?
+ * |		 try_to_open_my_archive(src->path) :
+ * |		 try_to_open_my_archive_in_memory(src->buf, src->len);
  * |		if (!M_MYMOD(x)->state_thingy)
  * |		{
  * |			return xarc_set_error(x, XARC_ERR_NOT_VALID_ARCHIVE, 0,
- * |			 XC("Failed to open '%s'! Oh horror!"), file);
+ * |			 XC("Failed to open '%s'! Oh horror!"), src->name);
  * |		}
  * |		return XARC_OK;
  * |	}
@@ -311,7 +517,7 @@ xarc_result_t xarc_set_error_filesys(xarc* x, const xchar* addl_fmt, ...);
 #define XARC_DEFINE_MODULE(name, open_func, extra_size) \
  const size_t XCONCAT2(xarc_extra_size_, name) = extra_size; \
  xarc_result_t (*XCONCAT2(xarc_open_func_, name)) \
- (xarc*, const xchar*, uint8_t) \
+ (xarc*, const xarc_source*, uint8_t) \
   = open_func;
 
 
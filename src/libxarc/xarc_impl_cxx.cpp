@@ -77,6 +77,12 @@ ExtractArchive::ExtractArchive(const xchar* file, uint8_t type)
 	this->OpenFile(file, type);
 }
 
+ExtractArchive::ExtractArchive(const void* buf, size_t len, uint8_t type)
+ : m_xarc(0)
+{
+	this->OpenMemory(buf, len, type);
+}
+
 ExtractArchive::~ExtractArchive()
 {
 	if (m_xarc)
@@ -134,11 +140,25 @@ StringType ExtractArchive::GetErrorAdditional() const
 }
 
 
-xarc_result_t ExtractArchive::OpenFile(const xchar* file, uint8_t type)
+xarc_result_t ExtractArchive::OpenFile(const xchar* file, uint8_t type,
+ uint8_t flags)
+{
+	if (m_xarc)
+		xarc_close(m_xarc);
+	xarc_open_options opts;
+	xarc_open_options_init(&opts);
+	opts.type = type;
+	opts.flags = flags;
+	m_xarc = xarc_open_ex(file, &opts);
+	return xarc_error_id(m_xarc);
+}
+
+xarc_result_t ExtractArchive::OpenMemory(const void* buf, size_t len,
+ uint8_t type)
 {
 	if (m_xarc)
 		xarc_close(m_xarc);
-	m_xarc = xarc_open(file, type);
+	m_xarc = xarc_open_memory(buf, len, type);
 	return xarc_error_id(m_xarc);
 }
 
@@ -181,5 +201,46 @@ xarc_result_t ExtractArchive::ExtractItemUserCallback
 	 XarcCxxExtractCallback, callback);
 }
 
+xarc_result_t ExtractArchive::ExtractAllUserCallback
+ (const StringType& base_path, uint8_t flags, ExtractCallback* callback,
+ uint32_t threads)
+{
+	if (!m_xarc)
+	{
+		throw XarcException(
+		 XC("Tried to use ExtractArchive without opening an actual archive")
+		);
+	}
+	xarc_extract_options opts;
+	xarc_extract_options_init(&opts);
+	opts.flags = flags;
+	opts.callback = XarcCxxExtractCallback;
+	opts.callback_param = callback;
+	opts.threads = threads;
+	return xarc_extract_all(m_xarc, base_path.c_str(), &opts);
+}
+
+xarc_result_t ExtractArchive::OpenItemStream()
+{
+	if (!m_xarc)
+	{
+		throw XarcException(
+		 XC("Tried to use ExtractArchive without opening an actual archive")
+		);
+	}
+	return xarc_item_open_stream(m_xarc);
+}
+
+xarc_result_t ExtractArchive::ReadItem(void* buf, size_t len, size_t* got)
+{
+	if (!m_xarc)
+	{
+		throw XarcException(
+		 XC("Tried to use ExtractArchive without opening an actual archive")
+		);
+	}
+	return xarc_item_read(m_xarc, buf, len, got);
+}
+
 
 }